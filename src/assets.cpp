@@ -0,0 +1,170 @@
+#include "assets.hpp"
+
+#include <algorithm>
+
+void asset_service_init(AssetService& service,
+                        const GPUContext* gpu,
+                        uint32_t worker_count,
+                        ThreadPool* parse_pool,
+                        size_t upload_budget) {
+    service.gpu = gpu;
+    service.parse_pool = parse_pool;
+    service.upload_budget = upload_budget;
+    thread_pool_init(service.workers, worker_count);
+}
+
+void asset_service_finalize(AssetService& service) {
+    // Let in-flight parses finish before tearing anything down.
+    try {
+        thread_pool_wait(service.workers);
+    } catch (...) {
+    }
+    thread_pool_finalize(service.workers);
+
+    for (std::unique_ptr<AssetMesh>& mesh : service.meshes) {
+        int state = mesh->state.load();
+        if (state == ASSET_UPLOADING || state == ASSET_READY) {
+            gpu_mesh_destroy(*service.gpu, mesh->gpu);
+        }
+        if (state != ASSET_FAILED) {
+            mesh_cache_close(mesh->data);
+        }
+    }
+    service.meshes.clear();
+}
+
+MeshHandle asset_load_mesh(AssetService& service,
+                           const std::string& filename,
+                           uint32_t load_flags,
+                           VertexFormat vertex_format) {
+    MeshHandle handle = service.meshes.size();
+
+    service.meshes.emplace_back(new AssetMesh());
+    AssetMesh* mesh = service.meshes.back().get();
+    mesh->filename = filename;
+    mesh->load_flags = load_flags;
+    mesh->vertex_format = vertex_format;
+    mesh->state = ASSET_LOADING;
+    mesh->uploaded_vertices = 0;
+    mesh->uploaded_indices = 0;
+    mesh->upload_ticket = 0;
+
+    ThreadPool* parse_pool = service.parse_pool;
+    thread_pool_submit(service.workers, [mesh, parse_pool]() {
+        try {
+            mesh->data = load_mesh_cached(mesh->filename, parse_pool, mesh->load_flags);
+            mesh->state.store(ASSET_PARSED, std::memory_order_release);
+        } catch (const std::exception& e) {
+            mesh->error = e.what();
+            mesh->state.store(ASSET_FAILED, std::memory_order_release);
+        }
+    });
+
+    return handle;
+}
+
+// Copies at most budget bytes of the mesh into its GPU buffers, returns the
+// number of bytes copied.
+static size_t upload_some(const GPUContext& gpu, AssetMesh& mesh, size_t budget) {
+    size_t copied = 0;
+
+    bool compact = mesh.gpu.vertex_format == VERTEX_FORMAT_COMPACT;
+    size_t vertex_size = compact ? sizeof(CompactVertex) : sizeof(Vertex);
+
+    size_t vertex_count = std::min(mesh.data.vertex_count - mesh.uploaded_vertices,
+                                   budget / vertex_size);
+    if (vertex_count > 0) {
+        if (compact) {
+            gpu_buffer_upload(gpu, mesh.gpu.compact_vertex_buffer,
+                              mesh.data.compact_vertices + mesh.uploaded_vertices,
+                              mesh.uploaded_vertices,
+                              vertex_count,
+                              &mesh.upload_ticket);
+        } else {
+            gpu_buffer_upload(gpu, mesh.gpu.vertex_buffer,
+                              mesh.data.vertices + mesh.uploaded_vertices,
+                              mesh.uploaded_vertices,
+                              vertex_count,
+                              &mesh.upload_ticket);
+        }
+        mesh.uploaded_vertices += vertex_count;
+        copied += vertex_count * vertex_size;
+    }
+
+    size_t index_size = mesh.gpu.index_type == INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    size_t index_count = std::min(mesh.data.index_count + mesh.data.lod_index_count - mesh.uploaded_indices,
+                                   (budget - copied) / index_size);
+    if (index_count > 0) {
+        gpu_mesh_upload_indices(gpu, mesh.gpu,
+                                mesh.data.indices + mesh.uploaded_indices,
+                                mesh.uploaded_indices,
+                                index_count,
+                                &mesh.upload_ticket);
+        mesh.uploaded_indices += index_count;
+        copied += index_count * index_size;
+    }
+
+    return copied;
+}
+
+void asset_service_update(AssetService& service) {
+    size_t budget = service.upload_budget;
+    // Uploads wait for the next frame while the copies of earlier ones take
+    // up the staging ring, rather than blocking this one.
+    if (!gpu_upload_has_room(*service.gpu, budget)) {
+        budget = 0;
+    }
+
+    for (std::unique_ptr<AssetMesh>& mesh : service.meshes) {
+        int state = mesh->state.load(std::memory_order_acquire);
+        if (state == ASSET_PARSED && budget > 0) {
+            mesh->gpu = gpu_mesh_allocate(*service.gpu,
+                                          mesh->data.vertex_count,
+                                          (mesh->data.index_count + mesh->data.lod_index_count) / 3,
+                                          mesh->vertex_format);
+            mesh->gpu.dequantize = mesh->vertex_format == VERTEX_FORMAT_COMPACT
+                ? vertex_dequantize_matrix(mesh->data.quantization)
+                : glm::mat4(1.0f);
+            mesh->gpu.lods.assign(mesh->data.lods, mesh->data.lods + mesh->data.lod_count);
+            mesh->gpu.bounds = mesh->data.bounds;
+            // Meshlets are a few percent of the mesh, not worth spreading over frames.
+            gpu_mesh_upload_meshlets(*service.gpu, mesh->gpu, mesh->data, &mesh->upload_ticket);
+            mesh->state.store(ASSET_UPLOADING, std::memory_order_relaxed);
+            state = ASSET_UPLOADING;
+        }
+
+        if (state == ASSET_UPLOADING) {
+            budget -= upload_some(*service.gpu, *mesh, budget);
+
+            // Ready once the copies are done, frames go on in the meantime.
+            if (mesh->uploaded_vertices == mesh->data.vertex_count
+                && mesh->uploaded_indices == mesh->data.index_count + mesh->data.lod_index_count
+                && gpu_upload_done(*service.gpu, mesh->upload_ticket)) {
+                mesh->state.store(ASSET_READY, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+AssetState asset_mesh_state(const AssetService& service, MeshHandle handle) {
+    return static_cast<AssetState>(service.meshes[handle]->state.load(std::memory_order_acquire));
+}
+
+const GPUMesh* asset_mesh_get(const AssetService& service, MeshHandle handle) {
+    if (asset_mesh_state(service, handle) != ASSET_READY) {
+        return nullptr;
+    }
+    return &service.meshes[handle]->gpu;
+}
+
+const CachedMesh* asset_mesh_data(const AssetService& service, MeshHandle handle) {
+    if (asset_mesh_state(service, handle) != ASSET_READY) {
+        return nullptr;
+    }
+    return &service.meshes[handle]->data;
+}
+
+void asset_mesh_rethrow(const AssetService& service, MeshHandle handle) {
+    const AssetMesh& mesh = *service.meshes[handle];
+    throw std::runtime_error("Could not load " + mesh.filename + " : " + mesh.error);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "render.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+using MeshHandle = uint32_t;
+
+enum AssetState : int {
+    ASSET_LOADING,   // Being parsed on a worker
+    ASSET_PARSED,    // Waiting for GPU buffers
+    ASSET_UPLOADING, // Streaming into GPU buffers, or waiting for the last copies
+    ASSET_READY,
+    ASSET_FAILED,
+};
+
+struct AssetMesh {
+    std::string filename;
+    uint32_t load_flags;
+    VertexFormat vertex_format;
+    std::atomic<int> state;
+    std::string error;
+
+    CachedMesh data;
+
+    GPUMesh gpu;
+    size_t uploaded_vertices;
+    size_t uploaded_indices;
+    // Covers every copy recorded so far.
+    GPUUploadTicket upload_ticket;
+};
+
+// Loads meshes on worker threads and streams them into GPU buffers a little
+// every frame, with asynchronous uploads, so that the render loop never
+// waits on assets. Apart from the
+// workers, everything runs on the render thread.
+struct AssetService {
+    const GPUContext* gpu;
+    ThreadPool workers;
+
+    // Optional pool for parsing large files in parallel. Only the workers
+    // submit to it.
+    ThreadPool* parse_pool;
+
+    // unique_ptr keeps the entries in place while workers fill them.
+    std::vector<std::unique_ptr<AssetMesh>> meshes;
+
+    // Bytes copied into GPU buffers per asset_service_update call.
+    size_t upload_budget;
+};
+
+void asset_service_init(AssetService& service,
+                        const GPUContext* gpu,
+                        uint32_t worker_count = 1,
+                        ThreadPool* parse_pool = nullptr,
+                        size_t upload_budget = 8 << 20);
+void asset_service_finalize(AssetService& service);
+
+// Queues a mesh for loading. The returned handle becomes ready later.
+MeshHandle asset_load_mesh(AssetService& service,
+                           const std::string& filename,
+                           uint32_t load_flags = 0,
+                           VertexFormat vertex_format = VERTEX_FORMAT_FULL);
+
+// Advances uploads, call once per frame.
+void asset_service_update(AssetService& service);
+
+AssetState asset_mesh_state(const AssetService& service, MeshHandle handle);
+
+// Both return nullptr until the mesh is ready.
+const GPUMesh* asset_mesh_get(const AssetService& service, MeshHandle handle);
+const CachedMesh* asset_mesh_data(const AssetService& service, MeshHandle handle);
+
+// Throws with the load error of a failed mesh.
+void asset_mesh_rethrow(const AssetService& service, MeshHandle handle);
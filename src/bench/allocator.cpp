@@ -0,0 +1,116 @@
+#include "bench.hpp"
+
+#include "../time_util.hpp"
+#include "../platform_gpu.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Allocation and free latency of the device memory sub-allocator, against
+// one vkAllocateMemory per buffer. Sizes are spread logarithmically between
+// 256 bytes and 256 KB, and freed in random order.
+int bench_allocator(int argc, char** argv) {
+    const uint32_t allocation_count = 2000;
+    const uint32_t churn_count = 100000;
+
+    GPUContext vk;
+    gpu_init(vk, GPU_INIT_HEADLESS);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> log_size(std::log(256.0), std::log(256.0 * 1024.0));
+
+    std::vector<VkMemoryRequirements> requirements(allocation_count);
+    VkDeviceSize requested = 0;
+    for (VkMemoryRequirements& r : requirements) {
+        r.size = (VkDeviceSize(std::exp(log_size(rng))) + 15) & ~VkDeviceSize(15);
+        r.alignment = 256;
+        r.memoryTypeBits = UINT32_MAX;
+        requested += r.size;
+    }
+
+    std::vector<uint32_t> free_order(allocation_count);
+    for (uint32_t i = 0; i < allocation_count; i++) {
+        free_order[i] = i;
+    }
+    std::shuffle(free_order.begin(), free_order.end(), rng);
+
+    std::cout << allocation_count << " allocations, " << requested / (1024.0 * 1024.0) << " MB\n";
+
+    // Sub-allocated.
+    std::vector<GPUAllocation> allocations(allocation_count);
+    double start = now_ms();
+    for (uint32_t i = 0; i < allocation_count; i++) {
+        allocations[i] = gpu_memory_allocate(*vk.allocator,
+                                             requirements[i],
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                             0,
+                                             true);
+    }
+    double allocated = now_ms();
+    for (uint32_t i : free_order) {
+        gpu_memory_free(*vk.allocator, allocations[i]);
+    }
+    double freed = now_ms();
+
+    std::cout << "gpu_memory_allocate : " << (allocated - start) * 1e6 / allocation_count << " ns, "
+              << "gpu_memory_free : " << (freed - allocated) * 1e6 / allocation_count << " ns\n";
+
+    // A small allocation made and freed while everything else is live, the
+    // pattern of per frame buffers.
+    for (uint32_t i = 0; i < allocation_count; i++) {
+        allocations[i] = gpu_memory_allocate(*vk.allocator,
+                                             requirements[i],
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                             0,
+                                             true);
+    }
+    VkMemoryRequirements small{64, 16, UINT32_MAX};
+    start = now_ms();
+    for (uint32_t i = 0; i < churn_count; i++) {
+        GPUAllocation allocation = gpu_memory_allocate(*vk.allocator,
+                                                       small,
+                                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                       0,
+                                                       true);
+        gpu_memory_free(*vk.allocator, allocation);
+    }
+    std::cout << "Allocate and free with " << allocation_count << " live : "
+              << (now_ms() - start) * 1e6 / churn_count << " ns\n";
+    for (uint32_t i = 0; i < allocation_count; i++) {
+        gpu_memory_free(*vk.allocator, allocations[i]);
+    }
+
+    // One driver allocation each, as before the sub-allocator.
+    int32_t memory_type = find_memory_type(&vk.allocator->memory_properties,
+                                           UINT32_MAX,
+                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (memory_type < 0) {
+        throw std::runtime_error("No device local memory type.");
+    }
+
+    std::vector<VkDeviceMemory> memories(allocation_count);
+    start = now_ms();
+    for (uint32_t i = 0; i < allocation_count; i++) {
+        VkMemoryAllocateInfo memory_ai{};
+        memory_ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memory_ai.allocationSize = requirements[i].size;
+        memory_ai.memoryTypeIndex = memory_type;
+        if (vkAllocateMemory(vk.device, &memory_ai, nullptr, &memories[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Could not allocate device memory.");
+        }
+    }
+    allocated = now_ms();
+    for (uint32_t i : free_order) {
+        vkFreeMemory(vk.device, memories[i], nullptr);
+    }
+    freed = now_ms();
+
+    std::cout << "vkAllocateMemory : " << (allocated - start) * 1e6 / allocation_count << " ns, "
+              << "vkFreeMemory : " << (freed - allocated) * 1e6 / allocation_count << " ns\n";
+
+    gpu_finalize(vk);
+
+    return 0;
+}
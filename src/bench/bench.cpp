@@ -0,0 +1,96 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+
+struct Benchmark {
+    const char* name;
+    const char* usage;
+    int (*run)(int argc, char** argv);
+};
+
+static const Benchmark BENCHMARKS[] = {
+    {"allocator", "", bench_allocator},
+    {"raycast", "<mesh.obj> [ray_count [max_threads]]", bench_raycast},
+    {"bvh_build", "<mesh.obj>", bench_bvh_build},
+    {"bvh4", "<mesh.obj> [ray_count [brute_force_ray_count]]", bench_bvh4},
+    {"vertex_dedup", "", bench_vertex_dedup},
+    {"index_width", "<mesh.obj>", bench_index_width},
+    {"gpu_bvh", "<mesh.obj> [ray_count]", bench_gpu_bvh},
+};
+
+void random_rays(const Mesh& mesh,
+                 size_t count,
+                 uint32_t seed,
+                 std::vector<glm::vec3>& origins,
+                 std::vector<glm::vec3>& directions) {
+    glm::vec3 lower(INFINITY);
+    glm::vec3 upper(-INFINITY);
+    for (const glm::vec3& position : mesh.positions) {
+        lower = glm::min(lower, position);
+        upper = glm::max(upper, position);
+    }
+    glm::vec3 center = (lower + upper) * 0.5f;
+    glm::vec3 extent = (upper - lower) * 0.5f;
+    float radius = glm::length(extent);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    origins.resize(count);
+    directions.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 s;
+        do {
+            s = glm::vec3(unit(rng), unit(rng), unit(rng));
+        } while (glm::length(s) > 1.0f || glm::length(s) < 0.1f);
+        origins[i] = center + glm::normalize(s) * radius * 1.5f;
+
+        glm::vec3 target = center + glm::vec3(unit(rng), unit(rng), unit(rng)) * extent;
+        directions[i] = glm::normalize(target - origins[i]);
+    }
+}
+
+std::vector<uint32_t> thread_counts(uint32_t max_threads) {
+    if (max_threads == 0) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<uint32_t> counts;
+    for (uint32_t count = 1; count < max_threads; count *= 2) {
+        counts.push_back(count);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+static void print_usage() {
+    std::cerr << "Usage : vgp-bench <benchmark> [arguments]\n";
+    for (const Benchmark& benchmark : BENCHMARKS) {
+        std::cerr << "  " << benchmark.name << " " << benchmark.usage << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    for (const Benchmark& benchmark : BENCHMARKS) {
+        if (strcmp(argv[1], benchmark.name) == 0) {
+            try {
+                return benchmark.run(argc - 2, argv + 2);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                return 1;
+            }
+        }
+    }
+
+    print_usage();
+    return 1;
+}
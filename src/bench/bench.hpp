@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Benchmarks run by vgp-bench, each taking the arguments after its name and
+// returning the exit status.
+
+int bench_allocator(int argc, char** argv);
+int bench_raycast(int argc, char** argv);
+int bench_bvh_build(int argc, char** argv);
+int bench_bvh4(int argc, char** argv);
+int bench_vertex_dedup(int argc, char** argv);
+int bench_index_width(int argc, char** argv);
+int bench_gpu_bvh(int argc, char** argv);
+
+// count rays from a sphere around mesh towards random points of its bounds,
+// the same for a given seed.
+void random_rays(const Mesh& mesh,
+                 size_t count,
+                 uint32_t seed,
+                 std::vector<glm::vec3>& origins,
+                 std::vector<glm::vec3>& directions);
+
+// 1, 2, 4... up to max_threads, or the hardware thread count when it is 0.
+std::vector<uint32_t> thread_counts(uint32_t max_threads);
@@ -0,0 +1,89 @@
+#include "bench.hpp"
+
+#include "../bvh.hpp"
+#include "../raycast.hpp"
+#include "../time_util.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// Nearest hit and any hit throughput of the wide quantized BVH, against the
+// binary BVH and brute force intersect() over the mesh, with the memory of
+// each tree. Brute force is slow on big meshes and only traces the first
+// brute_force_ray_count rays.
+int bench_bvh4(int argc, char** argv) {
+    if (argc < 1) {
+        throw std::runtime_error("bvh4 needs a mesh.");
+    }
+    size_t ray_count = argc > 1 ? std::stoul(argv[1]) : 1 << 18;
+    size_t brute_force_ray_count = std::min(ray_count, argc > 2 ? std::stoul(argv[2]) : size_t(1000));
+
+    Mesh mesh = load_obj_mesh(argv[0]);
+    Bvh bvh = build_bvh(mesh);
+    Bvh4 bvh4 = build_bvh4(bvh);
+
+    size_t binary_size = bvh.nodes.size() * sizeof(BvhNode);
+    size_t wide_size = bvh4.nodes.size() * sizeof(Bvh4Node);
+    size_t triangle_size = bvh.triangles.size() * sizeof(BvhTriangle);
+    std::cout << mesh.indices.size() / 3 << " triangles. Binary nodes : " << binary_size / 1024.0
+              << " KB, wide nodes : " << wide_size / 1024.0 << " KB ("
+              << static_cast<double>(binary_size) / wide_size << "x smaller, "
+              << static_cast<double>(binary_size + triangle_size) / (wide_size + triangle_size)
+              << "x with the triangles)\n";
+
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+    random_rays(mesh, ray_count, 2, origins, directions);
+
+    std::vector<float> reference(ray_count, INFINITY);
+    size_t mismatches = 0;
+
+    auto run = [&](const char* name, size_t count, auto trace) {
+        size_t hit_count = 0;
+        double start = now_ms();
+        for (size_t i = 0; i < count; i++) {
+            hit_count += trace(i) ? 1 : 0;
+        }
+        double elapsed = now_ms() - start;
+        std::cout << name << " : " << count / elapsed / 1000.0 << " Mrays/s, " << hit_count << " hits\n";
+    };
+
+    run("binary nearest", ray_count, [&](size_t i) {
+        return intersect(bvh, origins[i], directions[i], &reference[i]);
+    });
+    run("wide nearest", ray_count, [&](size_t i) {
+        float t = INFINITY;
+        bool hit = intersect(bvh4, origins[i], directions[i], &t);
+        mismatches += t != reference[i] ? 1 : 0;
+        return hit;
+    });
+    run("brute force nearest", brute_force_ray_count, [&](size_t i) {
+        float t = INFINITY;
+        bool hit = intersect(mesh, origins[i], directions[i], &t);
+        mismatches += t != reference[i] ? 1 : 0;
+        return hit;
+    });
+
+    // Shadow rays stopping just past the nearest hit.
+    std::vector<float> tmax(ray_count);
+    for (size_t i = 0; i < ray_count; i++) {
+        tmax[i] = reference[i] * 1.001f;
+    }
+    std::vector<char> occlusions(ray_count);
+
+    run("binary any hit", ray_count, [&](size_t i) {
+        occlusions[i] = occluded(bvh, origins[i], directions[i], 0.0f, tmax[i]);
+        return occlusions[i];
+    });
+    run("wide any hit", ray_count, [&](size_t i) {
+        bool hit = occluded(bvh4, origins[i], directions[i], 0.0f, tmax[i]);
+        mismatches += hit != static_cast<bool>(occlusions[i]) ? 1 : 0;
+        return hit;
+    });
+
+    if (mismatches > 0) {
+        std::cout << mismatches << " results differ from the binary BVH\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "bench.hpp"
+
+#include "../bvh.hpp"
+#include "../thread_pool.hpp"
+#include "../time_util.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// SAH BVH build throughput in Mtris/s, serial and on pools of 1, 4, 8 and
+// 16 threads, with the SAH cost of each tree to compare their quality.
+int bench_bvh_build(int argc, char** argv) {
+    if (argc < 1) {
+        throw std::runtime_error("bvh_build needs a mesh.");
+    }
+    const int repeat_count = 3;
+
+    Mesh mesh = load_obj_mesh(argv[0]);
+    double triangle_count = mesh.indices.size() / 3;
+    std::cout << triangle_count << " triangles\n";
+
+    double best = INFINITY;
+    Bvh bvh;
+    for (int i = 0; i < repeat_count; i++) {
+        double start = now_ms();
+        bvh = build_bvh(mesh);
+        best = std::min(best, now_ms() - start);
+    }
+    std::cout << "serial : " << best << "ms (" << triangle_count / best / 1000.0 << " Mtris/s), SAH cost "
+              << bvh_sah_cost(bvh) << ", " << bvh.nodes.size() << " nodes\n";
+
+    for (uint32_t thread_count : {1u, 4u, 8u, 16u}) {
+        ThreadPool pool;
+        thread_pool_init(pool, thread_count);
+
+        best = INFINITY;
+        for (int i = 0; i < repeat_count; i++) {
+            double start = now_ms();
+            bvh = build_bvh(mesh, &pool);
+            best = std::min(best, now_ms() - start);
+        }
+        std::cout << thread_count << " threads : " << best << "ms (" << triangle_count / best / 1000.0
+                  << " Mtris/s), SAH cost " << bvh_sah_cost(bvh) << ", " << bvh.nodes.size() << " nodes\n";
+
+        thread_pool_finalize(pool);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "bench.hpp"
+
+#include "../bvh.hpp"
+#include "../gpu_bvh.hpp"
+#include "../raycast.hpp"
+#include "../time_util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// LBVH build time in compute, and its hits checked against intersect() on
+// the CPU SAH BVH over the same rays. Hits on the same t but another
+// triangle are ties on a shared edge and are not counted as mismatches.
+// Loads its kernels from shaders/, run it from the build directory.
+int bench_gpu_bvh(int argc, char** argv) {
+    if (argc < 1) {
+        throw std::runtime_error("gpu_bvh needs a mesh.");
+    }
+    size_t ray_count = argc > 1 ? std::stoul(argv[1]) : 1 << 16;
+    const int repeat_count = 10;
+
+    Mesh mesh = load_obj_mesh(argv[0]);
+    double triangle_count = mesh.indices.size() / 3;
+    std::cout << triangle_count << " triangles\n";
+
+    GPUContext gpu;
+    gpu_init(gpu, GPU_INIT_HEADLESS);
+    VulkanComputeContext compute;
+    compute_init(&gpu, compute);
+    GPUBvhKernels kernels;
+    gpu_bvh_kernels_init(compute, kernels);
+
+    std::vector<Vertex> vertices(mesh.positions.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].position = mesh.positions[i];
+        vertices[i].uv = mesh.uvs[i];
+        vertices[i].normal = mesh.normals[i];
+    }
+    GPUBuffer<Vertex> vertex_buffer =
+        gpu_buffer_allocate<Vertex>(gpu, COMPUTE | STORAGE_BUFFER | HOST_ACCESS, vertices.size());
+    gpu_buffer_upload(gpu, vertex_buffer, vertices.data(), 0, vertices.size());
+
+    GPUBvh gpu_bvh;
+    gpu_bvh_init(gpu, gpu_bvh, mesh.indices.data(), mesh.indices.size());
+
+    // gpu_bvh_build waits for its submit, so this includes the round trip.
+    double best = INFINITY;
+    for (int i = 0; i < repeat_count; i++) {
+        double start = now_ms();
+        gpu_bvh_build(gpu, compute, kernels, gpu_bvh, vertex_buffer);
+        best = std::min(best, now_ms() - start);
+    }
+    std::cout << "gpu_bvh_build : " << best << "ms (" << triangle_count / best / 1000.0 << " Mtris/s)\n";
+
+    double start = now_ms();
+    Bvh bvh = build_bvh(mesh);
+    std::cout << "build_bvh : " << now_ms() - start << "ms\n";
+
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+    random_rays(mesh, ray_count, 3, origins, directions);
+
+    std::vector<GPURay> rays(ray_count);
+    for (size_t i = 0; i < ray_count; i++) {
+        rays[i].origin = glm::vec4(origins[i], 0.0f);
+        rays[i].direction = glm::vec4(directions[i], INFINITY);
+    }
+    std::vector<RayHit> hits(ray_count);
+
+    start = now_ms();
+    gpu_bvh_intersect(gpu, compute, kernels, gpu_bvh, vertex_buffer, rays.data(), ray_count, hits.data());
+    double elapsed = now_ms() - start;
+    std::cout << "gpu_bvh_intersect : " << ray_count / elapsed / 1000.0 << " Mrays/s\n";
+
+    size_t hit_count = 0;
+    size_t mismatches = 0;
+    start = now_ms();
+    for (size_t i = 0; i < ray_count; i++) {
+        float t = INFINITY;
+        uint32_t triangle = UINT32_MAX;
+        intersect(bvh, origins[i], directions[i], &t, &triangle);
+
+        hit_count += triangle != UINT32_MAX ? 1 : 0;
+        bool same_hit = hits[i].triangle == triangle
+            || std::abs(hits[i].t - t) <= 1e-5f * std::max(1.0f, std::abs(t));
+        mismatches += same_hit ? 0 : 1;
+    }
+    elapsed = now_ms() - start;
+    std::cout << "intersect : " << ray_count / elapsed / 1000.0 << " Mrays/s, " << hit_count << " hits\n";
+    if (mismatches > 0) {
+        std::cout << mismatches << " hits differ from the CPU BVH\n";
+    }
+
+    gpu_bvh_finalize(gpu, gpu_bvh);
+    gpu_buffer_free(gpu, vertex_buffer);
+    gpu_bvh_kernels_finalize(compute, kernels);
+    compute_finalize(compute);
+    gpu_finalize(gpu);
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include "bench.hpp"
+
+#include "../render.hpp"
+#include "../time_util.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// 16-bit against 32-bit index buffers for a mesh : size, the cost of
+// narrowing them in gpu_mesh_upload_indices, and a vertex fetch pass reading
+// positions through each index buffer, which stands for the index fetch
+// bandwidth of a draw.
+
+template<typename Index>
+static double fetch_ms(const std::vector<Index>& indices, const Mesh& mesh, int repeat_count, glm::vec3& sum) {
+    double best = INFINITY;
+    for (int r = 0; r < repeat_count; r++) {
+        double start = now_ms();
+        for (Index index : indices) {
+            sum += mesh.positions[index];
+        }
+        best = std::min(best, now_ms() - start);
+    }
+    return best;
+}
+
+int bench_index_width(int argc, char** argv) {
+    if (argc < 1) {
+        throw std::runtime_error("index_width needs a mesh.");
+    }
+    const int repeat_count = 10;
+
+    Mesh mesh = load_obj_mesh(argv[0], nullptr, MESH_LOAD_OPTIMIZE);
+    size_t index_count = mesh.indices.size();
+    IndexType index_type = index_type_for(mesh.positions.size());
+    std::cout << mesh.positions.size() << " vertices, " << index_count << " indices, "
+              << (index_type == INDEX_TYPE_UINT16 ? 16 : 32) << "-bit indices on the GPU\n";
+
+    std::cout << "32-bit : " << index_count * sizeof(uint32_t) / 1024.0 << " KB, 16-bit : "
+              << index_count * sizeof(uint16_t) / 1024.0 << " KB\n";
+    if (index_type != INDEX_TYPE_UINT16) {
+        std::cout << "Too many vertices for 16-bit indices, try a smaller mesh.\n";
+        return 0;
+    }
+
+    // Fresh buffers each time, like a new upload.
+    double copy_best = INFINITY;
+    double narrow_best = INFINITY;
+    for (int r = 0; r < repeat_count; r++) {
+        double start = now_ms();
+        std::vector<uint32_t> copied(mesh.indices.begin(), mesh.indices.end());
+        copy_best = std::min(copy_best, now_ms() - start);
+
+        start = now_ms();
+        std::vector<uint16_t> narrowed(index_count);
+        for (size_t i = 0; i < index_count; i++) {
+            narrowed[i] = static_cast<uint16_t>(mesh.indices[i]);
+        }
+        narrow_best = std::min(narrow_best, now_ms() - start);
+    }
+    std::cout << "Copy 32-bit : " << copy_best << "ms, narrow to 16-bit : " << narrow_best << "ms\n";
+
+    std::vector<uint16_t> indices_16(mesh.indices.begin(), mesh.indices.end());
+    glm::vec3 sum_32(0.0f);
+    glm::vec3 sum_16(0.0f);
+    double fetch_32 = fetch_ms(mesh.indices, mesh, repeat_count, sum_32);
+    double fetch_16 = fetch_ms(indices_16, mesh, repeat_count, sum_16);
+    std::cout << "Vertex fetch through 32-bit : " << fetch_32 << "ms, 16-bit : " << fetch_16 << "ms";
+    if (sum_32 != sum_16) {
+        std::cout << ", positions differ";
+    }
+    std::cout << "\n";
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "bench.hpp"
+
+#include "../bvh.hpp"
+#include "../raycast.hpp"
+#include "../thread_pool.hpp"
+#include "../time_util.hpp"
+
+#include <iostream>
+
+// Rays per second through intersect_batch from 1 to N threads, next to one
+// intersect() call per ray. The rays are shuffled, intersect_batch has to
+// sort them back into coherent groups.
+int bench_raycast(int argc, char** argv) {
+    if (argc < 1) {
+        throw std::runtime_error("raycast needs a mesh.");
+    }
+    size_t ray_count = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+    uint32_t max_threads = argc > 2 ? std::stoul(argv[2]) : 0;
+
+    Mesh mesh = load_obj_mesh(argv[0]);
+    Bvh bvh = build_bvh(mesh);
+    std::cout << mesh.indices.size() / 3 << " triangles, " << ray_count << " rays\n";
+
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+    random_rays(mesh, ray_count, 1, origins, directions);
+
+    std::vector<RayHit> reference(ray_count);
+    double start = now_ms();
+    for (size_t i = 0; i < ray_count; i++) {
+        reference[i].t = INFINITY;
+        reference[i].triangle = UINT32_MAX;
+        intersect(bvh, origins[i], directions[i], &reference[i].t, &reference[i].triangle);
+    }
+    double elapsed = now_ms() - start;
+    std::cout << "intersect : " << ray_count / elapsed / 1000.0 << " Mrays/s\n";
+
+    std::vector<RayHit> hits(ray_count);
+    start = now_ms();
+    intersect_batch(bvh, origins.data(), directions.data(), ray_count, hits.data());
+    elapsed = now_ms() - start;
+    std::cout << "intersect_batch, no pool : " << ray_count / elapsed / 1000.0 << " Mrays/s\n";
+
+    for (uint32_t thread_count : thread_counts(max_threads)) {
+        ThreadPool pool;
+        thread_pool_init(pool, thread_count);
+
+        // Once to start the workers.
+        intersect_batch(bvh, origins.data(), directions.data(), ray_count, hits.data(), &pool);
+
+        start = now_ms();
+        intersect_batch(bvh, origins.data(), directions.data(), ray_count, hits.data(), &pool);
+        elapsed = now_ms() - start;
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < ray_count; i++) {
+            if (hits[i].t != reference[i].t || hits[i].triangle != reference[i].triangle) {
+                mismatches++;
+            }
+        }
+
+        std::cout << thread_count << " threads : " << ray_count / elapsed / 1000.0 << " Mrays/s";
+        if (mismatches > 0) {
+            std::cout << ", " << mismatches << " hits differ from intersect";
+        }
+        std::cout << "\n";
+
+        thread_pool_finalize(pool);
+    }
+
+    return 0;
+}
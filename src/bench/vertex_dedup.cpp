@@ -0,0 +1,102 @@
+#include "bench.hpp"
+
+#include "../flat_hash_map.hpp"
+#include "../hash.hpp"
+#include "../time_util.hpp"
+
+#include <iostream>
+#include <tuple>
+#include <unordered_map>
+
+// Corner deduplication as load_obj_mesh does it, with FlatHashMap against
+// the std::unordered_map<std::tuple> it replaced. The corners are those of a
+// side x side vertex grid with one normal per cell column, so about three
+// corners share each key.
+
+struct CornerKey {
+    uint32_t v;
+    uint32_t vt;
+    uint32_t vn;
+};
+
+static inline bool operator==(const CornerKey& a, const CornerKey& b) {
+    return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+}
+
+static inline uint64_t hash_key(const CornerKey& key) {
+    return hash_u32x3(key.v, key.vt, key.vn);
+}
+
+// The boost style combiner of the former hash_tuple.hpp.
+struct TupleHash {
+    size_t operator()(const std::tuple<uint32_t, uint32_t, uint32_t>& key) const {
+        size_t seed = 0;
+        seed ^= std::hash<uint32_t>()(std::get<0>(key)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        seed ^= std::hash<uint32_t>()(std::get<1>(key)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        seed ^= std::hash<uint32_t>()(std::get<2>(key)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
+
+static std::vector<CornerKey> grid_corners(uint32_t side) {
+    std::vector<CornerKey> corners;
+    corners.reserve(6 * size_t(side - 1) * (side - 1));
+
+    for (uint32_t y = 0; y + 1 < side; y++) {
+        for (uint32_t x = 0; x + 1 < side; x++) {
+            uint32_t v00 = y * side + x + 1;
+            uint32_t v10 = v00 + 1;
+            uint32_t v01 = v00 + side;
+            uint32_t v11 = v01 + 1;
+            for (uint32_t v : {v00, v10, v11, v00, v11, v01}) {
+                corners.push_back({v, v, x + 1});
+            }
+        }
+    }
+    return corners;
+}
+
+int bench_vertex_dedup(int argc, char** argv) {
+    for (uint32_t side : {1024u, 2048u}) {
+        std::vector<CornerKey> corners = grid_corners(side);
+
+        // As load_obj_mesh used to do it, find then operator[].
+        double start = now_ms();
+        std::unordered_map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t, TupleHash> map;
+        map.reserve(corners.size() / 2);
+        uint32_t map_count = 0;
+        uint64_t map_checksum = 0;
+        for (const CornerKey& corner : corners) {
+            std::tuple<uint32_t, uint32_t, uint32_t> key = std::make_tuple(corner.v, corner.vt, corner.vn);
+            if (map.find(key) == map.end()) {
+                map[key] = map_count++;
+            }
+            map_checksum += map[key];
+        }
+        double map_elapsed = now_ms() - start;
+
+        start = now_ms();
+        FlatHashMap<CornerKey> flat;
+        flat_hash_map_reserve(flat, corners.size() / 2);
+        uint32_t flat_count = 0;
+        uint64_t flat_checksum = 0;
+        for (const CornerKey& corner : corners) {
+            uint32_t index = flat_hash_map_insert(flat, corner, flat_count);
+            if (index == flat_count) {
+                flat_count++;
+            }
+            flat_checksum += index;
+        }
+        double flat_elapsed = now_ms() - start;
+
+        std::cout << corners.size() << " corners, " << flat_count << " unique : unordered_map "
+                  << map_elapsed << "ms, FlatHashMap " << flat_elapsed << "ms ("
+                  << map_elapsed / flat_elapsed << "x)";
+        if (map_count != flat_count || map_checksum != flat_checksum) {
+            std::cout << ", indices differ";
+        }
+        std::cout << "\n";
+    }
+
+    return 0;
+}
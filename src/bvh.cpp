@@ -0,0 +1,639 @@
+#include "bvh.hpp"
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+static const uint32_t BVH_BIN_COUNT = 16;
+static const uint32_t BVH_MAX_LEAF_SIZE = 8;
+// Below this depth nodes split at the median, which adds at most 32 levels
+// for 32-bit triangle counts.
+static const uint32_t BVH_MEDIAN_SPLIT_DEPTH = BVH_MAX_DEPTH - 32;
+
+// With a pool, ranges at least this large are binned and partitioned in
+// chunks of at least BVH_CHUNK_SIZE, and subtrees at least BVH_TASK_SIZE
+// large are built as separate tasks.
+static const uint32_t BVH_PARALLEL_SIZE = 1 << 16;
+static const uint32_t BVH_CHUNK_SIZE = 1 << 14;
+static const uint32_t BVH_TASK_SIZE = 1 << 12;
+
+// Relative costs of visiting a node and intersecting a triangle.
+static const float BVH_TRAVERSAL_COST = 1.0f;
+static const float BVH_INTERSECTION_COST = 1.0f;
+
+// Wide trees turn binary subtrees this small into a single leaf.
+static const uint32_t BVH4_MAX_LEAF_SIZE = 4;
+
+static Aabb aabb_empty() {
+    return {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+}
+
+static void aabb_grow(Aabb& box, const glm::vec3& p) {
+    box.min = glm::min(box.min, p);
+    box.max = glm::max(box.max, p);
+}
+
+static void aabb_grow(Aabb& box, const Aabb& other) {
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static float aabb_half_area(const Aabb& box) {
+    glm::vec3 d = box.max - box.min;
+    if (d.x < 0.0f) {
+        return 0.0f;
+    }
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+struct BvhBuilder {
+    const Aabb* bounds;
+    std::vector<glm::vec3> centroids;
+    // Triangle indices, partitioned in place as nodes split.
+    std::vector<uint32_t> order;
+    // Partitions on the pool scatter here, then copy back.
+    std::vector<uint32_t> scratch;
+    // Sized for the worst case up front, so tasks can take nodes concurrently.
+    std::vector<BvhNode> nodes;
+    std::atomic<uint32_t> node_count;
+
+    ThreadPool* pool;
+    TaskGroup subtrees;
+};
+
+static uint32_t bvh_chunk_count(ThreadPool* pool, uint32_t count) {
+    if (!pool || count < BVH_PARALLEL_SIZE) {
+        return 1;
+    }
+    return std::max(1u, std::min(count / BVH_CHUNK_SIZE, 4 * thread_pool_size(*pool)));
+}
+
+// Runs f(chunk, begin, end) over chunk_count even slices of [first, first + count).
+template<typename F>
+static void bvh_for_each_chunk(ThreadPool* pool, uint32_t chunk_count, uint32_t first, uint32_t count, F f) {
+    auto chunk_begin = [&](size_t chunk) {
+        return first + static_cast<uint32_t>(static_cast<uint64_t>(count) * chunk / chunk_count);
+    };
+
+    if (chunk_count == 1) {
+        f(0, first, first + count);
+    } else {
+        parallel_for(*pool, chunk_count, [&](size_t chunk) {
+            f(chunk, chunk_begin(chunk), chunk_begin(chunk + 1));
+        });
+    }
+}
+
+struct BvhBin {
+    Aabb bounds;
+    uint32_t count;
+};
+
+static void build_node(BvhBuilder& builder, uint32_t node_index, uint32_t first, uint32_t count, uint32_t depth);
+
+static void split_node(BvhBuilder& builder, uint32_t node_index, uint32_t first, uint32_t split_count, uint32_t count, uint32_t depth) {
+    uint32_t left_child = builder.node_count.fetch_add(2, std::memory_order_relaxed);
+    builder.nodes[node_index].first = left_child;
+    builder.nodes[node_index].count = 0;
+
+    // Large left subtrees go to the pool, where idle workers steal them, and
+    // this thread carries on with the right one.
+    if (builder.pool && split_count >= BVH_TASK_SIZE) {
+        BvhBuilder* shared = &builder;
+        thread_pool_submit(*builder.pool, builder.subtrees, [shared, left_child, first, split_count, depth]() {
+            build_node(*shared, left_child, first, split_count, depth + 1);
+        });
+    } else {
+        build_node(builder, left_child, first, split_count, depth + 1);
+    }
+    build_node(builder, left_child + 1, first + split_count, count - split_count, depth + 1);
+}
+
+// Partitions order[first, first + count) by pred and returns the size of the
+// true side. On the pool, chunks count their true elements, then scatter in
+// place of a prefix sum of those counts.
+template<typename F>
+static uint32_t partition_range(BvhBuilder& builder, uint32_t first, uint32_t count, F pred) {
+    uint32_t chunk_count = bvh_chunk_count(builder.pool, count);
+    uint32_t* begin = &builder.order[first];
+    if (chunk_count == 1) {
+        return std::partition(begin, begin + count, pred) - begin;
+    }
+
+    std::vector<uint32_t> true_counts(chunk_count + 1, 0);
+    bvh_for_each_chunk(builder.pool, chunk_count, first, count, [&](size_t chunk, uint32_t chunk_begin, uint32_t chunk_end) {
+        uint32_t n = 0;
+        for (uint32_t i = chunk_begin; i < chunk_end; i++) {
+            n += pred(builder.order[i]);
+        }
+        true_counts[chunk + 1] = n;
+    });
+
+    // true_counts[c] becomes the first true slot of chunk c.
+    for (uint32_t c = 1; c <= chunk_count; c++) {
+        true_counts[c] += true_counts[c - 1];
+    }
+    uint32_t true_total = true_counts[chunk_count];
+
+    bvh_for_each_chunk(builder.pool, chunk_count, first, count, [&](size_t chunk, uint32_t chunk_begin, uint32_t chunk_end) {
+        uint32_t true_slot = first + true_counts[chunk];
+        uint32_t false_slot = first + true_total + (chunk_begin - first) - true_counts[chunk];
+        for (uint32_t i = chunk_begin; i < chunk_end; i++) {
+            uint32_t triangle = builder.order[i];
+            builder.scratch[pred(triangle) ? true_slot++ : false_slot++] = triangle;
+        }
+    });
+    bvh_for_each_chunk(builder.pool, chunk_count, first, count, [&](size_t, uint32_t chunk_begin, uint32_t chunk_end) {
+        std::copy(builder.scratch.begin() + chunk_begin,
+                  builder.scratch.begin() + chunk_end,
+                  builder.order.begin() + chunk_begin);
+    });
+
+    return true_total;
+}
+
+static void build_node(BvhBuilder& builder, uint32_t node_index, uint32_t first, uint32_t count, uint32_t depth) {
+    // Near the root the ranges are large enough to bin and partition on the pool.
+    uint32_t chunk_count = bvh_chunk_count(builder.pool, count);
+
+    Aabb bounds = aabb_empty();
+    Aabb centroid_bounds = aabb_empty();
+    if (chunk_count == 1) {
+        for (uint32_t i = first; i < first + count; i++) {
+            aabb_grow(bounds, builder.bounds[builder.order[i]]);
+            aabb_grow(centroid_bounds, builder.centroids[builder.order[i]]);
+        }
+    } else {
+        std::vector<Aabb> chunk_bounds(2 * chunk_count, aabb_empty());
+        bvh_for_each_chunk(builder.pool, chunk_count, first, count, [&](size_t chunk, uint32_t chunk_begin, uint32_t chunk_end) {
+            for (uint32_t i = chunk_begin; i < chunk_end; i++) {
+                aabb_grow(chunk_bounds[2 * chunk], builder.bounds[builder.order[i]]);
+                aabb_grow(chunk_bounds[2 * chunk + 1], builder.centroids[builder.order[i]]);
+            }
+        });
+        for (uint32_t c = 0; c < chunk_count; c++) {
+            aabb_grow(bounds, chunk_bounds[2 * c]);
+            aabb_grow(centroid_bounds, chunk_bounds[2 * c + 1]);
+        }
+    }
+
+    BvhNode& node = builder.nodes[node_index];
+    node.min = bounds.min;
+    node.max = bounds.max;
+    node.first = first;
+    node.count = count;
+
+    if (count <= 2) {
+        return;
+    }
+
+    // Find the best of the bin boundaries on the widest centroid axis.
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+        axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+        axis = 2;
+    }
+    if (extent[axis] <= 0.0f) {
+        // All centroids coincide, any split is as good as the others.
+        if (count > BVH_MAX_LEAF_SIZE) {
+            split_node(builder, node_index, first, count / 2, count, depth);
+        }
+        return;
+    }
+
+    if (depth >= BVH_MEDIAN_SPLIT_DEPTH) {
+        uint32_t* begin = &builder.order[first];
+        std::nth_element(begin, begin + count / 2, begin + count, [&](uint32_t a, uint32_t b) {
+            return builder.centroids[a][axis] < builder.centroids[b][axis];
+        });
+        split_node(builder, node_index, first, count / 2, count, depth);
+        return;
+    }
+
+    float bin_scale = BVH_BIN_COUNT / extent[axis];
+    auto bin_of = [&](uint32_t triangle) {
+        uint32_t bin = static_cast<uint32_t>((builder.centroids[triangle][axis] - centroid_bounds.min[axis]) * bin_scale);
+        return std::min(bin, BVH_BIN_COUNT - 1);
+    };
+
+    BvhBin bins[BVH_BIN_COUNT];
+    for (BvhBin& bin : bins) {
+        bin.bounds = aabb_empty();
+        bin.count = 0;
+    }
+
+    // On the pool, each chunk fills its own bins, merged afterwards.
+    std::vector<BvhBin> chunk_bins(chunk_count > 1 ? chunk_count * BVH_BIN_COUNT : 0, {aabb_empty(), 0});
+    bvh_for_each_chunk(builder.pool, chunk_count, first, count, [&](size_t chunk, uint32_t chunk_begin, uint32_t chunk_end) {
+        BvhBin* target = chunk_count > 1 ? &chunk_bins[chunk * BVH_BIN_COUNT] : bins;
+        for (uint32_t i = chunk_begin; i < chunk_end; i++) {
+            BvhBin& bin = target[bin_of(builder.order[i])];
+            aabb_grow(bin.bounds, builder.bounds[builder.order[i]]);
+            bin.count++;
+        }
+    });
+    for (size_t i = 0; i < chunk_bins.size(); i++) {
+        aabb_grow(bins[i % BVH_BIN_COUNT].bounds, chunk_bins[i].bounds);
+        bins[i % BVH_BIN_COUNT].count += chunk_bins[i].count;
+    }
+
+    // Sweep from the right to get the cost of every right side, then from the left.
+    float right_areas[BVH_BIN_COUNT];
+    uint32_t right_counts[BVH_BIN_COUNT];
+    Aabb right = aabb_empty();
+    uint32_t right_count = 0;
+    for (uint32_t b = BVH_BIN_COUNT - 1; b > 0; b--) {
+        aabb_grow(right, bins[b].bounds);
+        right_count += bins[b].count;
+        right_areas[b] = aabb_half_area(right);
+        right_counts[b] = right_count;
+    }
+
+    float best_cost = INFINITY;
+    uint32_t best_split = 0;
+    Aabb left = aabb_empty();
+    uint32_t left_count = 0;
+    for (uint32_t b = 1; b < BVH_BIN_COUNT; b++) {
+        aabb_grow(left, bins[b - 1].bounds);
+        left_count += bins[b - 1].count;
+        if (left_count == 0 || right_counts[b] == 0) {
+            continue;
+        }
+
+        float cost = aabb_half_area(left) * left_count + right_areas[b] * right_counts[b];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_split = b;
+        }
+    }
+
+    float leaf_cost = BVH_INTERSECTION_COST * count;
+    float split_cost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * best_cost / aabb_half_area(bounds);
+    if (best_split == 0 || (split_cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE)) {
+        if (count <= BVH_MAX_LEAF_SIZE) {
+            return;
+        }
+        best_split = BVH_BIN_COUNT / 2;
+    }
+
+    uint32_t split_count = partition_range(builder, first, count, [&](uint32_t triangle) {
+        return bin_of(triangle) < best_split;
+    });
+    if (split_count == 0 || split_count == count) {
+        split_count = count / 2;
+    }
+
+    split_node(builder, node_index, first, split_count, count, depth);
+}
+
+void build_bvh_nodes(const Aabb* boxes,
+                     uint32_t box_count,
+                     std::vector<BvhNode>& nodes,
+                     std::vector<uint32_t>& order,
+                     ThreadPool* pool) {
+    nodes.clear();
+    order.clear();
+    if (box_count == 0) {
+        nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f), 0});
+        return;
+    }
+
+    BvhBuilder builder;
+    builder.bounds = boxes;
+    builder.pool = pool;
+    builder.centroids.resize(box_count);
+    builder.order.resize(box_count);
+    bvh_for_each_chunk(pool, bvh_chunk_count(pool, box_count), 0, box_count, [&](size_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            builder.centroids[i] = (boxes[i].min + boxes[i].max) * .5f;
+            builder.order[i] = i;
+        }
+    });
+    if (pool) {
+        builder.scratch.resize(box_count);
+    }
+
+    // A binary tree with at least one box per leaf has at most 2n - 1 nodes.
+    builder.nodes.resize(2 * box_count - 1);
+    builder.node_count = 1;
+    build_node(builder, 0, 0, box_count, 0);
+    if (pool) {
+        thread_pool_wait(*pool, builder.subtrees);
+    }
+
+    builder.nodes.resize(builder.node_count);
+    nodes.swap(builder.nodes);
+    order.swap(builder.order);
+}
+
+Bvh build_bvh(const glm::vec3* positions,
+              size_t position_stride,
+              const uint32_t* indices,
+              size_t index_count,
+              ThreadPool* pool) {
+    auto position = [&](uint32_t index) -> const glm::vec3& {
+        return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + index * position_stride);
+    };
+
+    uint32_t triangle_count = index_count / 3;
+    uint32_t chunk_count = bvh_chunk_count(pool, triangle_count);
+
+    std::vector<Aabb> bounds(triangle_count);
+    bvh_for_each_chunk(pool, chunk_count, 0, triangle_count, [&](size_t, uint32_t begin, uint32_t end) {
+        for (uint32_t t = begin; t < end; t++) {
+            Aabb box = aabb_empty();
+            for (int k = 0; k < 3; k++) {
+                aabb_grow(box, position(indices[t * 3 + k]));
+            }
+            bounds[t] = box;
+        }
+    });
+
+    Bvh bvh;
+    std::vector<uint32_t> order;
+    build_bvh_nodes(bounds.data(), triangle_count, bvh.nodes, order, pool);
+    if (triangle_count == 0) {
+        bvh.build_cost = 0.0f;
+        return bvh;
+    }
+
+    bvh.triangles.resize(triangle_count);
+    bvh_for_each_chunk(pool, chunk_count, 0, triangle_count, [&](size_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t t = order[i];
+            glm::vec3 v0 = position(indices[t * 3]);
+            bvh.triangles[i].v0 = v0;
+            bvh.triangles[i].edge1 = position(indices[t * 3 + 1]) - v0;
+            bvh.triangles[i].edge2 = position(indices[t * 3 + 2]) - v0;
+            bvh.triangles[i].index = t;
+        }
+    });
+    bvh.build_cost = bvh_sah_cost(bvh);
+
+    return bvh;
+}
+
+Bvh build_bvh(const Mesh& mesh, ThreadPool* pool) {
+    return build_bvh(mesh.positions.data(), sizeof(glm::vec3), mesh.indices.data(), mesh.indices.size(), pool);
+}
+
+Bvh build_bvh(const CachedMesh& mesh, ThreadPool* pool) {
+    return build_bvh(&mesh.vertices[0].position, sizeof(Vertex), mesh.indices, mesh.index_count, pool);
+}
+
+void refit_bvh(Bvh& bvh,
+               const glm::vec3* positions,
+               size_t position_stride,
+               const uint32_t* indices) {
+    auto position = [&](uint32_t index) -> const glm::vec3& {
+        return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + index * position_stride);
+    };
+
+    for (BvhTriangle& triangle : bvh.triangles) {
+        const uint32_t* corners = &indices[triangle.index * 3];
+        glm::vec3 v0 = position(corners[0]);
+        triangle.v0 = v0;
+        triangle.edge1 = position(corners[1]) - v0;
+        triangle.edge2 = position(corners[2]) - v0;
+    }
+
+    if (bvh.triangles.empty()) {
+        return;
+    }
+
+    // Children are always allocated after their parent, so a reverse sweep
+    // sees both children of a node before the node itself.
+    for (size_t n = bvh.nodes.size(); n-- > 0;) {
+        BvhNode& node = bvh.nodes[n];
+        Aabb bounds = aabb_empty();
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                const BvhTriangle& triangle = bvh.triangles[i];
+                aabb_grow(bounds, triangle.v0);
+                aabb_grow(bounds, triangle.v0 + triangle.edge1);
+                aabb_grow(bounds, triangle.v0 + triangle.edge2);
+            }
+        } else {
+            const BvhNode& left = bvh.nodes[node.first];
+            const BvhNode& right = bvh.nodes[node.first + 1];
+            aabb_grow(bounds, {left.min, left.max});
+            aabb_grow(bounds, {right.min, right.max});
+        }
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+}
+
+bool update_bvh(Bvh& bvh,
+                const glm::vec3* positions,
+                size_t position_stride,
+                const uint32_t* indices,
+                size_t index_count) {
+    refit_bvh(bvh, positions, position_stride, indices);
+    if (bvh_sah_cost(bvh) <= BVH_REBUILD_COST_RATIO * bvh.build_cost) {
+        return false;
+    }
+
+    bvh = build_bvh(positions, position_stride, indices, index_count);
+    return true;
+}
+
+float bvh_sah_cost(const Bvh& bvh) {
+    const BvhNode& root = bvh.nodes[0];
+    float root_area = aabb_half_area({root.min, root.max});
+    if (root_area <= 0.0f) {
+        return 0.0f;
+    }
+
+    float cost = 0.0f;
+    for (const BvhNode& node : bvh.nodes) {
+        float area = aabb_half_area({node.min, node.max}) / root_area;
+        cost += node.count == 0
+            ? BVH_TRAVERSAL_COST * area
+            : BVH_INTERSECTION_COST * area * node.count;
+    }
+    return cost;
+}
+
+// Smallest exponent whose 255 steps still reach from min to max.
+static int8_t bvh4_exponent(float min, float max) {
+    int exponent = -126;
+    if (max > min) {
+        exponent = std::max(-126, std::min(127, static_cast<int>(std::ceil(std::log2((max - min) / 255.0f)))));
+    }
+    while (exponent > -126 && min + 255.0f * bvh4_scale(exponent - 1) >= max) {
+        exponent--;
+    }
+    while (exponent < 127 && min + 255.0f * bvh4_scale(exponent) < max) {
+        exponent++;
+    }
+    return exponent;
+}
+
+// Rounds outwards, with the same float operations as traversal so the
+// dequantized box always contains [min, max].
+static void bvh4_quantize(float origin, float scale, float min, float max, uint8_t* q_min, uint8_t* q_max) {
+    int lo = static_cast<int>(std::floor(std::min(std::max((min - origin) / scale, 0.0f), 255.0f)));
+    while (lo > 0 && origin + static_cast<float>(lo) * scale > min) {
+        lo--;
+    }
+    int hi = static_cast<int>(std::ceil(std::min(std::max((max - origin) / scale, 0.0f), 255.0f)));
+    while (hi < 255 && origin + static_cast<float>(hi) * scale < max) {
+        hi++;
+    }
+    *q_min = lo;
+    *q_max = hi;
+}
+
+Bvh4 build_bvh4(const Bvh& bvh) {
+    Bvh4 wide;
+    if (bvh.triangles.empty()) {
+        return wide;
+    }
+    wide.triangles.reserve(bvh.triangles.size());
+
+    // Triangle range of every subtree, which is contiguous. Children always
+    // follow their parent, so a reverse sweep sees them first.
+    std::vector<uint32_t> subtree_first(bvh.nodes.size());
+    std::vector<uint32_t> subtree_count(bvh.nodes.size());
+    for (size_t n = bvh.nodes.size(); n-- > 0;) {
+        const BvhNode& node = bvh.nodes[n];
+        if (node.count > 0) {
+            subtree_first[n] = node.first;
+            subtree_count[n] = node.count;
+        } else {
+            subtree_first[n] = subtree_first[node.first];
+            subtree_count[n] = subtree_count[node.first] + subtree_count[node.first + 1];
+        }
+    }
+    auto is_leaf = [&](uint32_t n) {
+        return bvh.nodes[n].count > 0 || subtree_count[n] <= BVH4_MAX_LEAF_SIZE;
+    };
+
+    // Binary nodes waiting to become the wide node they were given.
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    stack.push_back({0, 0});
+    wide.nodes.resize(1);
+
+    while (!stack.empty()) {
+        uint32_t source = stack.back().first;
+        uint32_t target = stack.back().second;
+        stack.pop_back();
+
+        uint32_t children[BVH4_WIDTH];
+        uint32_t child_count = 0;
+        const BvhNode& node = bvh.nodes[source];
+        if (is_leaf(source)) {
+            // Only for a root that is a leaf.
+            children[child_count++] = source;
+        } else {
+            children[child_count++] = node.first;
+            children[child_count++] = node.first + 1;
+        }
+
+        while (child_count < BVH4_WIDTH) {
+            uint32_t largest = child_count;
+            float largest_area = -1.0f;
+            for (uint32_t i = 0; i < child_count; i++) {
+                const BvhNode& child = bvh.nodes[children[i]];
+                float area = aabb_half_area({child.min, child.max});
+                if (!is_leaf(children[i]) && area > largest_area) {
+                    largest = i;
+                    largest_area = area;
+                }
+            }
+            if (largest == child_count) {
+                break;
+            }
+
+            // Its children take its place, keeping the tree order.
+            uint32_t first = bvh.nodes[children[largest]].first;
+            for (uint32_t i = child_count; i > largest + 1; i--) {
+                children[i] = children[i - 1];
+            }
+            children[largest] = first;
+            children[largest + 1] = first + 1;
+            child_count++;
+        }
+
+        Bvh4Node out{};
+        out.origin = node.min;
+        for (int axis = 0; axis < 3; axis++) {
+            out.exponent[axis] = bvh4_exponent(node.min[axis], node.max[axis]);
+        }
+        out.child_count = child_count;
+        out.first_child = wide.nodes.size();
+        out.first_triangle = wide.triangles.size();
+
+        uint32_t inner_count = 0;
+        for (uint32_t i = 0; i < child_count; i++) {
+            const BvhNode& child = bvh.nodes[children[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                bvh4_quantize(out.origin[axis], bvh4_scale(out.exponent[axis]),
+                              child.min[axis], child.max[axis],
+                              &out.min[axis][i], &out.max[axis][i]);
+            }
+
+            if (is_leaf(children[i])) {
+                uint32_t first = subtree_first[children[i]];
+                out.triangle_count[i] = subtree_count[children[i]];
+                wide.triangles.insert(wide.triangles.end(),
+                                      bvh.triangles.begin() + first,
+                                      bvh.triangles.begin() + first + subtree_count[children[i]]);
+            } else {
+                stack.push_back({children[i], out.first_child + inner_count++});
+            }
+        }
+
+        wide.nodes.resize(wide.nodes.size() + inner_count);
+        wide.nodes[target] = out;
+    }
+
+    return wide;
+}
+
+Bvh4 build_bvh4(const Mesh& mesh, ThreadPool* pool) {
+    return build_bvh4(build_bvh(mesh, pool));
+}
+
+Bvh4 build_bvh4(const CachedMesh& mesh, ThreadPool* pool) {
+    return build_bvh4(build_bvh(mesh, pool));
+}
+
+SceneBvh build_scene_bvh(const SceneInstance* instances, size_t instance_count) {
+    std::vector<Aabb> bounds(instance_count);
+    for (size_t i = 0; i < instance_count; i++) {
+        const BvhNode& root = instances[i].bvh->nodes[0];
+        const glm::mat4& transform = instances[i].transform;
+
+        // World space box of the eight transformed corners of the root.
+        Aabb box = aabb_empty();
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 p(corner & 1 ? root.max.x : root.min.x,
+                        corner & 2 ? root.max.y : root.min.y,
+                        corner & 4 ? root.max.z : root.min.z);
+            aabb_grow(box, glm::vec3(transform * glm::vec4(p, 1.0f)));
+        }
+        bounds[i] = box;
+    }
+
+    SceneBvh scene;
+    std::vector<uint32_t> order;
+    build_bvh_nodes(bounds.data(), instance_count, scene.nodes, order);
+
+    scene.instances.resize(instance_count);
+    for (size_t i = 0; i < instance_count; i++) {
+        SceneInstance& instance = scene.instances[i];
+        instance = instances[order[i]];
+        instance.inverse_transform = glm::inverse(instance.transform);
+        instance.id = order[i];
+    }
+
+    return scene;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "mesh_cache.hpp"
+
+#include <cstring>
+#include <vector>
+
+// Trees never get deeper than this, so traversal stacks can be fixed arrays.
+static const uint32_t BVH_MAX_DEPTH = 64;
+
+// update_bvh rebuilds once refits have made the tree this much more expensive
+// than it was when built.
+static const float BVH_REBUILD_COST_RATIO = 1.5f;
+
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BvhNode {
+    glm::vec3 min;
+    // Leaves : first triangle. Inner nodes : left child, the right one follows it.
+    uint32_t first;
+    glm::vec3 max;
+    // Triangle count, 0 for inner nodes.
+    uint32_t count;
+};
+static_assert(sizeof(BvhNode) == 32, "Wrong size for BvhNode");
+
+// Triangles are copied in leaf order, so traversal never touches the mesh.
+struct BvhTriangle {
+    glm::vec3 v0;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+    // Index of the triangle in the source index buffer.
+    uint32_t index;
+};
+
+struct Bvh {
+    // The root is nodes[0].
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangle> triangles;
+    // bvh_sah_cost right after the last full build.
+    float build_cost;
+};
+
+// Binned SAH build over arbitrary boxes. Leaf ranges index order, which maps
+// them back to boxes. With a pool, the top levels bin in parallel and
+// subtrees are built as tasks, splitting exactly like the serial build.
+void build_bvh_nodes(const Aabb* boxes,
+                     uint32_t box_count,
+                     std::vector<BvhNode>& nodes,
+                     std::vector<uint32_t>& order,
+                     ThreadPool* pool = nullptr);
+
+// Builds with binned SAH over triangle centroids. Positions are read with a
+// byte stride, so interleaved vertices work directly.
+Bvh build_bvh(const glm::vec3* positions,
+              size_t position_stride,
+              const uint32_t* indices,
+              size_t index_count,
+              ThreadPool* pool = nullptr);
+Bvh build_bvh(const Mesh& mesh, ThreadPool* pool = nullptr);
+Bvh build_bvh(const CachedMesh& mesh, ThreadPool* pool = nullptr);
+
+// Recomputes the triangles and node bounds from moved positions, bottom-up,
+// keeping the tree topology. indices must be the buffer the BVH was built from.
+void refit_bvh(Bvh& bvh,
+               const glm::vec3* positions,
+               size_t position_stride,
+               const uint32_t* indices);
+
+// Refits, then rebuilds if the cost went past BVH_REBUILD_COST_RATIO times
+// build_cost. Returns true if the tree was rebuilt.
+bool update_bvh(Bvh& bvh,
+                const glm::vec3* positions,
+                size_t position_stride,
+                const uint32_t* indices,
+                size_t index_count);
+
+// Surface area heuristic cost of the tree, relative to a single leaf node.
+float bvh_sah_cost(const Bvh& bvh);
+
+static const uint32_t BVH4_WIDTH = 4;
+
+// Wide node holding the boxes of up to four children, one per SSE lane.
+// Child bounds are 8-bit offsets from the node origin in steps of
+// 2^exponent, rounded outwards.
+struct Bvh4Node {
+    glm::vec3 origin;
+    int8_t exponent[3];
+    uint8_t child_count;
+    // Inner children follow each other from first_child, and the triangles
+    // of leaf children from first_triangle, both in child order.
+    uint32_t first_child;
+    uint32_t first_triangle;
+    // Per child, 0 for inner children.
+    uint8_t triangle_count[BVH4_WIDTH];
+    uint8_t min[3][BVH4_WIDTH];
+    uint8_t max[3][BVH4_WIDTH];
+};
+static_assert(sizeof(Bvh4Node) == 52, "Wrong size for Bvh4Node");
+
+// 2^exponent, built from the float bits. Exponents stay within [-126, 127].
+inline float bvh4_scale(int8_t exponent) {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+struct Bvh4 {
+    // The root is nodes[0], empty for an empty mesh.
+    std::vector<Bvh4Node> nodes;
+    std::vector<BvhTriangle> triangles;
+};
+
+// Collapses a binary BVH, repeatedly opening the largest inner child of each
+// node until it has BVH4_WIDTH children. Leaves are kept as they are.
+Bvh4 build_bvh4(const Bvh& bvh);
+Bvh4 build_bvh4(const Mesh& mesh, ThreadPool* pool = nullptr);
+Bvh4 build_bvh4(const CachedMesh& mesh, ThreadPool* pool = nullptr);
+
+// One placement of a shared per-mesh BVH.
+struct SceneInstance {
+    const Bvh* bvh;
+    glm::mat4 transform;
+    glm::mat4 inverse_transform;
+    // Position in the array given to build_scene_bvh.
+    uint32_t id;
+};
+
+// Two level structure : a BVH over the world space bounds of the instances,
+// whose leaves point into the per-mesh BVHs.
+struct SceneBvh {
+    std::vector<BvhNode> nodes;
+    // In leaf order.
+    std::vector<SceneInstance> instances;
+};
+
+// Only bvh and transform need to be set on the instances.
+SceneBvh build_scene_bvh(const SceneInstance* instances, size_t instance_count);
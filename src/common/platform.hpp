@@ -9,5 +9,17 @@ enum GPUBufferUsageFlags : uint32_t {
     STORAGE_BUFFER = 0x00000008,
     GRAPHICS       = 0x00000010,
     COMPUTE        = 0x00000020,
+    TRANSFER_DST   = 0x00000040,
+    TRANSFER_SRC   = 0x00000080,
+    // Mapped by the CPU, for small buffers rewritten often and for readbacks.
+    // Without it, buffers live in device local memory that only
+    // gpu_buffer_upload can write, through a staging copy.
+    HOST_ACCESS    = 0x00000100,
+};
+
+enum GPUInitFlags : uint32_t {
+    // No surface or swapchain extensions, and any device type including
+    // software ones, for graphics_init_headless.
+    GPU_INIT_HEADLESS = 0x00000001,
 };
 
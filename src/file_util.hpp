@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MappedFile {
+    const char* data;
+    size_t size;
+};
+
+static inline size_t file_size(const std::string& filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        throw std::runtime_error("Could not stat file " + filename);
+    }
+
+    return st.st_size;
+}
+
+// Maps a whole file read-only. Empty files give a null data pointer.
+static inline MappedFile map_file(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat file " + filename);
+    }
+
+    MappedFile file;
+    file.data = nullptr;
+    file.size = st.st_size;
+
+    if (file.size > 0) {
+        void* ptr = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map file " + filename);
+        }
+        madvise(ptr, file.size, MADV_SEQUENTIAL);
+        file.data = static_cast<const char*>(ptr);
+    }
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
+
+    return file;
+}
+
+static inline void unmap_file(MappedFile& file) {
+    if (file.data) {
+        munmap(const_cast<char*>(file.data), file.size);
+    }
+    file.data = nullptr;
+    file.size = 0;
+}
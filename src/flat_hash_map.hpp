@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open-addressing map from small keys to dense uint32_t values, meant for
+// vertex deduplication and welding. Keys are stored inline next to their value
+// and probed linearly. Keys need operator== and a hash_key(const Key&)
+// overload. Entries cannot be removed.
+template<typename Key>
+struct FlatHashMap {
+    struct Slot {
+        Key key;
+        uint32_t value;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
+
+// Marks empty slots, so it cannot be used as a value.
+static const uint32_t FLAT_HASH_MAP_EMPTY = UINT32_MAX;
+
+template<typename Key>
+static inline size_t flat_hash_map_probe(const FlatHashMap<Key>& map, const Key& key) {
+    size_t mask = map.slots.size() - 1;
+    size_t i = hash_key(key) & mask;
+    while (map.slots[i].value != FLAT_HASH_MAP_EMPTY && !(map.slots[i].key == key)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Grows the table so that expected_count entries stay under half load.
+template<typename Key>
+void flat_hash_map_reserve(FlatHashMap<Key>& map, size_t expected_count) {
+    size_t capacity = 16;
+    while (capacity < expected_count * 2) {
+        capacity *= 2;
+    }
+    if (capacity <= map.slots.size()) {
+        return;
+    }
+
+    std::vector<typename FlatHashMap<Key>::Slot> old_slots(capacity, {Key{}, FLAT_HASH_MAP_EMPTY});
+    old_slots.swap(map.slots);
+
+    for (const auto& slot : old_slots) {
+        if (slot.value != FLAT_HASH_MAP_EMPTY) {
+            map.slots[flat_hash_map_probe(map, slot.key)] = slot;
+        }
+    }
+}
+
+// Returns the value stored for key, or FLAT_HASH_MAP_EMPTY.
+template<typename Key>
+uint32_t flat_hash_map_find(const FlatHashMap<Key>& map, const Key& key) {
+    if (map.slots.empty()) {
+        return FLAT_HASH_MAP_EMPTY;
+    }
+    return map.slots[flat_hash_map_probe(map, key)].value;
+}
+
+// Inserts key with value unless it is already present. Returns the value now
+// stored for key, which is the given one iff the key was new.
+template<typename Key>
+uint32_t flat_hash_map_insert(FlatHashMap<Key>& map, const Key& key, uint32_t value) {
+    if ((map.count + 1) * 2 > map.slots.size()) {
+        flat_hash_map_reserve(map, map.count + 1);
+    }
+
+    typename FlatHashMap<Key>::Slot& slot = map.slots[flat_hash_map_probe(map, key)];
+    if (slot.value == FLAT_HASH_MAP_EMPTY) {
+        slot.key = key;
+        slot.value = value;
+        map.count++;
+    }
+    return slot.value;
+}
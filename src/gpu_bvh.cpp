@@ -0,0 +1,174 @@
+#include "gpu_bvh.hpp"
+
+#include <vector>
+
+static const uint32_t LBVH_GROUP_SIZE = 256;
+static const uint32_t LBVH_RAYCAST_GROUP_SIZE = 64;
+// Keys per radix sort workgroup, see lbvh_radix_count.
+static const uint32_t LBVH_RADIX_BLOCK_SIZE = 1024;
+static const uint32_t LBVH_RADIX_BINS = 256;
+
+static uint32_t group_count(size_t count, uint32_t group_size) {
+    return (count + group_size - 1) / group_size;
+}
+
+void gpu_bvh_kernels_init(const VulkanComputeContext& compute, GPUBvhKernels& kernels) {
+    kernels.bounds = compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_bounds.comp.spv");
+    kernels.morton = compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>,
+                                           GPUBuffer<uint32_t>, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_morton.comp.spv");
+    kernels.radix_count = compute_kernel_create<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_radix_count.comp.spv");
+    kernels.radix_scan = compute_kernel_create<GPUBvhParameters, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_radix_scan.comp.spv");
+    kernels.radix_scatter = compute_kernel_create<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>,
+                                                  GPUBuffer<uint32_t>, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_radix_scatter.comp.spv");
+    kernels.build = compute_kernel_create<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<GPUBvhNode>,
+                                          GPUBuffer<uint32_t>, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_build.comp.spv");
+    kernels.refit = compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>,
+                                          GPUBuffer<GPUBvhNode>, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>>(
+        compute, "shaders/lbvh_refit.comp.spv");
+    kernels.raycast = compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBuffer<GPUBvhNode>, GPUBuffer<uint32_t>,
+                                            GPUBuffer<GPURay>, GPUBuffer<RayHit>>(
+        compute, "shaders/lbvh_raycast.comp.spv");
+}
+
+void gpu_bvh_kernels_finalize(const VulkanComputeContext& compute, GPUBvhKernels& kernels) {
+    compute_kernel_destroy(compute, kernels.bounds);
+    compute_kernel_destroy(compute, kernels.morton);
+    compute_kernel_destroy(compute, kernels.radix_count);
+    compute_kernel_destroy(compute, kernels.radix_scan);
+    compute_kernel_destroy(compute, kernels.radix_scatter);
+    compute_kernel_destroy(compute, kernels.build);
+    compute_kernel_destroy(compute, kernels.refit);
+    compute_kernel_destroy(compute, kernels.raycast);
+}
+
+void gpu_bvh_init(const GPUContext& gpu, GPUBvh& bvh, const uint32_t* indices, size_t index_count) {
+    bvh.triangle_count = index_count / 3;
+    if (bvh.triangle_count == 0) {
+        throw std::runtime_error("Cannot build a GPU BVH without triangles.");
+    }
+
+    uint32_t n = bvh.triangle_count;
+    uint32_t block_count = group_count(n, LBVH_RADIX_BLOCK_SIZE);
+
+    bvh.indices = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, 3 * n);
+    gpu_buffer_upload(gpu, bvh.indices, indices, 0, 3 * n);
+
+    for (uint32_t pass = 0; pass < 4; pass++) {
+        uint32_t parameters[3] = {n, 8 * pass, block_count};
+        bvh.parameters[pass] = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, 3);
+        gpu_buffer_upload(gpu, bvh.parameters[pass], parameters, 0, 3);
+    }
+    // Reset before every build, a staging copy would cost more than the write.
+    bvh.centroid_bounds = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER | HOST_ACCESS, 6);
+
+    for (int i = 0; i < 2; i++) {
+        bvh.keys[i] = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, n);
+        bvh.values[i] = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, n);
+    }
+    bvh.histograms = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, LBVH_RADIX_BINS * block_count);
+
+    bvh.nodes = gpu_buffer_allocate<GPUBvhNode>(gpu, COMPUTE | STORAGE_BUFFER, 2 * n - 1);
+    bvh.parents = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, 2 * n - 1);
+    // Never zero sized, even for a single triangle without inner nodes.
+    bvh.flags = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER, n);
+}
+
+void gpu_bvh_finalize(const GPUContext& gpu, GPUBvh& bvh) {
+    gpu_buffer_free(gpu, bvh.indices);
+    for (GPUBvhParameters& parameters : bvh.parameters) {
+        gpu_buffer_free(gpu, parameters);
+    }
+    gpu_buffer_free(gpu, bvh.centroid_bounds);
+    for (int i = 0; i < 2; i++) {
+        gpu_buffer_free(gpu, bvh.keys[i]);
+        gpu_buffer_free(gpu, bvh.values[i]);
+    }
+    gpu_buffer_free(gpu, bvh.histograms);
+    gpu_buffer_free(gpu, bvh.nodes);
+    gpu_buffer_free(gpu, bvh.parents);
+    gpu_buffer_free(gpu, bvh.flags);
+}
+
+void gpu_bvh_build(const GPUContext& gpu,
+                   const VulkanComputeContext& compute,
+                   const GPUBvhKernels& kernels,
+                   GPUBvh& bvh,
+                   const GPUBuffer<Vertex>& vertices) {
+    uint32_t n = bvh.triangle_count;
+    uint32_t block_count = group_count(n, LBVH_RADIX_BLOCK_SIZE);
+    uint32_t triangle_groups = group_count(n, LBVH_GROUP_SIZE);
+
+    // Empty bounds for the atomics to shrink from. This is a write, the
+    // bounds themselves never come back to the CPU.
+    const uint32_t empty_bounds[6] = {UINT32_MAX, UINT32_MAX, UINT32_MAX, 0, 0, 0};
+    gpu_buffer_upload(gpu, bvh.centroid_bounds, empty_bounds, 0, 6);
+
+    // One submission for the whole build, each pass waits for the previous
+    // one through the batch barriers.
+    VulkanComputeBatch batch;
+    compute_batch_begin(compute, batch);
+
+    compute_batch_dispatch(compute, batch, kernels.bounds, triangle_groups, 1, 1,
+                           vertices, bvh.indices, bvh.parameters[0], bvh.centroid_bounds);
+    compute_batch_dispatch(compute, batch, kernels.morton, triangle_groups, 1, 1,
+                           vertices, bvh.indices, bvh.parameters[0], bvh.centroid_bounds,
+                           bvh.keys[0], bvh.values[0]);
+
+    for (uint32_t pass = 0; pass < 4; pass++) {
+        uint32_t in = pass % 2;
+        uint32_t out = 1 - in;
+        compute_batch_dispatch(compute, batch, kernels.radix_count, block_count, 1, 1,
+                               bvh.parameters[pass], bvh.keys[in], bvh.histograms);
+        compute_batch_dispatch(compute, batch, kernels.radix_scan, 1, 1, 1,
+                               bvh.parameters[pass], bvh.histograms);
+        compute_batch_dispatch(compute, batch, kernels.radix_scatter, block_count, 1, 1,
+                               bvh.parameters[pass], bvh.keys[in], bvh.values[in],
+                               bvh.keys[out], bvh.values[out], bvh.histograms);
+    }
+
+    if (n > 1) {
+        compute_batch_dispatch(compute, batch, kernels.build, group_count(n - 1, LBVH_GROUP_SIZE), 1, 1,
+                               bvh.parameters[0], bvh.keys[0], bvh.nodes, bvh.parents, bvh.flags);
+    }
+    compute_batch_dispatch(compute, batch, kernels.refit, triangle_groups, 1, 1,
+                           vertices, bvh.indices, bvh.parameters[0], bvh.values[0],
+                           bvh.nodes, bvh.parents, bvh.flags);
+
+    compute_batch_submit(compute, batch);
+}
+
+void gpu_bvh_intersect(const GPUContext& gpu,
+                       const VulkanComputeContext& compute,
+                       const GPUBvhKernels& kernels,
+                       const GPUBvh& bvh,
+                       const GPUBuffer<Vertex>& vertices,
+                       const GPURay* rays,
+                       size_t ray_count,
+                       RayHit* hits) {
+    if (ray_count == 0) {
+        return;
+    }
+
+    uint32_t count = ray_count;
+    GPUBuffer<uint32_t> parameters = gpu_buffer_allocate<uint32_t>(gpu, COMPUTE | STORAGE_BUFFER | HOST_ACCESS, 1);
+    GPUBuffer<GPURay> ray_buffer = gpu_buffer_allocate<GPURay>(gpu, COMPUTE | STORAGE_BUFFER | HOST_ACCESS, ray_count);
+    GPUBuffer<RayHit> hit_buffer = gpu_buffer_allocate<RayHit>(gpu, COMPUTE | STORAGE_BUFFER | HOST_ACCESS, ray_count);
+    gpu_buffer_upload(gpu, parameters, &count, 0, 1);
+    gpu_buffer_upload(gpu, ray_buffer, rays, 0, ray_count);
+
+    compute_kernel_invoke(compute, kernels.raycast, group_count(ray_count, LBVH_RAYCAST_GROUP_SIZE), 1, 1,
+                          vertices, bvh.indices, bvh.nodes, parameters, ray_buffer, hit_buffer);
+
+    gpu_buffer_invalidate(gpu, hit_buffer, 0, ray_count);
+    std::copy(hit_buffer.mapped, hit_buffer.mapped + ray_count, hits);
+
+    gpu_buffer_free(gpu, parameters);
+    gpu_buffer_free(gpu, ray_buffer);
+    gpu_buffer_free(gpu, hit_buffer);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "platform_gpu.hpp"
+#include "mesh.hpp"
+#include "raycast.hpp"
+
+// Linear BVH built entirely in compute from the current vertex positions :
+// Morton codes of the triangle centroids, a radix sort, Karras' radix tree
+// and a bottom-up bounds pass. Nothing is read back, so it can follow a
+// deformation kernel every frame.
+
+// std430 layout shared with the lbvh shaders. Inner nodes are
+// [0, n - 1), leaves [n - 1, 2n - 1) and the root is node 0.
+struct GPUBvhNode {
+    glm::vec3 min;
+    // Inner nodes : left child. Leaves : triangle.
+    uint32_t left;
+    glm::vec3 max;
+    // Inner nodes : right child. Leaves : GPU_BVH_LEAF.
+    uint32_t right;
+};
+static_assert(sizeof(GPUBvhNode) == 32, "Wrong size for GPUBvhNode");
+
+static const uint32_t GPU_BVH_LEAF = UINT32_MAX;
+
+struct GPURay {
+    glm::vec4 origin;
+    // w is the maximum distance.
+    glm::vec4 direction;
+};
+static_assert(sizeof(RayHit) == 16, "RayHit must match the lbvh_raycast hit layout");
+
+// triangle_count, radix shift, radix block count.
+using GPUBvhParameters = GPUBuffer<uint32_t>;
+
+struct GPUBvhKernels {
+    VulkanComputeKernel<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>> bounds;
+    VulkanComputeKernel<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>,
+                        GPUBuffer<uint32_t>, GPUBuffer<uint32_t>> morton;
+    VulkanComputeKernel<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>> radix_count;
+    VulkanComputeKernel<GPUBvhParameters, GPUBuffer<uint32_t>> radix_scan;
+    VulkanComputeKernel<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>,
+                        GPUBuffer<uint32_t>, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>> radix_scatter;
+    VulkanComputeKernel<GPUBvhParameters, GPUBuffer<uint32_t>, GPUBuffer<GPUBvhNode>,
+                        GPUBuffer<uint32_t>, GPUBuffer<uint32_t>> build;
+    VulkanComputeKernel<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBvhParameters, GPUBuffer<uint32_t>,
+                        GPUBuffer<GPUBvhNode>, GPUBuffer<uint32_t>, GPUBuffer<uint32_t>> refit;
+    VulkanComputeKernel<GPUBuffer<Vertex>, GPUBuffer<uint32_t>, GPUBuffer<GPUBvhNode>, GPUBuffer<uint32_t>,
+                        GPUBuffer<GPURay>, GPUBuffer<RayHit>> raycast;
+};
+
+struct GPUBvh {
+    uint32_t triangle_count;
+    // 32-bit copy of the mesh indices, whatever the draw index type.
+    GPUBuffer<uint32_t> indices;
+
+    // One per radix pass, shifts 0, 8, 16 and 24. The first one also
+    // serves the other kernels.
+    GPUBvhParameters parameters[4];
+    // Centroid bounds as order preserving uints, min then max.
+    GPUBuffer<uint32_t> centroid_bounds;
+
+    // Morton codes and triangle indices, sorted back into [0] after the
+    // even number of passes.
+    GPUBuffer<uint32_t> keys[2];
+    GPUBuffer<uint32_t> values[2];
+    GPUBuffer<uint32_t> histograms;
+
+    GPUBuffer<GPUBvhNode> nodes;
+    GPUBuffer<uint32_t> parents;
+    GPUBuffer<uint32_t> flags;
+};
+
+void gpu_bvh_kernels_init(const VulkanComputeContext& compute, GPUBvhKernels& kernels);
+void gpu_bvh_kernels_finalize(const VulkanComputeContext& compute, GPUBvhKernels& kernels);
+
+// Allocates for the triangles of indices, which must not be empty.
+void gpu_bvh_init(const GPUContext& gpu, GPUBvh& bvh, const uint32_t* indices, size_t index_count);
+void gpu_bvh_finalize(const GPUContext& gpu, GPUBvh& bvh);
+
+// Rebuilds the whole tree from the positions in vertices.
+void gpu_bvh_build(const GPUContext& gpu,
+                   const VulkanComputeContext& compute,
+                   const GPUBvhKernels& kernels,
+                   GPUBvh& bvh,
+                   const GPUBuffer<Vertex>& vertices);
+
+// Traces rays against the last build and reads the hits back. Hits carry the
+// triangle index in the mesh index buffer, with UINT32_MAX and an infinite t
+// on a miss, like intersect_batch.
+void gpu_bvh_intersect(const GPUContext& gpu,
+                       const VulkanComputeContext& compute,
+                       const GPUBvhKernels& kernels,
+                       const GPUBvh& bvh,
+                       const GPUBuffer<Vertex>& vertices,
+                       const GPURay* rays,
+                       size_t ray_count,
+                       RayHit* hits);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// MurmurHash64A, by Austin Appleby (public domain).
+static inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    uint64_t h = seed ^ (size * m);
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* block_end = p + (size & ~size_t(7));
+
+    for (; p != block_end; p += 8) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (size & 7) {
+    case 7: h ^= uint64_t(p[6]) << 48; // fallthrough
+    case 6: h ^= uint64_t(p[5]) << 40; // fallthrough
+    case 5: h ^= uint64_t(p[4]) << 32; // fallthrough
+    case 4: h ^= uint64_t(p[3]) << 24; // fallthrough
+    case 3: h ^= uint64_t(p[2]) << 16; // fallthrough
+    case 2: h ^= uint64_t(p[1]) << 8;  // fallthrough
+    case 1: h ^= uint64_t(p[0]);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+// 64x64->128 bit multiply folded back to 64 bits, the mixing step of wyhash.
+static inline uint64_t hash_mum(uint64_t a, uint64_t b) {
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+static inline uint64_t hash_u32x3(uint32_t a, uint32_t b, uint32_t c) {
+    uint64_t lo = a | (static_cast<uint64_t>(b) << 32);
+    return hash_mum(lo ^ 0xa0761d6478bd642fULL, c ^ 0xe7037ed1a0b428dbULL);
+}
@@ -3,15 +3,22 @@
 #include <chrono>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
 #include <cstring>
+#include <cstdlib>
 #include <cassert>
 
 #include "platform_gpu.hpp"
 #include "platform_wm.hpp"
 
 #include "time_util.hpp"
+#include "file_util.hpp"
+#include "thread_pool.hpp"
 #include "render.hpp"
+#include "assets.hpp"
+#include "bvh.hpp"
+#include "raycast.hpp"
 
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -47,58 +54,49 @@ static void update_orbit_camera(Camera& cam, float lat, float lng, float r, glm:
                         std::sin(lat));
 }
 
-bool intersect(const Mesh& mesh,
-               const glm::vec3& ray_o,
-               const glm::vec3& ray_d,
-               float* t_out) {
-    bool rval = false;
-    float tmax;
-
-    for (size_t i = 0; i < mesh.indices.size() / 3; i++) {
-        glm::vec3 edge1 = mesh.positions[mesh.indices[i * 3 + 1]] - mesh.positions[mesh.indices[i * 3]];
-        glm::vec3 edge2 = mesh.positions[mesh.indices[i * 3 + 2]] - mesh.positions[mesh.indices[i * 3]];
-        glm::vec3 h = glm::cross(ray_d, edge2);
-        float a = glm::dot(edge1, h);
-        if (a == 0.0f)
-            continue;    // ray parallel to the triangle
-
-        float f = 1.0f / a;
-        glm::vec3 s = ray_o - mesh.positions[mesh.indices[i * 3]];
-        float u = f * glm::dot(s, h);
-        if (u < 0.0f || u > 1.0f)
-            continue;
-        glm::vec3 q = glm::cross(s, edge1);
-        float v = f * glm::dot(ray_d, q);
-        if (v < 0.0f || u + v > 1.0f)
-            continue;
-
-        // On calcule t pour savoir ou le point d'intersection se situe sur la ligne.
-        float t = f * glm::dot(edge2, q);
-        if (t > 0.0f && (!rval || t < tmax)) {
-            if (t_out) {
-                *t_out = t;
-            }
-            tmax = t;
-            rval = true;
-        } 
+// Binary PPM, from pixels in the order graphics_read_frame gives them.
+static void save_frame_ppm(const std::string& filename, const std::vector<uint32_t>& pixels, uint32_t width, uint32_t height) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open file " + filename);
     }
 
-    return rval;
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> rgb(3 * pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) {
+        rgb[3 * i + 0] = pixels[i] & 0xff;
+        rgb[3 * i + 1] = (pixels[i] >> 8) & 0xff;
+        rgb[3 * i + 2] = (pixels[i] >> 16) & 0xff;
+    }
+    file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
 }
 
 int main(int argc, char** argv) {
+    // --headless [frame_count [output.ppm]] renders offscreen without a
+    // display, and saves the last frame once everything has loaded.
+    bool headless = argc > 1 && strcmp(argv[1], "--headless") == 0;
+    uint32_t headless_frame_count = argc > 2 ? std::max(atoi(argv[2]), 1) : 1;
+    std::string headless_output = argc > 3 ? argv[3] : "frame.ppm";
+    uint32_t headless_frames_rendered = 0;
+
     GPUContext gpu;
-    gpu_init(gpu);
+    gpu_init(gpu, headless ? GPU_INIT_HEADLESS : 0);
 
     WMContext wm;
-    wm_init(wm);
-    
     GraphicsContext gfx;
-    graphics_init(&gpu, &wm, gfx);
+    if (headless) {
+        graphics_init_headless(&gpu, 640, 480, true, gfx);
+    } else {
+        wm_init(wm);
+        graphics_init(&gpu, &wm, gfx);
+    }
     
     VulkanComputeContext compute;
     compute_init(&gpu, compute);
 
+    ThreadPool pool;
+    thread_pool_init(pool);
+
     std::vector<Vertex> vertices = {
         {{-.5f, -.5f, 0}, {0, 0}, {0, 0, 1}},
         {{.5f, -.5f, 0}, {0, 0}, {0, 0, 1}},
@@ -112,34 +110,33 @@ int main(int argc, char** argv) {
     };
     assert(indices.size() % 3 == 0);
 
-    Mesh suzanne = load_obj_mesh("suzanne_smooth.obj");
-    GPUMesh suzanne_gpu = gpu_mesh_allocate(gpu, suzanne.positions.size(), suzanne.indices.size() / 3);
-    gpu_mesh_upload(gpu, suzanne_gpu, suzanne);
-    
-    GPUBuffer<Vertex> base_vertices = suzanne_gpu.vertex_buffer;
-    suzanne_gpu.vertex_buffer = gpu_buffer_allocate<Vertex>(gpu,
-                                                            COMPUTE | GRAPHICS | VERTEX_BUFFER | STORAGE_BUFFER,
-                                                            suzanne_gpu.vertex_buffer.count);
-
-    // test_compute(cctx, suzanne);
-
-    glm::vec3* suzanne_colors = gpu_buffer_map(gpu, suzanne_gpu.color_buffer);
+    AssetService assets;
+    asset_service_init(assets, &gpu, 1, &pool);
+
+    double load_start = now_ms();
+    uint32_t suzanne_flags = MESH_LOAD_OPTIMIZE | MESH_LOAD_LODS | MESH_LOAD_MESHLETS;
+    MeshHandle suzanne_handle = asset_load_mesh(assets, "suzanne_smooth.obj", suzanne_flags);
+    // A static copy next to it, drawn from quantized vertices.
+    MeshHandle compact_handle = asset_load_mesh(assets, "suzanne_smooth.obj", suzanne_flags, VERTEX_FORMAT_COMPACT);
+
+    // Set up once suzanne has streamed in.
+    GPUMesh suzanne_gpu;
+    GPUBuffer<Vertex> base_vertices;
+    bool suzanne_loaded = false;
+    size_t suzanne_model = 0;
+    GPUMesh compact_gpu;
+    bool compact_loaded = false;
+
+    // The compact copy keeps suzanne's rest pose, the wiggled one gets its own
+    // BVH refitted from the compute output before picking.
+    Bvh suzanne_bvh;
+    Bvh wiggle_bvh;
+    bool pick_requested = false;
 
-    for (uint32_t i = 0; i < suzanne.positions.size(); i++) {
-        suzanne_colors[i].x = suzanne.uvs[i].x;
-        suzanne_colors[i].y = suzanne.uvs[i].y;
-        suzanne_colors[i].z = 0.0f;
-    }
-
-    gpu_buffer_unmap(gpu, suzanne_gpu.color_buffer);
-    
-    
     auto kernel =
-        compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<Vertex>, GPUBuffer<float>>(compute, "shaders/wiggle.comp.spv");
+        compute_kernel_create<GPUBuffer<Vertex>, GPUBuffer<Vertex>, GPUBufferSlice<float>>(compute, "shaders/wiggle.comp.spv");
 
-    std::vector<GPUModel> models = {
-        {&suzanne_gpu, glm::translate(glm::vec3(0, 0, 0))},
-    };
+    std::vector<GPUModel> models;
     
     float orbit_speed = 2.0f;
     float zoom_speed = .1f;
@@ -168,7 +165,7 @@ int main(int argc, char** argv) {
 
     
     while (true) {
-        while (XPending(wm.display)) {
+        while (!headless && XPending(wm.display)) {
             XEvent event;
             XNextEvent(wm.display, &event);
 
@@ -205,6 +202,7 @@ int main(int argc, char** argv) {
                 switch (event.xbutton.button) {
                 case Button1:
                     mouse_button_down |= MOUSE_LEFT;
+                    pick_requested = true;
                     break;
                 case Button2:
                     mouse_button_down |= MOUSE_MIDDLE;
@@ -252,32 +250,143 @@ int main(int argc, char** argv) {
             break;
         }
 
-        gpu_mesh_upload(gpu, suzanne_gpu, suzanne);
+        asset_service_update(assets);
+
+        if (!suzanne_loaded) {
+            AssetState state = asset_mesh_state(assets, suzanne_handle);
+            if (state == ASSET_FAILED) {
+                asset_mesh_rethrow(assets, suzanne_handle);
+            }
+
+            if (state == ASSET_READY) {
+                double load_ms = now_ms() - load_start;
+                std::cout << "Loaded suzanne_smooth.obj in " << load_ms << "ms ("
+                          << file_size("suzanne_smooth.obj") / (1024.0 * 1024.0) / (load_ms / 1000.0) << " MB/s)\n";
+
+                const CachedMesh& suzanne = *asset_mesh_data(assets, suzanne_handle);
+                std::cout << "Split into " << suzanne.meshlet_count << " meshlets ("
+                          << static_cast<float>(suzanne.index_count / 3) / suzanne.meshlet_count
+                          << " triangles, "
+                          << static_cast<float>(suzanne.meshlet_vertex_count) / suzanne.meshlet_count
+                          << " vertices on average)\n";
+                suzanne_gpu = *asset_mesh_get(assets, suzanne_handle);
+
+                size_t index_size = suzanne_gpu.index_type == INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+                std::cout << "Index buffer : " << suzanne_gpu.index_count * index_size / 1024.0 << " KB ("
+                          << 8 * index_size << "-bit, " << suzanne.index_count / 3 << " triangles, "
+                          << suzanne.lod_index_count << " LOD indices)\n";
+
+                base_vertices = suzanne_gpu.vertex_buffer;
+                // Read back on the CPU when picking.
+                suzanne_gpu.vertex_buffer = gpu_buffer_allocate<Vertex>(gpu,
+                                                                        COMPUTE | GRAPHICS | VERTEX_BUFFER | STORAGE_BUFFER | HOST_ACCESS,
+                                                                        suzanne_gpu.vertex_buffer.count);
+
+                std::vector<glm::vec3> suzanne_colors(suzanne.vertex_count);
+                for (uint32_t i = 0; i < suzanne.vertex_count; i++) {
+                    suzanne_colors[i].x = suzanne.vertices[i].uv.x;
+                    suzanne_colors[i].y = suzanne.vertices[i].uv.y;
+                    suzanne_colors[i].z = 0.0f;
+                }
+                gpu_buffer_upload(gpu, suzanne_gpu.color_buffer, suzanne_colors.data(), 0, suzanne_colors.size());
+
+                double bvh_start = now_ms();
+                suzanne_bvh = build_bvh(suzanne, &pool);
+                std::cout << "Built BVH over " << suzanne.index_count / 3 << " triangles in "
+                          << now_ms() - bvh_start << "ms (" << suzanne_bvh.nodes.size() << " nodes)\n";
+                wiggle_bvh = suzanne_bvh;
+
+                suzanne_model = models.size();
+                models.push_back({&suzanne_gpu, glm::translate(glm::vec3(0, 0, 0))});
+                suzanne_loaded = true;
+            }
+        }
+
+        if (!compact_loaded) {
+            AssetState state = asset_mesh_state(assets, compact_handle);
+            if (state == ASSET_FAILED) {
+                asset_mesh_rethrow(assets, compact_handle);
+            }
+
+            if (state == ASSET_READY) {
+                const CachedMesh& suzanne = *asset_mesh_data(assets, compact_handle);
+                compact_gpu = *asset_mesh_get(assets, compact_handle);
+
+                std::vector<uint32_t> compact_colors(suzanne.vertex_count);
+                for (uint32_t i = 0; i < suzanne.vertex_count; i++) {
+                    compact_colors[i] = compact_color(glm::vec4(suzanne.vertices[i].uv, 0.0f, 1.0f));
+                }
+                gpu_buffer_upload(gpu, compact_gpu.compact_color_buffer, compact_colors.data(), 0, compact_colors.size());
+
+                std::cout << "Bytes per vertex : " << sizeof(Vertex) + sizeof(glm::vec3) << " full, "
+                          << sizeof(CompactVertex) + sizeof(uint32_t) << " compact\n";
+
+                models.push_back({&compact_gpu, glm::translate(glm::vec3(0, 1.5f, 0)) * glm::scale(glm::vec3(.5f))});
+                compact_loaded = true;
+            }
+        }
 
         double t1 = now_seconds();
         float elapsed = static_cast<float>(t1 - t0);
         float freq = .5f;
 
-        GPUBuffer<float> t_buf = gpu_buffer_allocate<float>(gpu, COMPUTE | STORAGE_BUFFER, 1);
-        gpu_buffer_upload(gpu, t_buf, &elapsed, 0, 1);
+        // Before any frame upload, they go to the slice begin_frame sets up.
+        GraphicsFrame frame = begin_frame(gfx);
+
+        if (suzanne_loaded) {
+            GPUBufferSlice<float> t_buf = graphics_frame_upload(gfx, &elapsed, 1);
         
-        double compute_before = now_seconds();
-        compute_kernel_invoke(compute,
-                              kernel,
-                              suzanne_gpu.vertex_buffer.count / 32 + 1, 1, 1,
-                              base_vertices,
-                              suzanne_gpu.vertex_buffer,
-                              t_buf);
-        compute_acc += (now_seconds() - compute_before);
-        gpu_buffer_free(gpu, t_buf);
-
-        models[0].transform = glm::scale(glm::vec3(.5f))
-            * glm::translate(glm::vec3(std::sin(elapsed), 0, 0))
-            * glm::rotate(2.0f * static_cast<float>(M_PI) * freq * elapsed, glm::vec3(0, 0, 1));
+            double compute_before = now_seconds();
+            compute_kernel_invoke(compute,
+                                  kernel,
+                                  (suzanne_gpu.vertex_buffer.count + 31) / 32, 1, 1,
+                                  base_vertices,
+                                  suzanne_gpu.vertex_buffer,
+                                  t_buf);
+            compute_acc += (now_seconds() - compute_before);
+
+            models[suzanne_model].transform = glm::scale(glm::vec3(.5f))
+                * glm::translate(glm::vec3(std::sin(elapsed), 0, 0))
+                * glm::rotate(2.0f * static_cast<float>(M_PI) * freq * elapsed, glm::vec3(0, 0, 1));
+        }
 
         update_orbit_camera(cam, cam_lat, cam_long, cam_r, cam_center);
 
-        GraphicsFrame frame = begin_frame(gfx);
+        if (pick_requested && suzanne_loaded) {
+            pick_requested = false;
+
+            glm::mat4 inv_view_proj = glm::inverse(camera_proj(cam) * camera_view(cam));
+            glm::vec4 near = inv_view_proj * glm::vec4(mouse_position, 0.0f, 1.0f);
+            glm::vec4 far = inv_view_proj * glm::vec4(mouse_position, 0.5f, 1.0f);
+            glm::vec3 ray_o = glm::vec3(near) / near.w;
+            glm::vec3 ray_d = glm::normalize(glm::vec3(far) / far.w - ray_o);
+
+            double pick_start = now_ms();
+
+            const CachedMesh& suzanne = *asset_mesh_data(assets, suzanne_handle);
+            const GPUBuffer<Vertex>& wiggled = suzanne_gpu.vertex_buffer;
+            gpu_buffer_invalidate(gpu, wiggled, 0, wiggled.count);
+            bool rebuilt = update_bvh(wiggle_bvh, &wiggled.mapped[0].position, sizeof(Vertex), suzanne.indices, suzanne.index_count);
+            std::cout << (rebuilt ? "Rebuilt" : "Refitted") << " BVH in " << now_ms() - pick_start << "ms\n";
+
+            // Instance ids are model indices. Models move every frame, so the
+            // top level is rebuilt for each pick.
+            std::vector<SceneInstance> instances(models.size());
+            for (size_t i = 0; i < models.size(); i++) {
+                instances[i].bvh = i == suzanne_model ? &wiggle_bvh : &suzanne_bvh;
+                instances[i].transform = models[i].transform;
+            }
+            SceneBvh scene = build_scene_bvh(instances.data(), instances.size());
+
+            float closest;
+            uint32_t picked_model;
+            uint32_t picked_triangle;
+            if (intersect(scene, ray_o, ray_d, &closest, &picked_model, &picked_triangle)) {
+                std::cout << "Picked triangle " << picked_triangle << " of model " << picked_model
+                          << " at distance " << closest << " (" << now_ms() - pick_start << "ms)\n";
+            }
+        }
+
         {
             cam.aspect = static_cast<float>(gfx.swapchain.extent.width)
                 / static_cast<float>(gfx.swapchain.extent.height);
@@ -289,6 +398,17 @@ int main(int argc, char** argv) {
             end_frame(gfx, frame);
         }
 
+        if (headless && suzanne_loaded && compact_loaded) {
+            headless_frames_rendered++;
+            if (headless_frames_rendered == headless_frame_count) {
+                std::vector<uint32_t> pixels(gfx.swapchain.extent.width * gfx.swapchain.extent.height);
+                graphics_read_frame(gfx, frame, pixels.data());
+                save_frame_ppm(headless_output, pixels, gfx.swapchain.extent.width, gfx.swapchain.extent.height);
+                std::cout << "Saved frame " << frame.frame_index << " to " << headless_output << "\n";
+                should_close = true;
+            }
+        }
+
         current_frame++;
     }
 
@@ -305,12 +425,19 @@ int main(int argc, char** argv) {
     compute_kernel_destroy(compute, kernel);
     compute_finalize(compute);
     
-    gpu_mesh_destroy(gpu, suzanne_gpu);
-    gpu_buffer_free(gpu, base_vertices);
+    // The asset service owns everything but the wiggled vertices.
+    if (suzanne_loaded) {
+        gpu_buffer_free(gpu, suzanne_gpu.vertex_buffer);
+    }
+    asset_service_finalize(assets);
 
     graphics_finalize(gfx);
 
-    wm_finalize(wm);
+    thread_pool_finalize(pool);
+
+    if (!headless) {
+        wm_finalize(wm);
+    }
     
     gpu_finalize(gpu);
 }
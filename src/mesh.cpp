@@ -0,0 +1,417 @@
+#include "mesh.hpp"
+
+#include "file_util.hpp"
+#include "hash.hpp"
+#include "mesh_optimize.hpp"
+#include "simplify.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <charconv>
+#include <cstring>
+#include <cassert>
+
+#include "flat_hash_map.hpp"
+
+struct ObjCounts {
+    size_t positions;
+    size_t uvs;
+    size_t normals;
+    size_t corners;
+    size_t triangles;
+};
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_blanks(const char* p, const char* end) {
+    while (p != end && is_blank(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static inline const char* skip_token(const char* p, const char* end) {
+    while (p != end && !is_blank(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static inline const char* line_end(const char* p, const char* end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    return eol ? eol : end;
+}
+
+static inline const char* parse_float(const char* p, const char* end, float& out) {
+    p = skip_blanks(p, end);
+    if (p != end && *p == '+') {
+        p++;
+    }
+
+    std::from_chars_result result = std::from_chars(p, end, out);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error("Expected a number in .obj file");
+    }
+
+    return result.ptr;
+}
+
+static inline const char* parse_index(const char* p, const char* end, uint32_t& out) {
+    const char* start = p;
+    uint32_t value = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    if (p == start) {
+        throw std::runtime_error("Expected an index in .obj file");
+    }
+
+    out = value;
+    return p;
+}
+
+// Cheap first pass so that every array can be sized before parsing.
+static ObjCounts count_obj_records(const char* begin, const char* end) {
+    ObjCounts counts{};
+
+    for (const char* p = begin; p < end; ) {
+        const char* eol = line_end(p, end);
+        const char* head = skip_blanks(p, eol);
+        const char* head_end = skip_token(head, eol);
+        p = eol + (eol != end);
+
+        size_t head_size = head_end - head;
+        if (head_size == 1 && head[0] == 'v') {
+            counts.positions++;
+        } else if (head_size == 2 && head[0] == 'v' && head[1] == 't') {
+            counts.uvs++;
+        } else if (head_size == 2 && head[0] == 'v' && head[1] == 'n') {
+            counts.normals++;
+        } else if (head_size == 1 && head[0] == 'f') {
+            size_t face_corners = 0;
+            for (const char* q = skip_blanks(head_end, eol); q != eol; q = skip_blanks(q, eol)) {
+                q = skip_token(q, eol);
+                face_corners++;
+            }
+
+            // Matches the fan emitted by load_obj_mesh, one triangle per corner after the first.
+            counts.corners += face_corners;
+            if (face_corners > 0) {
+                counts.triangles += face_corners - 1;
+            }
+        }
+    }
+
+    return counts;
+}
+
+// One face corner, as 1-based position/uv/normal indices.
+struct VertexKey {
+    uint32_t v;
+    uint32_t vt;
+    uint32_t vn;
+};
+
+static inline bool operator==(const VertexKey& a, const VertexKey& b) {
+    return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+}
+
+static inline uint64_t hash_key(const VertexKey& key) {
+    return hash_u32x3(key.v, key.vt, key.vn);
+}
+
+// Records parsed from one newline-aligned slice of the file. Face corners are
+// deduplicated locally, in first-seen order, and indices refer to that local
+// numbering until the merge.
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+
+    std::vector<VertexKey> unique_vertices;
+    std::vector<uint32_t> indices;
+
+    std::string log;
+
+    // Offsets of this chunk's records in the merged arrays.
+    size_t position_offset;
+    size_t uv_offset;
+    size_t normal_offset;
+    size_t index_offset;
+
+    std::vector<uint32_t> global_vertices;
+};
+
+static void parse_obj_chunk(ObjChunk& chunk) {
+    ObjCounts counts = count_obj_records(chunk.begin, chunk.end);
+
+    // Closed meshes have about one vertex per six corners, and UV or normal
+    // seams add to that. The table grows if this guess is too small.
+    FlatHashMap<VertexKey> vertex_indices;
+    flat_hash_map_reserve(vertex_indices, counts.corners / 2);
+
+    chunk.unique_vertices.reserve(counts.corners);
+    chunk.positions.reserve(counts.positions);
+    chunk.normals.reserve(counts.normals);
+    chunk.uvs.reserve(counts.uvs);
+    chunk.indices.reserve(counts.triangles * 3);
+
+    // Reused across faces so that polygons do not allocate.
+    std::vector<uint32_t> face_indices;
+
+    for (const char* p = chunk.begin; p < chunk.end; ) {
+        const char* eol = line_end(p, chunk.end);
+        const char* head = skip_blanks(p, eol);
+        p = eol + (eol != chunk.end);
+
+        if (head == eol || *head == '#') {
+            continue;
+        }
+
+        const char* head_end = skip_token(head, eol);
+        size_t head_size = head_end - head;
+
+        if (head_size == 1 && head[0] == 'f') {
+            face_indices.clear();
+
+            for (const char* q = skip_blanks(head_end, eol); q != eol; q = skip_blanks(q, eol)) {
+                uint32_t v, vt, vn;
+                    
+                q = parse_index(q, eol, v);
+                if (q == eol || *q != '/') {
+                    throw std::runtime_error("Expected '/' in .obj file");
+                }
+                q = parse_index(q + 1, eol, vt);
+                if (q == eol || *q != '/') {
+                    throw std::runtime_error("Expected '/' in .obj file");
+                }
+                q = parse_index(q + 1, eol, vn);
+
+                VertexKey vertex = {v, vt, vn};
+                uint32_t next_index = chunk.unique_vertices.size();
+                uint32_t index = flat_hash_map_insert(vertex_indices, vertex, next_index);
+                if (index == next_index) {
+                    chunk.unique_vertices.push_back(vertex);
+                }
+                face_indices.push_back(index);
+            }
+
+            for (uint32_t second = 0; second + 1 < face_indices.size(); second++) {
+                uint32_t third = second + 1;
+                chunk.indices.push_back(face_indices[0]);
+                chunk.indices.push_back(face_indices[second]);
+                chunk.indices.push_back(face_indices[third]);
+            }
+        } else if (head_size == 1 && head[0] == 'v') {
+            glm::vec3 pos;
+            const char* q = parse_float(head_end, eol, pos.x);
+            q = parse_float(q, eol, pos.y);
+            parse_float(q, eol, pos.z);
+            chunk.positions.push_back(pos);
+        } else if (head_size == 2 && head[0] == 'v' && head[1] == 't') {
+            glm::vec2 uv;
+            const char* q = parse_float(head_end, eol, uv.x);
+            parse_float(q, eol, uv.y);
+            chunk.uvs.push_back(uv);
+        } else if (head_size == 2 && head[0] == 'v' && head[1] == 'n') {
+            glm::vec3 normal;
+            const char* q = parse_float(head_end, eol, normal.x);
+            q = parse_float(q, eol, normal.y);
+            parse_float(q, eol, normal.z);
+            chunk.normals.push_back(normal);
+        } else {
+            chunk.log += "Unknown .obj file directive '" + std::string(head, head_size) + "'\n";
+        }
+    }
+}
+
+// Splits [begin, end) into roughly equal slices that each end on a newline.
+static std::vector<ObjChunk> split_obj_chunks(const char* begin, const char* end, size_t chunk_count) {
+    std::vector<ObjChunk> chunks;
+    size_t target_size = (end - begin) / chunk_count + 1;
+
+    const char* p = begin;
+    while (p < end) {
+        const char* chunk_end = p + std::min<size_t>(target_size, end - p);
+        chunk_end = line_end(chunk_end, end);
+        chunk_end += (chunk_end != end);
+
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = chunk_end;
+        p = chunk_end;
+    }
+
+    return chunks;
+}
+
+template<typename F>
+static void for_each_index(ThreadPool* pool, size_t count, F f) {
+    if (pool && count > 1) {
+        parallel_for(*pool, count, f);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            f(i);
+        }
+    }
+}
+
+static void merge_obj_chunks(std::vector<ObjChunk>& chunks, ThreadPool* pool, Mesh& mesh) {
+    size_t position_count = 0;
+    size_t uv_count = 0;
+    size_t normal_count = 0;
+    size_t index_count = 0;
+    for (ObjChunk& chunk : chunks) {
+        std::cout << chunk.log;
+
+        chunk.position_offset = position_count;
+        chunk.uv_offset = uv_count;
+        chunk.normal_offset = normal_count;
+        chunk.index_offset = index_count;
+
+        position_count += chunk.positions.size();
+        uv_count += chunk.uvs.size();
+        normal_count += chunk.normals.size();
+        index_count += chunk.indices.size();
+    }
+
+    // Assign global vertex ids in the order the corners appear in the file,
+    // which is the order a single sequential pass would produce.
+    std::vector<VertexKey> unique_vertices;
+    if (chunks.size() == 1) {
+        unique_vertices = std::move(chunks[0].unique_vertices);
+    } else {
+        FlatHashMap<VertexKey> vertex_indices;
+        flat_hash_map_reserve(vertex_indices, chunks[0].unique_vertices.size() * chunks.size());
+
+        for (ObjChunk& chunk : chunks) {
+            chunk.global_vertices.resize(chunk.unique_vertices.size());
+            for (size_t i = 0; i < chunk.unique_vertices.size(); i++) {
+                uint32_t next_index = unique_vertices.size();
+                uint32_t index = flat_hash_map_insert(vertex_indices, chunk.unique_vertices[i], next_index);
+                if (index == next_index) {
+                    unique_vertices.push_back(chunk.unique_vertices[i]);
+                }
+                chunk.global_vertices[i] = index;
+            }
+        }
+    }
+
+    for (const VertexKey& vertex : unique_vertices) {
+        if (vertex.v == 0 || vertex.v > position_count
+            || vertex.vt == 0 || vertex.vt > uv_count
+            || vertex.vn == 0 || vertex.vn > normal_count) {
+            throw std::runtime_error("Index out of range in .obj file");
+        }
+    }
+
+    std::vector<glm::vec3> raw_positions;
+    std::vector<glm::vec3> raw_normals;
+    std::vector<glm::vec2> raw_uvs;
+    if (chunks.size() == 1) {
+        raw_positions = std::move(chunks[0].positions);
+        raw_uvs = std::move(chunks[0].uvs);
+        raw_normals = std::move(chunks[0].normals);
+        mesh.indices = std::move(chunks[0].indices);
+    } else {
+        raw_positions.resize(position_count);
+        raw_uvs.resize(uv_count);
+        raw_normals.resize(normal_count);
+        mesh.indices.resize(index_count);
+
+        auto copy_chunk = [&](size_t c) {
+            ObjChunk& chunk = chunks[c];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), raw_positions.begin() + chunk.position_offset);
+            std::copy(chunk.uvs.begin(), chunk.uvs.end(), raw_uvs.begin() + chunk.uv_offset);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), raw_normals.begin() + chunk.normal_offset);
+
+            uint32_t* indices = mesh.indices.data() + chunk.index_offset;
+            for (size_t i = 0; i < chunk.indices.size(); i++) {
+                indices[i] = chunk.global_vertices[chunk.indices[i]];
+            }
+        };
+
+        for_each_index(pool, chunks.size(), copy_chunk);
+    }
+
+    mesh.positions.resize(unique_vertices.size());
+    mesh.uvs.resize(unique_vertices.size());
+    mesh.normals.resize(unique_vertices.size());
+
+    size_t range_size = unique_vertices.size() / chunks.size() + 1;
+    for_each_index(pool, chunks.size(), [&](size_t c) {
+        size_t range_end = std::min(unique_vertices.size(), (c + 1) * range_size);
+        for (size_t i = c * range_size; i < range_end; i++) {
+            mesh.positions[i] = raw_positions[unique_vertices[i].v - 1];
+            mesh.uvs[i] = raw_uvs[unique_vertices[i].vt - 1];
+            mesh.normals[i] = raw_normals[unique_vertices[i].vn - 1];
+        }
+    });
+}
+
+Mesh load_obj_mesh(const std::string &filename, ThreadPool* pool, uint32_t flags) {
+    Mesh mesh;
+
+    MappedFile file = map_file(filename);
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+
+    try {
+        // Small files are not worth the merge.
+        const size_t min_chunk_size = 1 << 20;
+        size_t chunk_count = 1;
+        if (pool) {
+            chunk_count = std::min<size_t>(4 * thread_pool_size(*pool), file.size / min_chunk_size + 1);
+        }
+
+        std::vector<ObjChunk> chunks = split_obj_chunks(begin, end, chunk_count);
+        if (chunks.empty()) {
+            chunks.emplace_back();
+            chunks.back().begin = begin;
+            chunks.back().end = end;
+        }
+
+        for_each_index(pool, chunks.size(), [&chunks](size_t c) { parse_obj_chunk(chunks[c]); });
+
+        merge_obj_chunks(chunks, pool, mesh);
+
+        if (flags & MESH_LOAD_OPTIMIZE) {
+            VertexCacheStats before, after;
+            mesh_optimize(mesh, &before, &after);
+            std::cout << "Optimized " << filename
+                      << " : ACMR " << before.acmr << " -> " << after.acmr
+                      << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+        }
+
+        if (flags & MESH_LOAD_LODS) {
+            build_mesh_lods(mesh);
+            std::cout << "Built " << mesh.lods.size() << " LODs for " << filename << " :";
+            for (const MeshLod& lod : mesh.lods) {
+                std::cout << " " << lod.index_count / 3;
+            }
+            std::cout << " triangles\n";
+        }
+
+        if (flags & MESH_LOAD_MESHLETS) {
+            mesh.meshlets = build_meshlets(mesh);
+        }
+    } catch (...) {
+        unmap_file(file);
+        throw;
+    }
+
+    unmap_file(file);
+
+    assert(mesh.positions.size() == mesh.uvs.size()
+           && mesh.uvs.size() == mesh.normals.size());
+
+    return mesh;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "meshlet.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct ThreadPool;
+
+struct Vertex {
+    glm::vec3 position;
+    glm::vec2 uv;
+    glm::vec3 normal;
+};
+static_assert(sizeof(Vertex) == sizeof(float) * 8, "Wrong size for Vertex");
+
+// Quantized Vertex, see quantize.hpp.
+struct CompactVertex {
+    // unorm16 within the mesh bounds. The fourth component is padding, three
+    // component 16-bit vertex formats are rarely supported.
+    uint16_t position[4];
+    // Octahedral encoding, snorm16x2
+    uint32_t normal;
+    // half2
+    uint32_t uv;
+};
+static_assert(sizeof(CompactVertex) == 16, "Wrong size for CompactVertex");
+
+enum VertexFormat : uint32_t {
+    // Vertex, with a vec3 color stream
+    VERTEX_FORMAT_FULL,
+    // CompactVertex, with an RGBA8 color stream
+    VERTEX_FORMAT_COMPACT,
+};
+
+// A range of the index buffer drawing the mesh at some level of detail.
+struct MeshLod {
+    uint32_t index_offset;
+    uint32_t index_count;
+    // Object-space distance to the full mesh, as estimated by the simplifier.
+    float error;
+};
+
+struct Mesh {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    
+    std::vector<uint32_t> indices;
+
+    // Only filled with MESH_LOAD_LODS. The first level is `indices`, the
+    // others index into lod_indices, placed right after `indices`.
+    std::vector<MeshLod> lods;
+    std::vector<uint32_t> lod_indices;
+
+    // Only filled with MESH_LOAD_MESHLETS.
+    MeshletData meshlets;
+};
+
+enum MeshLoadFlags : uint32_t {
+    // Reorder triangles and vertices for the GPU, see mesh_optimize.hpp.
+    MESH_LOAD_OPTIMIZE = 0x01,
+    // Split into meshlets, see meshlet.hpp.
+    MESH_LOAD_MESHLETS = 0x02,
+    // Build a chain of simplified index buffers, see simplify.hpp.
+    MESH_LOAD_LODS = 0x04,
+};
+
+// Parses a triangulated v/vt/vn .obj file. With a pool, newline-aligned chunks
+// are parsed in parallel and merged into the same Mesh as the serial path.
+Mesh load_obj_mesh(const std::string& filename, ThreadPool* pool = nullptr, uint32_t flags = 0);
@@ -0,0 +1,264 @@
+#include "mesh_cache.hpp"
+
+#include "hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+static const char MESH_CACHE_MAGIC[4] = {'V', 'G', 'P', 'M'};
+
+// Bump whenever MeshCacheHeader, Vertex, CompactVertex, MeshLod or Meshlet change.
+static const uint32_t MESH_CACHE_VERSION = 5;
+
+std::string mesh_cache_path(const std::string& source_filename) {
+    const char* cache_dir = getenv("VGP_CACHE_DIR");
+    if (!cache_dir || !cache_dir[0]) {
+        return source_filename + ".vgpm";
+    }
+
+    size_t slash = source_filename.find_last_of('/');
+    std::string base_name = slash == std::string::npos
+        ? source_filename
+        : source_filename.substr(slash + 1);
+
+    return std::string(cache_dir) + "/" + base_name + ".vgpm";
+}
+
+// The whole cache file, as mesh_cache_write stores it.
+static std::vector<char> serialize_mesh(uint64_t source_hash,
+                                        uint64_t source_size,
+                                        uint32_t load_flags,
+                                        const Mesh& mesh) {
+    MeshCacheHeader header{};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.vertex_count = mesh.positions.size();
+    header.vertex_offset = sizeof(MeshCacheHeader);
+    header.compact_vertex_offset = header.vertex_offset + header.vertex_count * sizeof(Vertex);
+    header.index_count = mesh.indices.size();
+    header.index_offset = header.compact_vertex_offset + header.vertex_count * sizeof(CompactVertex);
+    header.lod_index_count = mesh.lod_indices.size();
+    header.lod_count = mesh.lods.size();
+    header.lod_offset = header.index_offset + (header.index_count + header.lod_index_count) * sizeof(uint32_t);
+    header.load_flags = load_flags;
+    header.meshlet_count = mesh.meshlets.meshlets.size();
+    header.meshlet_offset = header.lod_offset + header.lod_count * sizeof(MeshLod);
+    header.meshlet_vertex_count = mesh.meshlets.vertices.size();
+    header.meshlet_vertex_offset = header.meshlet_offset + header.meshlet_count * sizeof(Meshlet);
+    header.meshlet_triangle_size = mesh.meshlets.triangles.size();
+    header.meshlet_triangle_offset = header.meshlet_vertex_offset + header.meshlet_vertex_count * sizeof(uint32_t);
+
+    VertexQuantization quantization = vertex_quantization(mesh.positions.data(), mesh.positions.size());
+    for (int k = 0; k < 3; k++) {
+        header.position_offset[k] = quantization.offset[k];
+        header.position_scale[k] = quantization.scale[k];
+    }
+
+    std::vector<Vertex> vertices(mesh.positions.size());
+    std::vector<CompactVertex> compact_vertices(mesh.positions.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].position = mesh.positions[i];
+        vertices[i].uv = mesh.uvs[i];
+        vertices[i].normal = mesh.normals[i];
+        compact_vertices[i] = compact_vertex(mesh.positions[i], mesh.uvs[i], mesh.normals[i], quantization);
+    }
+
+    if (!mesh.positions.empty()) {
+        glm::vec3 min = mesh.positions[0];
+        glm::vec3 max = min;
+        for (const glm::vec3& p : mesh.positions) {
+            min = glm::min(min, p);
+            max = glm::max(max, p);
+        }
+
+        glm::vec3 center = (min + max) * .5f;
+        float radius = 0.0f;
+        for (const glm::vec3& p : mesh.positions) {
+            radius = std::max(radius, glm::length(p - center));
+        }
+
+        header.bounds[0] = center.x;
+        header.bounds[1] = center.y;
+        header.bounds[2] = center.z;
+        header.bounds[3] = radius;
+    }
+
+    std::vector<char> image;
+    image.reserve(header.meshlet_triangle_offset + header.meshlet_triangle_size);
+    auto append = [&image](const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        image.insert(image.end(), bytes, bytes + size);
+    };
+    append(&header, sizeof(header));
+    append(vertices.data(), vertices.size() * sizeof(Vertex));
+    append(compact_vertices.data(), compact_vertices.size() * sizeof(CompactVertex));
+    append(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+    append(mesh.lod_indices.data(), mesh.lod_indices.size() * sizeof(uint32_t));
+    append(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+    append(mesh.meshlets.meshlets.data(), mesh.meshlets.meshlets.size() * sizeof(Meshlet));
+    append(mesh.meshlets.vertices.data(), mesh.meshlets.vertices.size() * sizeof(uint32_t));
+    append(mesh.meshlets.triangles.data(), mesh.meshlets.triangles.size());
+
+    return image;
+}
+
+// Write to a temporary file first so that readers never see a partial cache.
+static bool write_cache_image(const std::string& source_filename, const std::vector<char>& image) {
+    std::string path = mesh_cache_path(source_filename);
+    // Unique per process and call, concurrent writers of the same cache each
+    // rename a complete file of their own.
+    static std::atomic<uint32_t> tmp_counter{0};
+    std::string tmp_path = path + "." + std::to_string(getpid()) + "." + std::to_string(tmp_counter++) + ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(image.data(), image.size());
+    file.close();
+
+    if (!file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Warning : could not write mesh cache " << path << "\n";
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void mesh_cache_write(const std::string& source_filename,
+                      uint64_t source_hash,
+                      uint64_t source_size,
+                      uint32_t load_flags,
+                      const Mesh& mesh) {
+    write_cache_image(source_filename, serialize_mesh(source_hash, source_size, load_flags, mesh));
+}
+
+// Points cached into a cache image, if it is valid for the source.
+static bool parse_cache(const MappedFile& file,
+                        uint64_t source_hash,
+                        uint64_t source_size,
+                        uint32_t load_flags,
+                        CachedMesh& cached) {
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(file.data);
+    bool valid = file.size >= sizeof(MeshCacheHeader)
+        && !memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic))
+        && header->version == MESH_CACHE_VERSION
+        && header->source_hash == source_hash
+        && header->source_size == source_size
+        && header->load_flags == load_flags
+        && header->vertex_offset + header->vertex_count * sizeof(Vertex) <= file.size
+        && header->compact_vertex_offset + header->vertex_count * sizeof(CompactVertex) <= file.size
+        && header->index_offset + (header->index_count + header->lod_index_count) * sizeof(uint32_t) <= file.size
+        && header->lod_offset + header->lod_count * sizeof(MeshLod) <= file.size
+        && header->meshlet_offset + header->meshlet_count * sizeof(Meshlet) <= file.size
+        && header->meshlet_vertex_offset + header->meshlet_vertex_count * sizeof(uint32_t) <= file.size
+        && header->meshlet_triangle_offset + header->meshlet_triangle_size <= file.size;
+
+    if (!valid) {
+        return false;
+    }
+
+    cached.vertices = reinterpret_cast<const Vertex*>(file.data + header->vertex_offset);
+    cached.vertex_count = header->vertex_count;
+    cached.compact_vertices = reinterpret_cast<const CompactVertex*>(file.data + header->compact_vertex_offset);
+    cached.quantization.offset = glm::vec3(header->position_offset[0], header->position_offset[1], header->position_offset[2]);
+    cached.quantization.scale = glm::vec3(header->position_scale[0], header->position_scale[1], header->position_scale[2]);
+    cached.indices = reinterpret_cast<const uint32_t*>(file.data + header->index_offset);
+    cached.index_count = header->index_count;
+    cached.lod_index_count = header->lod_index_count;
+    cached.lods = reinterpret_cast<const MeshLod*>(file.data + header->lod_offset);
+    cached.lod_count = header->lod_count;
+    cached.bounds = glm::vec4(header->bounds[0], header->bounds[1], header->bounds[2], header->bounds[3]);
+    cached.meshlets = reinterpret_cast<const Meshlet*>(file.data + header->meshlet_offset);
+    cached.meshlet_count = header->meshlet_count;
+    cached.meshlet_vertices = reinterpret_cast<const uint32_t*>(file.data + header->meshlet_vertex_offset);
+    cached.meshlet_vertex_count = header->meshlet_vertex_count;
+    cached.meshlet_triangles = reinterpret_cast<const uint8_t*>(file.data + header->meshlet_triangle_offset);
+    cached.meshlet_triangle_size = header->meshlet_triangle_size;
+
+    return true;
+}
+
+bool mesh_cache_open(const std::string& source_filename,
+                     uint64_t source_hash,
+                     uint64_t source_size,
+                     uint32_t load_flags,
+                     CachedMesh& cached) {
+    std::string path = mesh_cache_path(source_filename);
+
+    MappedFile file;
+    try {
+        file = map_file(path);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    if (!parse_cache(file, source_hash, source_size, load_flags, cached)) {
+        unmap_file(file);
+        return false;
+    }
+    cached.file = file;
+    cached.memory = nullptr;
+
+    return true;
+}
+
+void mesh_cache_close(CachedMesh& cached) {
+    unmap_file(cached.file);
+    cached.memory = nullptr;
+    cached.vertices = nullptr;
+    cached.vertex_count = 0;
+    cached.compact_vertices = nullptr;
+    cached.indices = nullptr;
+    cached.index_count = 0;
+    cached.lod_index_count = 0;
+    cached.lods = nullptr;
+    cached.lod_count = 0;
+    cached.meshlets = nullptr;
+    cached.meshlet_count = 0;
+    cached.meshlet_vertices = nullptr;
+    cached.meshlet_vertex_count = 0;
+    cached.meshlet_triangles = nullptr;
+    cached.meshlet_triangle_size = 0;
+}
+
+CachedMesh load_mesh_cached(const std::string& filename, ThreadPool* pool, uint32_t load_flags) {
+    MappedFile source = map_file(filename);
+    uint64_t source_hash = hash_bytes(source.data, source.size);
+    uint64_t source_size = source.size;
+    unmap_file(source);
+
+    CachedMesh cached;
+    if (mesh_cache_open(filename, source_hash, source_size, load_flags, cached)) {
+        return cached;
+    }
+
+    Mesh mesh = load_obj_mesh(filename, pool, load_flags);
+    std::shared_ptr<std::vector<char>> memory =
+        std::make_shared<std::vector<char>>(serialize_mesh(source_hash, source_size, load_flags, mesh));
+
+    if (write_cache_image(filename, *memory)
+        && mesh_cache_open(filename, source_hash, source_size, load_flags, cached)) {
+        return cached;
+    }
+
+    // The cache could not be written, the same image is kept in memory
+    // instead.
+    std::cerr << "Warning : serving " << filename << " without a cache, set VGP_CACHE_DIR to a writable directory.\n";
+    MappedFile image;
+    image.data = memory->data();
+    image.size = memory->size();
+    parse_cache(image, source_hash, source_size, load_flags, cached);
+    cached.file.data = nullptr;
+    cached.file.size = 0;
+    cached.memory = memory;
+
+    return cached;
+}
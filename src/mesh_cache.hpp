@@ -0,0 +1,101 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "file_util.hpp"
+#include "quantize.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// On-disk layout of a .vgpm file. The vertex, compact vertex, index, LOD and
+// meshlet arrays follow the header at the given byte offsets, in native byte
+// order. LOD indices directly follow the full mesh indices.
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t vertex_count;
+    uint64_t vertex_offset;
+    // vertex_count CompactVertex, quantized with the offset and scale below
+    uint64_t compact_vertex_offset;
+    float position_offset[4];
+    float position_scale[4];
+    uint64_t index_count;
+    uint64_t index_offset;
+    uint64_t lod_index_count;
+    uint64_t lod_count;
+    uint64_t lod_offset;
+    // Bounding sphere, center then radius
+    float bounds[4];
+    // MeshLoadFlags the mesh was loaded with.
+    uint64_t load_flags;
+    uint64_t meshlet_count;
+    uint64_t meshlet_offset;
+    uint64_t meshlet_vertex_count;
+    uint64_t meshlet_vertex_offset;
+    // In bytes
+    uint64_t meshlet_triangle_size;
+    uint64_t meshlet_triangle_offset;
+};
+
+// Mesh data read straight from a mapped cache file. The arrays stay valid
+// until mesh_cache_close.
+struct CachedMesh {
+    MappedFile file;
+    // Holds the cache image instead of file when it could not be written.
+    // Shared so that copies of the CachedMesh keep pointing into it.
+    std::shared_ptr<const std::vector<char>> memory;
+
+    const Vertex* vertices;
+    size_t vertex_count;
+
+    // The same vertices, in VERTEX_FORMAT_COMPACT.
+    const CompactVertex* compact_vertices;
+    VertexQuantization quantization;
+
+    // Holds index_count indices for the full mesh, then lod_index_count
+    // indices for the other levels of detail.
+    const uint32_t* indices;
+    size_t index_count;
+    size_t lod_index_count;
+
+    // Empty unless loaded with MESH_LOAD_LODS.
+    const MeshLod* lods;
+    size_t lod_count;
+
+    // Bounding sphere, center then radius
+    glm::vec4 bounds;
+
+    // Empty unless loaded with MESH_LOAD_MESHLETS.
+    const Meshlet* meshlets;
+    size_t meshlet_count;
+    const uint32_t* meshlet_vertices;
+    size_t meshlet_vertex_count;
+    const uint8_t* meshlet_triangles;
+    size_t meshlet_triangle_size;
+};
+
+std::string mesh_cache_path(const std::string& source_filename);
+
+// Writes the cache for a source file whose contents hash to source_hash.
+// Failing to write is not an error, the cache is just skipped.
+void mesh_cache_write(const std::string& source_filename,
+                      uint64_t source_hash,
+                      uint64_t source_size,
+                      uint32_t load_flags,
+                      const Mesh& mesh);
+
+// Returns false if there is no cache for the source, if it is stale or if it
+// was loaded with other flags.
+bool mesh_cache_open(const std::string& source_filename,
+                     uint64_t source_hash,
+                     uint64_t source_size,
+                     uint32_t load_flags,
+                     CachedMesh& cached);
+void mesh_cache_close(CachedMesh& cached);
+
+// Maps the cache of an .obj file, parsing the source and writing the cache
+// first if needed.
+CachedMesh load_mesh_cached(const std::string& filename, ThreadPool* pool = nullptr, uint32_t load_flags = 0);
@@ -0,0 +1,253 @@
+#include "mesh_optimize.hpp"
+
+#include <cmath>
+#include <vector>
+
+VertexCacheStats analyze_vertex_cache(const uint32_t* indices,
+                                      size_t index_count,
+                                      size_t vertex_count,
+                                      uint32_t cache_size) {
+    // timestamps[v] is the value of `transforms` when v last entered the
+    // cache, so v is cached while fewer than cache_size misses followed.
+    std::vector<size_t> timestamps(vertex_count, 0);
+    size_t transforms = 0;
+
+    for (size_t i = 0; i < index_count; i++) {
+        uint32_t v = indices[i];
+        if (timestamps[v] == 0 || transforms - timestamps[v] >= cache_size) {
+            transforms++;
+            timestamps[v] = transforms;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = index_count ? static_cast<float>(transforms) / (index_count / 3) : 0.0f;
+    stats.atvr = vertex_count ? static_cast<float>(transforms) / vertex_count : 0.0f;
+    return stats;
+}
+
+void mesh_remove_degenerate_triangles(Mesh& mesh) {
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        uint32_t a = mesh.indices[i];
+        uint32_t b = mesh.indices[i + 1];
+        uint32_t c = mesh.indices[i + 2];
+        if (a == b || b == c || c == a) {
+            continue;
+        }
+
+        mesh.indices[kept++] = a;
+        mesh.indices[kept++] = b;
+        mesh.indices[kept++] = c;
+    }
+    mesh.indices.resize(kept);
+}
+
+static const int FORSYTH_CACHE_SIZE = 32;
+static const int FORSYTH_VALENCE_TABLE_SIZE = 32;
+
+static float forsyth_cache_score(int cache_position) {
+    // The three vertices of the last triangle get a fixed score, so that the
+    // next one does not just reuse the same edge.
+    if (cache_position < 3) {
+        return 0.75f;
+    }
+
+    float scaled = 1.0f - static_cast<float>(cache_position - 3) / (FORSYTH_CACHE_SIZE - 3);
+    return std::pow(scaled, 1.5f);
+}
+
+static float forsyth_valence_score(uint32_t valence) {
+    // Favors finishing off vertices that only have a few triangles left.
+    return 2.0f / std::sqrt(static_cast<float>(valence));
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count) {
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    float cache_scores[FORSYTH_CACHE_SIZE];
+    for (int i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+        cache_scores[i] = forsyth_cache_score(i);
+    }
+    float valence_scores[FORSYTH_VALENCE_TABLE_SIZE];
+    for (int i = 1; i < FORSYTH_VALENCE_TABLE_SIZE; i++) {
+        valence_scores[i] = forsyth_valence_score(i);
+    }
+
+    // Triangles of each vertex, the first `valence` of which are not emitted yet.
+    std::vector<uint32_t> valence(vertex_count, 0);
+    for (uint32_t index : indices) {
+        valence[index]++;
+    }
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; v++) {
+        adjacency_offsets[v + 1] = adjacency_offsets[v] + valence[v];
+    }
+
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<int> cache_positions(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count);
+
+    auto score_vertex = [&](uint32_t v) {
+        if (valence[v] == 0) {
+            return -1.0f;
+        }
+        float score = cache_positions[v] >= 0 ? cache_scores[cache_positions[v]] : 0.0f;
+        score += valence[v] < FORSYTH_VALENCE_TABLE_SIZE
+            ? valence_scores[valence[v]]
+            : forsyth_valence_score(valence[v]);
+        return score;
+    };
+
+    for (size_t v = 0; v < vertex_count; v++) {
+        vertex_scores[v] = score_vertex(v);
+    }
+
+    std::vector<float> triangle_scores(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+
+    size_t best_triangle = 0;
+    for (size_t t = 0; t < triangle_count; t++) {
+        triangle_scores[t] = vertex_scores[indices[t * 3]]
+            + vertex_scores[indices[t * 3 + 1]]
+            + vertex_scores[indices[t * 3 + 2]];
+        if (triangle_scores[t] > triangle_scores[best_triangle]) {
+            best_triangle = t;
+        }
+    }
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> new_cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    new_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    size_t next_unemitted = 0;
+
+    for (size_t emitted_count = 0; emitted_count < triangle_count; emitted_count++) {
+        if (best_triangle == SIZE_MAX) {
+            // Nothing in the cache has triangles left, restart from the first
+            // triangle not emitted yet, which keeps the pass linear.
+            while (emitted[next_unemitted]) {
+                next_unemitted++;
+            }
+            best_triangle = next_unemitted;
+        }
+
+        const uint32_t* triangle = &indices[best_triangle * 3];
+        emitted[best_triangle] = true;
+
+        new_cache.clear();
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = triangle[k];
+            output.push_back(v);
+            new_cache.push_back(v);
+
+            uint32_t* begin = &adjacency[adjacency_offsets[v]];
+            uint32_t* end = begin + valence[v];
+            for (uint32_t* it = begin; it != end; it++) {
+                if (*it == best_triangle) {
+                    *it = *(end - 1);
+                    *(end - 1) = best_triangle;
+                    break;
+                }
+            }
+            valence[v]--;
+        }
+
+        for (uint32_t v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                new_cache.push_back(v);
+            }
+        }
+
+        for (size_t i = 0; i < new_cache.size(); i++) {
+            uint32_t v = new_cache[i];
+            cache_positions[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+            vertex_scores[v] = score_vertex(v);
+        }
+
+        best_triangle = SIZE_MAX;
+        float best_score = -1.0f;
+        for (uint32_t v : new_cache) {
+            const uint32_t* begin = &adjacency[adjacency_offsets[v]];
+            for (const uint32_t* it = begin; it != begin + valence[v]; it++) {
+                const uint32_t* other = &indices[*it * 3];
+                float score = vertex_scores[other[0]] + vertex_scores[other[1]] + vertex_scores[other[2]];
+                triangle_scores[*it] = score;
+                if (score > best_score) {
+                    best_score = score;
+                    best_triangle = *it;
+                }
+            }
+        }
+
+        if (new_cache.size() > FORSYTH_CACHE_SIZE) {
+            new_cache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(new_cache);
+    }
+
+    indices.swap(output);
+}
+
+void mesh_optimize_vertex_cache(Mesh& mesh) {
+    optimize_vertex_cache(mesh.indices, mesh.positions.size());
+}
+
+void mesh_optimize_vertex_fetch(Mesh& mesh) {
+    std::vector<uint32_t> remap(mesh.positions.size(), UINT32_MAX);
+    uint32_t next = 0;
+
+    for (uint32_t& index : mesh.indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+
+    std::vector<glm::vec3> positions(next);
+    std::vector<glm::vec2> uvs(next);
+    std::vector<glm::vec3> normals(next);
+    for (size_t v = 0; v < remap.size(); v++) {
+        if (remap[v] != UINT32_MAX) {
+            positions[remap[v]] = mesh.positions[v];
+            uvs[remap[v]] = mesh.uvs[v];
+            normals[remap[v]] = mesh.normals[v];
+        }
+    }
+
+    mesh.positions.swap(positions);
+    mesh.uvs.swap(uvs);
+    mesh.normals.swap(normals);
+}
+
+void mesh_optimize(Mesh& mesh, VertexCacheStats* before, VertexCacheStats* after) {
+    // Measure without the degenerate triangles so that both ratios are per
+    // drawn triangle.
+    mesh_remove_degenerate_triangles(mesh);
+
+    if (before) {
+        *before = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.positions.size());
+    }
+
+    mesh_optimize_vertex_cache(mesh);
+    mesh_optimize_vertex_fetch(mesh);
+
+    if (after) {
+        *after = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.positions.size());
+    }
+}
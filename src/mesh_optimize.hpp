@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mesh.hpp"
+
+struct VertexCacheStats {
+    // Average cache miss ratio : vertex shader invocations per triangle.
+    float acmr;
+    // Average transform to vertex ratio : invocations per unique vertex, 1 at best.
+    float atvr;
+};
+
+// Simulates a FIFO post-transform cache of the given size.
+VertexCacheStats analyze_vertex_cache(const uint32_t* indices,
+                                      size_t index_count,
+                                      size_t vertex_count,
+                                      uint32_t cache_size = 32);
+
+// Drops triangles that repeat a vertex index, since they cannot rasterize.
+void mesh_remove_degenerate_triangles(Mesh& mesh);
+
+// Reorders triangles for post-transform cache hits, following Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation".
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count);
+void mesh_optimize_vertex_cache(Mesh& mesh);
+
+// Renumbers vertices in the order the index buffer first uses them, so that
+// vertex fetches walk memory forwards. Unused vertices are dropped.
+void mesh_optimize_vertex_fetch(Mesh& mesh);
+
+// All of the above, in order. Returns the cache stats before and after.
+void mesh_optimize(Mesh& mesh, VertexCacheStats* before = nullptr, VertexCacheStats* after = nullptr);
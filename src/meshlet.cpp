@@ -0,0 +1,148 @@
+#include "meshlet.hpp"
+
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static void compute_meshlet_bounds(const Mesh& mesh, const MeshletData& data, Meshlet& meshlet) {
+    const uint32_t* vertices = &data.vertices[meshlet.vertex_offset];
+    const uint8_t* triangles = &data.triangles[meshlet.triangle_offset];
+
+    glm::vec3 min = mesh.positions[vertices[0]];
+    glm::vec3 max = min;
+    for (uint32_t i = 1; i < meshlet.vertex_count; i++) {
+        min = glm::min(min, mesh.positions[vertices[i]]);
+        max = glm::max(max, mesh.positions[vertices[i]]);
+    }
+
+    meshlet.center = (min + max) * .5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertex_count; i++) {
+        meshlet.radius = std::max(meshlet.radius, glm::length(mesh.positions[vertices[i]] - meshlet.center));
+    }
+
+    glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+    glm::vec3 corners[MESHLET_MAX_TRIANGLES];
+    uint32_t normal_count = 0;
+    glm::vec3 normal_sum(0.0f);
+
+    for (uint32_t t = 0; t < meshlet.triangle_count; t++) {
+        glm::vec3 p0 = mesh.positions[vertices[triangles[t * 3]]];
+        glm::vec3 p1 = mesh.positions[vertices[triangles[t * 3 + 1]]];
+        glm::vec3 p2 = mesh.positions[vertices[triangles[t * 3 + 2]]];
+
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(n);
+        if (area == 0.0f) {
+            continue;
+        }
+
+        normals[normal_count] = n / area;
+        corners[normal_count] = p0;
+        normal_sum += normals[normal_count];
+        normal_count++;
+    }
+
+    meshlet.cone_apex = meshlet.center;
+    meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.cone_cutoff = 1.0f;
+
+    float sum_length = glm::length(normal_sum);
+    if (normal_count == 0 || sum_length == 0.0f) {
+        return;
+    }
+
+    glm::vec3 axis = normal_sum / sum_length;
+    float min_cos = 1.0f;
+    for (uint32_t i = 0; i < normal_count; i++) {
+        min_cos = std::min(min_cos, glm::dot(axis, normals[i]));
+    }
+
+    // Cones wider than a hemisphere (or close to it) never cull anything.
+    if (min_cos <= 0.1f) {
+        return;
+    }
+
+    // Move the apex back along the axis until it is behind every triangle
+    // plane, so that the test holds for eyes close to the meshlet.
+    float max_t = 0.0f;
+    for (uint32_t i = 0; i < normal_count; i++) {
+        float distance = glm::dot(meshlet.center - corners[i], normals[i]);
+        max_t = std::max(max_t, distance / glm::dot(axis, normals[i]));
+    }
+
+    meshlet.cone_apex = meshlet.center - axis * max_t;
+    meshlet.cone_axis = axis;
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_cos * min_cos);
+}
+
+MeshletData build_meshlets(const Mesh& mesh) {
+    MeshletData data;
+
+    size_t triangle_count = mesh.indices.size() / 3;
+    data.meshlets.reserve(triangle_count / MESHLET_MAX_TRIANGLES + 1);
+    data.vertices.reserve(mesh.indices.size() / 2);
+    data.triangles.reserve(mesh.indices.size() + data.meshlets.capacity() * 4);
+
+    // Local index of each mesh vertex in the current meshlet, valid while
+    // owner matches the meshlet being built.
+    std::vector<uint8_t> local_index(mesh.positions.size());
+    std::vector<uint32_t> owner(mesh.positions.size(), UINT32_MAX);
+
+    Meshlet current{};
+
+    auto finish = [&]() {
+        if (current.triangle_count == 0) {
+            return;
+        }
+        compute_meshlet_bounds(mesh, data, current);
+        data.meshlets.push_back(current);
+
+        while (data.triangles.size() % 4) {
+            data.triangles.push_back(0);
+        }
+
+        current = Meshlet{};
+        current.vertex_offset = data.vertices.size();
+        current.triangle_offset = data.triangles.size();
+    };
+
+    for (size_t t = 0; t < triangle_count; t++) {
+        const uint32_t* triangle = &mesh.indices[t * 3];
+        uint32_t meshlet_id = data.meshlets.size();
+
+        uint32_t new_vertices = 0;
+        for (int k = 0; k < 3; k++) {
+            new_vertices += owner[triangle[k]] != meshlet_id
+                && (k < 1 || triangle[k] != triangle[0])
+                && (k < 2 || triangle[k] != triangle[1]);
+        }
+
+        if (current.vertex_count + new_vertices > MESHLET_MAX_VERTICES
+            || current.triangle_count + 1 > MESHLET_MAX_TRIANGLES) {
+            finish();
+            meshlet_id = data.meshlets.size();
+        }
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = triangle[k];
+            if (owner[v] != meshlet_id) {
+                owner[v] = meshlet_id;
+                local_index[v] = current.vertex_count++;
+                data.vertices.push_back(v);
+            }
+            data.triangles.push_back(local_index[v]);
+        }
+        current.triangle_count++;
+    }
+
+    finish();
+
+    return data;
+}
+
+bool meshlet_is_backfacing(const Meshlet& meshlet, const glm::vec3& eye) {
+    return meshlet.cone_cutoff < 1.0f
+        && glm::dot(glm::normalize(meshlet.cone_apex - eye), meshlet.cone_axis) >= meshlet.cone_cutoff;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct Mesh;
+
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Laid out for std430 storage buffers.
+struct Meshlet {
+    // Bounding sphere
+    glm::vec3 center;
+    float radius;
+
+    // The meshlet faces away from an eye at p when
+    // dot(normalize(cone_apex - p), cone_axis) >= cone_cutoff.
+    // A cutoff of 1 means the cone is too wide to ever cull.
+    glm::vec3 cone_apex;
+    float cone_cutoff;
+    glm::vec3 cone_axis;
+
+    // First entry in MeshletData::vertices
+    uint32_t vertex_offset;
+    // First byte in MeshletData::triangles, always a multiple of 4
+    uint32_t triangle_offset;
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    uint32_t padding;
+};
+static_assert(sizeof(Meshlet) == 64, "Wrong size for Meshlet");
+
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    // Mesh vertex index of each meshlet-local vertex
+    std::vector<uint32_t> vertices;
+    // Three local vertex indices per triangle, each meshlet padded to 4 bytes
+    std::vector<uint8_t> triangles;
+};
+
+// Splits the mesh into meshlets, following the index order. Running
+// mesh_optimize_vertex_cache first gives much tighter meshlets.
+MeshletData build_meshlets(const Mesh& mesh);
+
+bool meshlet_is_backfacing(const Meshlet& meshlet, const glm::vec3& eye);
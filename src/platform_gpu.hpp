@@ -1,10 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <cstring>
 
 #if 1
 
 #include "vulkan/gpu.hpp"
+#include "vulkan/staging.hpp"
 #include "vulkan/graphics.hpp"
 #include "vulkan/compute.hpp"
 
@@ -14,21 +16,76 @@ using GraphicsFrame = VulkanFrame;
 
 template<typename T>
 using GPUBuffer = VulkanBuffer<T>;
+template<typename T>
+using GPUBufferSlice = VulkanBufferSlice<T>;
+using GPUUploadTicket = StagingTicket;
 
 #endif
 
-void gpu_init(GPUContext& ctx);
+void gpu_init(GPUContext& ctx, uint32_t flags = 0);
 void gpu_finalize(GPUContext& ctx);
 
 void graphics_init(const GPUContext* ctx, const WMContext* wm, GraphicsContext& graphics);
+// Renders to offscreen images instead of a window, on a context from
+// gpu_init with GPU_INIT_HEADLESS. With readback, every frame is also copied
+// to host memory for graphics_read_frame.
+void graphics_init_headless(const GPUContext* ctx,
+                            uint32_t width,
+                            uint32_t height,
+                            bool readback,
+                            GraphicsContext& graphics);
 void graphics_finalize(GraphicsContext& graphics);
 void graphics_wait_idle(const GraphicsContext& graphics);
 
+// Waits for a frame of a headless context with readback, and copies its
+// width * height RGBA8 pixels, top row first. Valid until MAX_FRAMES_IN_FLIGHT
+// more frames have begun.
+void graphics_read_frame(const GraphicsContext& graphics, const GraphicsFrame& frame, uint32_t* pixels);
+
+// Host access buffers are written in place. The others get a staging copy,
+// submitted with the next frame or compute dispatch.
+//
+// With ticket, the copy is asynchronous, on the transfer queue when there is
+// one, and frames go on without waiting for it. The buffer must not be in
+// use on the device, and may only be used once gpu_upload_done returns true
+// for *ticket, which is raised to cover the copy.
+template<typename T>
+void gpu_buffer_upload(const GPUContext& ctx,
+                       GPUBuffer<T>& buffer,
+                       const T* data,
+                       size_t offset,
+                       size_t count,
+                       GPUUploadTicket* ticket = nullptr) {
+    if (!gpu_buffer_host_visible(buffer)) {
+        if (ticket) {
+            GPUUploadTicket copy = staging_upload(ctx, *ctx.transfer, buffer.handle, offset * sizeof(T), data, count * sizeof(T));
+            *ticket = std::max(*ticket, copy);
+        } else {
+            staging_upload(ctx, *ctx.staging, buffer.handle, offset * sizeof(T), data, count * sizeof(T));
+        }
+        return;
+    }
+
+    memcpy(buffer.mapped + offset, data, sizeof(T) * count);
+    gpu_buffer_flush(ctx, buffer, offset, count);
+}
+
+// Copies count elements to the ring slice of the frame begun last, valid
+// until that frame slot is reused, see frame_ring.hpp. Call it between
+// begin_frame and end_frame : before begin_frame the slice is the previous
+// frame's, which begin_frame may hand out again while the data is in use.
 template<typename T>
-void gpu_buffer_upload(const GPUContext& ctx, GPUBuffer<T>& buffer, const T* data, size_t offset, size_t count) {
-    T* device_ptr = gpu_buffer_map(ctx, buffer, offset, count);
+GPUBufferSlice<T> graphics_frame_upload(GraphicsContext& graphics, const T* data, size_t count) {
+    return frame_ring_upload(*graphics.vk, graphics.frame_ring, data, count);
+}
 
-    memcpy(device_ptr, data, sizeof(T) * count);
+// Whether asynchronous uploads of up to size bytes in total can be recorded
+// without waiting on earlier ones.
+inline bool gpu_upload_has_room(const GPUContext& ctx, size_t size) {
+    return staging_has_room(ctx, *ctx.transfer, size);
+}
 
-    gpu_buffer_unmap(ctx, buffer);
+// Whether the asynchronous uploads of ticket are done, without blocking.
+inline bool gpu_upload_done(const GPUContext& ctx, GPUUploadTicket ticket) {
+    return staging_ticket_done(ctx, *ctx.transfer, ticket);
 }
@@ -0,0 +1,89 @@
+#include "quantize.hpp"
+
+#include <glm/packing.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+VertexQuantization vertex_quantization(const glm::vec3* positions, size_t count) {
+    VertexQuantization quantization;
+    quantization.offset = glm::vec3(0.0f);
+    quantization.scale = glm::vec3(1.0f);
+    if (count == 0) {
+        return quantization;
+    }
+
+    glm::vec3 min = positions[0];
+    glm::vec3 max = min;
+    for (size_t i = 1; i < count; i++) {
+        min = glm::min(min, positions[i]);
+        max = glm::max(max, positions[i]);
+    }
+
+    quantization.offset = min;
+    quantization.scale = max - min;
+
+    // Flat axes quantize to 0 whatever the scale.
+    for (int k = 0; k < 3; k++) {
+        if (quantization.scale[k] == 0.0f) {
+            quantization.scale[k] = 1.0f;
+        }
+    }
+
+    return quantization;
+}
+
+glm::mat4 vertex_dequantize_matrix(const VertexQuantization& quantization) {
+    return glm::translate(quantization.offset) * glm::scale(quantization.scale);
+}
+
+static float sign_not_zero(float x) {
+    return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+glm::vec2 octahedral_encode(const glm::vec3& normal) {
+    float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (l1 == 0.0f) {
+        return glm::vec2(0.0f);
+    }
+
+    glm::vec3 n = normal / l1;
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals.
+        encoded = glm::vec2((1.0f - std::fabs(n.y)) * sign_not_zero(n.x),
+                            (1.0f - std::fabs(n.x)) * sign_not_zero(n.y));
+    }
+    return encoded;
+}
+
+glm::vec3 octahedral_decode(const glm::vec2& encoded) {
+    glm::vec3 n(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+CompactVertex compact_vertex(const glm::vec3& position,
+                             const glm::vec2& uv,
+                             const glm::vec3& normal,
+                             const VertexQuantization& quantization) {
+    CompactVertex vertex;
+
+    glm::vec3 unorm = glm::clamp((position - quantization.offset) / quantization.scale, 0.0f, 1.0f);
+    for (int k = 0; k < 3; k++) {
+        vertex.position[k] = static_cast<uint16_t>(std::lround(unorm[k] * 65535.0f));
+    }
+    vertex.position[3] = 0;
+
+    vertex.normal = glm::packSnorm2x16(octahedral_encode(normal));
+    vertex.uv = glm::packHalf2x16(uv);
+
+    return vertex;
+}
+
+uint32_t compact_color(const glm::vec4& color) {
+    return glm::packUnorm4x8(color);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "mesh.hpp"
+
+// Maps unorm16 positions back into the mesh bounds :
+// position = offset + scale * unorm.
+struct VertexQuantization {
+    glm::vec3 offset;
+    glm::vec3 scale;
+};
+
+VertexQuantization vertex_quantization(const glm::vec3* positions, size_t count);
+
+// Folds the dequantization into a matrix, to multiply model matrices with.
+glm::mat4 vertex_dequantize_matrix(const VertexQuantization& quantization);
+
+glm::vec2 octahedral_encode(const glm::vec3& normal);
+glm::vec3 octahedral_decode(const glm::vec2& encoded);
+
+CompactVertex compact_vertex(const glm::vec3& position,
+                             const glm::vec2& uv,
+                             const glm::vec3& normal,
+                             const VertexQuantization& quantization);
+
+uint32_t compact_color(const glm::vec4& color);
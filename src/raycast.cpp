@@ -0,0 +1,889 @@
+#include "raycast.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAYCAST_X86 1
+#include <immintrin.h>
+#endif
+
+bool intersect(const Mesh& mesh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out) {
+    bool rval = false;
+    float tmax;
+
+    for (size_t i = 0; i < mesh.indices.size() / 3; i++) {
+        glm::vec3 edge1 = mesh.positions[mesh.indices[i * 3 + 1]] - mesh.positions[mesh.indices[i * 3]];
+        glm::vec3 edge2 = mesh.positions[mesh.indices[i * 3 + 2]] - mesh.positions[mesh.indices[i * 3]];
+        glm::vec3 h = glm::cross(ray_d, edge2);
+        float a = glm::dot(edge1, h);
+        if (a == 0.0f)
+            continue;    // ray parallel to the triangle
+
+        float f = 1.0f / a;
+        glm::vec3 s = ray_o - mesh.positions[mesh.indices[i * 3]];
+        float u = f * glm::dot(s, h);
+        if (u < 0.0f || u > 1.0f)
+            continue;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = f * glm::dot(ray_d, q);
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+
+        // On calcule t pour savoir ou le point d'intersection se situe sur la ligne.
+        float t = f * glm::dot(edge2, q);
+        if (t > 0.0f && (!rval || t < tmax)) {
+            if (t_out) {
+                *t_out = t;
+            }
+            tmax = t;
+            rval = true;
+        } 
+    }
+
+    return rval;
+}
+
+bool occluded(const Mesh& mesh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax) {
+    for (size_t i = 0; i < mesh.indices.size() / 3; i++) {
+        const glm::vec3& v0 = mesh.positions[mesh.indices[i * 3]];
+        glm::vec3 edge1 = mesh.positions[mesh.indices[i * 3 + 1]] - v0;
+        glm::vec3 edge2 = mesh.positions[mesh.indices[i * 3 + 2]] - v0;
+        glm::vec3 h = glm::cross(ray_d, edge2);
+        float a = glm::dot(edge1, h);
+        if (a == 0.0f) {
+            continue;
+        }
+
+        float f = 1.0f / a;
+        glm::vec3 s = ray_o - v0;
+        float u = f * glm::dot(s, h);
+        if (u < 0.0f || u > 1.0f) {
+            continue;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = f * glm::dot(ray_d, q);
+        if (v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+
+        float t = f * glm::dot(edge2, q);
+        if (t > tmin && t < tmax) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TriangleSoA build_triangle_soa(const glm::vec3* positions,
+                               size_t position_stride,
+                               const uint32_t* indices,
+                               size_t index_count) {
+    auto position = [&](uint32_t index) -> const glm::vec3& {
+        return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const char*>(positions) + index * position_stride);
+    };
+
+    TriangleSoA soa;
+    soa.triangle_count = index_count / 3;
+    soa.blocks.resize((soa.triangle_count + TRIANGLE_BLOCK_SIZE - 1) / TRIANGLE_BLOCK_SIZE, TriangleBlock{});
+
+    for (size_t t = 0; t < soa.triangle_count; t++) {
+        TriangleBlock& block = soa.blocks[t / TRIANGLE_BLOCK_SIZE];
+        size_t lane = t % TRIANGLE_BLOCK_SIZE;
+
+        glm::vec3 v0 = position(indices[t * 3]);
+        glm::vec3 edge1 = position(indices[t * 3 + 1]) - v0;
+        glm::vec3 edge2 = position(indices[t * 3 + 2]) - v0;
+        for (int k = 0; k < 3; k++) {
+            block.v0[k][lane] = v0[k];
+            block.edge1[k][lane] = edge1[k];
+            block.edge2[k][lane] = edge2[k];
+        }
+    }
+
+    return soa;
+}
+
+TriangleSoA build_triangle_soa(const Mesh& mesh) {
+    return build_triangle_soa(mesh.positions.data(), sizeof(glm::vec3), mesh.indices.data(), mesh.indices.size());
+}
+
+TriangleSoA build_triangle_soa(const CachedMesh& mesh) {
+    return build_triangle_soa(&mesh.vertices[0].position, sizeof(Vertex), mesh.indices, mesh.index_count);
+}
+
+// Each kernel returns the nearest hit distance in (tmin, tmax) and sets its
+// triangle, leaving *triangle_out untouched on a miss. With any_hit, it stops
+// at the first block with a hit.
+using IntersectSoAKernel = float (*)(const TriangleSoA&, const glm::vec3&, const glm::vec3&,
+                                     float, float, bool, uint32_t*);
+
+static float intersect_soa_scalar(const TriangleSoA& soa,
+                                  const glm::vec3& ray_o,
+                                  const glm::vec3& ray_d,
+                                  float tmin,
+                                  float tmax,
+                                  bool any_hit,
+                                  uint32_t* triangle_out) {
+    for (size_t t = 0; t < soa.triangle_count; t++) {
+        const TriangleBlock& block = soa.blocks[t / TRIANGLE_BLOCK_SIZE];
+        size_t lane = t % TRIANGLE_BLOCK_SIZE;
+
+        glm::vec3 v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+        glm::vec3 edge1(block.edge1[0][lane], block.edge1[1][lane], block.edge1[2][lane]);
+        glm::vec3 edge2(block.edge2[0][lane], block.edge2[1][lane], block.edge2[2][lane]);
+
+        glm::vec3 h = glm::cross(ray_d, edge2);
+        float a = glm::dot(edge1, h);
+        if (a == 0.0f) {
+            continue;
+        }
+
+        float f = 1.0f / a;
+        glm::vec3 s = ray_o - v0;
+        float u = f * glm::dot(s, h);
+        if (u < 0.0f || u > 1.0f) {
+            continue;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = f * glm::dot(ray_d, q);
+        if (v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+
+        float hit = f * glm::dot(edge2, q);
+        if (hit > tmin && hit < tmax) {
+            tmax = hit;
+            *triangle_out = t;
+            if (any_hit) {
+                break;
+            }
+        }
+    }
+
+    return tmax;
+}
+
+#ifdef RAYCAST_X86
+
+// The SSE and AVX kernels are the same code on different vector widths.
+// Every lane keeps its own nearest hit and the block it came from, lanes are
+// only reduced at the end. Lanes that never hit keep tmax.
+#define RAYCAST_SIMD_KERNEL(name, isa, W, vec, set1, seti, load, add, sub, mul, div,                \
+                            and_, cmplt, cmple, cmpneq, blend, movemask, store, storei)             \
+    __attribute__((target(isa)))                                                                    \
+    static float name(const TriangleSoA& soa,                                                       \
+                      const glm::vec3& ray_o,                                                       \
+                      const glm::vec3& ray_d,                                                       \
+                      float tmin,                                                                   \
+                      float tmax,                                                                   \
+                      bool any_hit,                                                                 \
+                      uint32_t* triangle_out) {                                                     \
+        const vec ox = set1(ray_o.x), oy = set1(ray_o.y), oz = set1(ray_o.z);                       \
+        const vec dx = set1(ray_d.x), dy = set1(ray_d.y), dz = set1(ray_d.z);                       \
+        const vec zero = set1(0.0f), one = set1(1.0f), lower = set1(tmin);                          \
+                                                                                                    \
+        vec best_t = set1(tmax);                                                                    \
+        vec best_group = set1(0.0f);                                                                \
+                                                                                                    \
+        size_t group_count = soa.blocks.size() * (TRIANGLE_BLOCK_SIZE / W);                         \
+        for (size_t g = 0; g < group_count; g++) {                                                  \
+            const TriangleBlock& block = soa.blocks[g / (TRIANGLE_BLOCK_SIZE / W)];                 \
+            size_t lane = (g % (TRIANGLE_BLOCK_SIZE / W)) * W;                                      \
+                                                                                                    \
+            vec e1x = load(&block.edge1[0][lane]);                                                  \
+            vec e1y = load(&block.edge1[1][lane]);                                                  \
+            vec e1z = load(&block.edge1[2][lane]);                                                  \
+            vec e2x = load(&block.edge2[0][lane]);                                                  \
+            vec e2y = load(&block.edge2[1][lane]);                                                  \
+            vec e2z = load(&block.edge2[2][lane]);                                                  \
+                                                                                                    \
+            /* h = cross(d, edge2) */                                                               \
+            vec hx = sub(mul(dy, e2z), mul(dz, e2y));                                               \
+            vec hy = sub(mul(dz, e2x), mul(dx, e2z));                                               \
+            vec hz = sub(mul(dx, e2y), mul(dy, e2x));                                               \
+            vec a = add(add(mul(e1x, hx), mul(e1y, hy)), mul(e1z, hz));                             \
+            vec f = div(one, a);                                                                    \
+                                                                                                    \
+            vec sx = sub(ox, load(&block.v0[0][lane]));                                             \
+            vec sy = sub(oy, load(&block.v0[1][lane]));                                             \
+            vec sz = sub(oz, load(&block.v0[2][lane]));                                             \
+            vec u = mul(f, add(add(mul(sx, hx), mul(sy, hy)), mul(sz, hz)));                        \
+                                                                                                    \
+            /* q = cross(s, edge1) */                                                               \
+            vec qx = sub(mul(sy, e1z), mul(sz, e1y));                                               \
+            vec qy = sub(mul(sz, e1x), mul(sx, e1z));                                               \
+            vec qz = sub(mul(sx, e1y), mul(sy, e1x));                                               \
+            vec v = mul(f, add(add(mul(dx, qx), mul(dy, qy)), mul(dz, qz)));                        \
+            vec t = mul(f, add(add(mul(e2x, qx), mul(e2y, qy)), mul(e2z, qz)));                     \
+                                                                                                    \
+            vec hit = and_(cmpneq(a, zero), cmple(zero, u));                                        \
+            hit = and_(hit, cmple(u, one));                                                         \
+            hit = and_(hit, cmple(zero, v));                                                        \
+            hit = and_(hit, cmple(add(u, v), one));                                                 \
+            hit = and_(hit, cmplt(lower, t));                                                       \
+            hit = and_(hit, cmplt(t, best_t));                                                      \
+                                                                                                    \
+            best_t = blend(best_t, t, hit);                                                         \
+            best_group = blend(best_group, seti(g), hit);                                           \
+            if (any_hit && movemask(hit)) {                                                         \
+                break;                                                                              \
+            }                                                                                       \
+        }                                                                                           \
+                                                                                                    \
+        alignas(32) float lane_t[W];                                                                \
+        alignas(32) uint32_t lane_group[W];                                                         \
+        store(lane_t, best_t);                                                                      \
+        storei(lane_group, best_group);                                                             \
+                                                                                                    \
+        bool found = false;                                                                         \
+        for (uint32_t i = 0; i < W; i++) {                                                          \
+            uint32_t triangle = lane_group[i] * W + i;                                              \
+            if (lane_t[i] < tmax || (found && lane_t[i] == tmax && triangle < *triangle_out)) {     \
+                found = true;                                                                       \
+                tmax = lane_t[i];                                                                   \
+                *triangle_out = triangle;                                                           \
+            }                                                                                       \
+        }                                                                                           \
+        return tmax;                                                                                \
+    }
+
+#define SSE_SETI(i) _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(i)))
+#define SSE_BLEND(a, b, mask) _mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b))
+#define SSE_STOREI(p, x) _mm_store_si128(reinterpret_cast<__m128i*>(p), _mm_castps_si128(x))
+
+RAYCAST_SIMD_KERNEL(intersect_soa_sse, "sse2", 4, __m128,
+                    _mm_set1_ps, SSE_SETI, _mm_load_ps,
+                    _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, _mm_and_ps,
+                    _mm_cmplt_ps, _mm_cmple_ps, _mm_cmpneq_ps,
+                    SSE_BLEND, _mm_movemask_ps, _mm_store_ps, SSE_STOREI)
+
+#define AVX_SETI(i) _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(i)))
+#define AVX_CMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define AVX_CMPLE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define AVX_CMPNEQ(a, b) _mm256_cmp_ps(a, b, _CMP_NEQ_OQ)
+#define AVX_STOREI(p, x) _mm256_store_si256(reinterpret_cast<__m256i*>(p), _mm256_castps_si256(x))
+
+RAYCAST_SIMD_KERNEL(intersect_soa_avx, "avx", 8, __m256,
+                    _mm256_set1_ps, AVX_SETI, _mm256_load_ps,
+                    _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps, _mm256_and_ps,
+                    AVX_CMPLT, AVX_CMPLE, AVX_CMPNEQ,
+                    _mm256_blendv_ps, _mm256_movemask_ps, _mm256_store_ps, AVX_STOREI)
+
+#endif
+
+static IntersectSoAKernel select_intersect_soa_kernel() {
+#ifdef RAYCAST_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        return intersect_soa_avx;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return intersect_soa_sse;
+    }
+#endif
+    return intersect_soa_scalar;
+}
+
+static const IntersectSoAKernel intersect_soa_kernel = select_intersect_soa_kernel();
+
+bool intersect(const TriangleSoA& triangles,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out) {
+    uint32_t triangle = UINT32_MAX;
+    float t = intersect_soa_kernel(triangles, ray_o, ray_d, 0.0f, INFINITY, false, &triangle);
+    if (triangle == UINT32_MAX) {
+        return false;
+    }
+
+    if (t_out) {
+        *t_out = t;
+    }
+    if (triangle_out) {
+        *triangle_out = triangle;
+    }
+    return true;
+}
+
+bool occluded(const TriangleSoA& triangles,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax) {
+    uint32_t triangle = UINT32_MAX;
+    intersect_soa_kernel(triangles, ray_o, ray_d, tmin, tmax, true, &triangle);
+    return triangle != UINT32_MAX;
+}
+
+// Möller-Trumbore, returns the hit distance or INFINITY.
+static inline float intersect_triangle(const BvhTriangle& triangle,
+                                       const glm::vec3& ray_o,
+                                       const glm::vec3& ray_d,
+                                       float* u_out,
+                                       float* v_out) {
+    glm::vec3 h = glm::cross(ray_d, triangle.edge2);
+    float a = glm::dot(triangle.edge1, h);
+    if (a == 0.0f) {
+        return INFINITY;
+    }
+
+    float f = 1.0f / a;
+    glm::vec3 s = ray_o - triangle.v0;
+    float u = f * glm::dot(s, h);
+    if (u < 0.0f || u > 1.0f) {
+        return INFINITY;
+    }
+    glm::vec3 q = glm::cross(s, triangle.edge1);
+    float v = f * glm::dot(ray_d, q);
+    if (v < 0.0f || u + v > 1.0f) {
+        return INFINITY;
+    }
+
+    float t = f * glm::dot(triangle.edge2, q);
+    if (t <= 0.0f) {
+        return INFINITY;
+    }
+
+    *u_out = u;
+    *v_out = v;
+    return t;
+}
+
+// Slab test, returns the entry distance or INFINITY if the box is missed or
+// further than tmax.
+static inline float intersect_node(const BvhNode& node,
+                                   const glm::vec3& ray_o,
+                                   const glm::vec3& inv_d,
+                                   float tmax) {
+    glm::vec3 t0 = (node.min - ray_o) * inv_d;
+    glm::vec3 t1 = (node.max - ray_o) * inv_d;
+    glm::vec3 near = glm::min(t0, t1);
+    glm::vec3 far = glm::max(t0, t1);
+
+    float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    float exit = std::min(std::min(far.x, far.y), std::min(far.z, tmax));
+    return enter <= exit ? enter : INFINITY;
+}
+
+// Nearest hit closer than tmax, with hit.triangle indexing bvh.triangles.
+static RayHit intersect_bvh(const Bvh& bvh,
+                            const glm::vec3& ray_o,
+                            const glm::vec3& ray_d,
+                            float tmax = INFINITY) {
+    glm::vec3 inv_d = 1.0f / ray_d;
+
+    RayHit hit = {tmax, UINT32_MAX, 0.0f, 0.0f};
+
+    if (bvh.triangles.empty() || intersect_node(bvh.nodes[0], ray_o, inv_d, hit.t) == INFINITY) {
+        return hit;
+    }
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    uint32_t node_index = 0;
+
+    while (true) {
+        const BvhNode& node = bvh.nodes[node_index];
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                float u, v;
+                float t = intersect_triangle(bvh.triangles[i], ray_o, ray_d, &u, &v);
+                if (t < hit.t) {
+                    hit = {t, i, u, v};
+                }
+            }
+        } else {
+            // Visit the nearest child first, the other one may then be culled by tmax.
+            uint32_t left = node.first;
+            uint32_t right = node.first + 1;
+            float t_left = intersect_node(bvh.nodes[left], ray_o, inv_d, hit.t);
+            float t_right = intersect_node(bvh.nodes[right], ray_o, inv_d, hit.t);
+
+            if (t_left > t_right) {
+                std::swap(t_left, t_right);
+                std::swap(left, right);
+            }
+
+            if (t_left != INFINITY) {
+                if (t_right != INFINITY) {
+                    stack[stack_size++] = right;
+                }
+                node_index = left;
+                continue;
+            }
+        }
+
+        // Pop until a node is still closer than the current hit.
+        bool found = false;
+        while (stack_size > 0) {
+            node_index = stack[--stack_size];
+            if (intersect_node(bvh.nodes[node_index], ray_o, inv_d, hit.t) != INFINITY) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+
+    return hit;
+}
+
+bool intersect(const Bvh& bvh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out) {
+    RayHit hit = intersect_bvh(bvh, ray_o, ray_d);
+    if (hit.triangle == UINT32_MAX) {
+        return false;
+    }
+
+    if (t_out) {
+        *t_out = hit.t;
+    }
+    if (triangle_out) {
+        *triangle_out = bvh.triangles[hit.triangle].index;
+    }
+    return true;
+}
+
+bool occluded(const Bvh& bvh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax) {
+    if (bvh.triangles.empty()) {
+        return false;
+    }
+
+    glm::vec3 inv_d = 1.0f / ray_d;
+
+    // Any hit will do, so children are pushed without sorting them by distance.
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const BvhNode& node = bvh.nodes[stack[--stack_size]];
+        if (intersect_node(node, ray_o, inv_d, tmax) == INFINITY) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                float u, v;
+                float t = intersect_triangle(bvh.triangles[i], ray_o, ray_d, &u, &v);
+                if (t > tmin && t < tmax) {
+                    return true;
+                }
+            }
+        } else {
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first;
+        }
+    }
+
+    return false;
+}
+
+// Entry distances of the children of a wide node, INFINITY for children that
+// are missed, further than tmax, or past child_count.
+#ifdef RAYCAST_X86
+
+static inline __m128 bvh4_dequantize(const uint8_t* q, float origin, float scale) {
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(scale)));
+}
+
+static inline void intersect_children(const Bvh4Node& node,
+                                      const glm::vec3& ray_o,
+                                      const glm::vec3& inv_d,
+                                      float tmax,
+                                      float* t_out) {
+    __m128 enter = _mm_setzero_ps();
+    __m128 exit = _mm_set1_ps(tmax);
+    for (int axis = 0; axis < 3; axis++) {
+        float scale = bvh4_scale(node.exponent[axis]);
+        __m128 o = _mm_set1_ps(ray_o[axis]);
+        __m128 inv = _mm_set1_ps(inv_d[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(bvh4_dequantize(node.min[axis], node.origin[axis], scale), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(bvh4_dequantize(node.max[axis], node.origin[axis], scale), o), inv);
+        enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+        exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+    }
+
+    __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+    __m128 valid = _mm_castsi128_ps(_mm_cmplt_epi32(lanes, _mm_set1_epi32(node.child_count)));
+    __m128 hit = _mm_and_ps(_mm_cmple_ps(enter, exit), valid);
+    _mm_storeu_ps(t_out, _mm_or_ps(_mm_and_ps(hit, enter), _mm_andnot_ps(hit, _mm_set1_ps(INFINITY))));
+}
+
+#else
+
+static inline void intersect_children(const Bvh4Node& node,
+                                      const glm::vec3& ray_o,
+                                      const glm::vec3& inv_d,
+                                      float tmax,
+                                      float* t_out) {
+    glm::vec3 scale(bvh4_scale(node.exponent[0]), bvh4_scale(node.exponent[1]), bvh4_scale(node.exponent[2]));
+    for (uint32_t i = 0; i < BVH4_WIDTH; i++) {
+        t_out[i] = INFINITY;
+        if (i >= node.child_count) {
+            continue;
+        }
+
+        float enter = 0.0f;
+        float exit = tmax;
+        for (int axis = 0; axis < 3; axis++) {
+            float min = node.origin[axis] + static_cast<float>(node.min[axis][i]) * scale[axis];
+            float max = node.origin[axis] + static_cast<float>(node.max[axis][i]) * scale[axis];
+            float t0 = (min - ray_o[axis]) * inv_d[axis];
+            float t1 = (max - ray_o[axis]) * inv_d[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        if (enter <= exit) {
+            t_out[i] = enter;
+        }
+    }
+}
+
+#endif
+
+// Nearest hit closer than tmax, with hit.triangle indexing bvh.triangles.
+static RayHit intersect_bvh4(const Bvh4& bvh,
+                             const glm::vec3& ray_o,
+                             const glm::vec3& ray_d,
+                             float tmax = INFINITY) {
+    glm::vec3 inv_d = 1.0f / ray_d;
+
+    RayHit hit = {tmax, UINT32_MAX, 0.0f, 0.0f};
+    if (bvh.nodes.empty()) {
+        return hit;
+    }
+
+    // Nodes are pushed with their entry distance, so popping needs no box test.
+    struct StackEntry {
+        uint32_t node;
+        float t;
+    };
+    StackEntry stack[(BVH4_WIDTH - 1) * BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    uint32_t node_index = 0;
+
+    while (true) {
+        const Bvh4Node& node = bvh.nodes[node_index];
+        float t_children[BVH4_WIDTH];
+        intersect_children(node, ray_o, inv_d, hit.t, t_children);
+
+        // Leaves are intersected on the spot, which may cull inner children.
+        StackEntry next[BVH4_WIDTH];
+        uint32_t next_count = 0;
+        uint32_t triangle = node.first_triangle;
+        uint32_t child = node.first_child;
+        for (uint32_t i = 0; i < node.child_count; i++) {
+            uint32_t count = node.triangle_count[i];
+            if (count == 0) {
+                if (t_children[i] != INFINITY) {
+                    next[next_count++] = {child, t_children[i]};
+                }
+                child++;
+                continue;
+            }
+
+            if (t_children[i] < hit.t) {
+                for (uint32_t j = triangle; j < triangle + count; j++) {
+                    float u, v;
+                    float t = intersect_triangle(bvh.triangles[j], ray_o, ray_d, &u, &v);
+                    if (t < hit.t) {
+                        hit = {t, j, u, v};
+                    }
+                }
+            }
+            triangle += count;
+        }
+
+        // Farthest first, so the nearest child is visited next and the others
+        // come off the stack in order.
+        for (uint32_t i = 1; i < next_count; i++) {
+            for (uint32_t j = i; j > 0 && next[j - 1].t < next[j].t; j--) {
+                std::swap(next[j - 1], next[j]);
+            }
+        }
+        for (uint32_t i = 0; i + 1 < next_count; i++) {
+            if (next[i].t < hit.t) {
+                stack[stack_size++] = next[i];
+            }
+        }
+        if (next_count > 0 && next[next_count - 1].t < hit.t) {
+            node_index = next[next_count - 1].node;
+            continue;
+        }
+
+        bool found = false;
+        while (stack_size > 0) {
+            StackEntry entry = stack[--stack_size];
+            if (entry.t < hit.t) {
+                node_index = entry.node;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+
+    return hit;
+}
+
+bool intersect(const Bvh4& bvh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out) {
+    RayHit hit = intersect_bvh4(bvh, ray_o, ray_d);
+    if (hit.triangle == UINT32_MAX) {
+        return false;
+    }
+
+    if (t_out) {
+        *t_out = hit.t;
+    }
+    if (triangle_out) {
+        *triangle_out = bvh.triangles[hit.triangle].index;
+    }
+    return true;
+}
+
+bool occluded(const Bvh4& bvh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax) {
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+
+    glm::vec3 inv_d = 1.0f / ray_d;
+
+    uint32_t stack[(BVH4_WIDTH - 1) * BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const Bvh4Node& node = bvh.nodes[stack[--stack_size]];
+        float t_children[BVH4_WIDTH];
+        intersect_children(node, ray_o, inv_d, tmax, t_children);
+
+        uint32_t triangle = node.first_triangle;
+        uint32_t child = node.first_child;
+        for (uint32_t i = 0; i < node.child_count; i++) {
+            uint32_t count = node.triangle_count[i];
+            if (count == 0) {
+                if (t_children[i] != INFINITY) {
+                    stack[stack_size++] = child;
+                }
+                child++;
+                continue;
+            }
+
+            if (t_children[i] != INFINITY) {
+                for (uint32_t j = triangle; j < triangle + count; j++) {
+                    float u, v;
+                    float t = intersect_triangle(bvh.triangles[j], ray_o, ray_d, &u, &v);
+                    if (t > tmin && t < tmax) {
+                        return true;
+                    }
+                }
+            }
+            triangle += count;
+        }
+    }
+
+    return false;
+}
+
+bool intersect(const SceneBvh& scene,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* instance_out,
+               uint32_t* triangle_out) {
+    if (scene.instances.empty()) {
+        return false;
+    }
+
+    glm::vec3 inv_d = 1.0f / ray_d;
+
+    RayHit hit = {INFINITY, UINT32_MAX, 0.0f, 0.0f};
+    const SceneInstance* hit_instance = nullptr;
+
+    if (intersect_node(scene.nodes[0], ray_o, inv_d, hit.t) == INFINITY) {
+        return false;
+    }
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint32_t stack_size = 0;
+    uint32_t node_index = 0;
+
+    while (true) {
+        const BvhNode& node = scene.nodes[node_index];
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                // The object space direction is not renormalized, so t is the
+                // same along both rays.
+                const SceneInstance& instance = scene.instances[i];
+                glm::vec3 object_o = glm::vec3(instance.inverse_transform * glm::vec4(ray_o, 1.0f));
+                glm::vec3 object_d = glm::vec3(instance.inverse_transform * glm::vec4(ray_d, 0.0f));
+
+                RayHit instance_hit = intersect_bvh(*instance.bvh, object_o, object_d, hit.t);
+                if (instance_hit.triangle != UINT32_MAX) {
+                    hit = instance_hit;
+                    hit_instance = &instance;
+                }
+            }
+        } else {
+            uint32_t left = node.first;
+            uint32_t right = node.first + 1;
+            float t_left = intersect_node(scene.nodes[left], ray_o, inv_d, hit.t);
+            float t_right = intersect_node(scene.nodes[right], ray_o, inv_d, hit.t);
+
+            if (t_left > t_right) {
+                std::swap(t_left, t_right);
+                std::swap(left, right);
+            }
+
+            if (t_left != INFINITY) {
+                if (t_right != INFINITY) {
+                    stack[stack_size++] = right;
+                }
+                node_index = left;
+                continue;
+            }
+        }
+
+        bool found = false;
+        while (stack_size > 0) {
+            node_index = stack[--stack_size];
+            if (intersect_node(scene.nodes[node_index], ray_o, inv_d, hit.t) != INFINITY) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+
+    if (!hit_instance) {
+        return false;
+    }
+
+    if (t_out) {
+        *t_out = hit.t;
+    }
+    if (instance_out) {
+        *instance_out = hit_instance->id;
+    }
+    if (triangle_out) {
+        *triangle_out = hit_instance->bvh->triangles[hit.triangle].index;
+    }
+    return true;
+}
+
+static const size_t RAY_BATCH_CHUNK_SIZE = 1024;
+
+// Spreads the low 10 bits of x to every third bit.
+static uint32_t morton_expand_bits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+static uint32_t morton_code(const glm::vec3& p) {
+    glm::uvec3 q = glm::uvec3(glm::clamp(p * 1024.0f, 0.0f, 1023.0f));
+    return (morton_expand_bits(q.x) << 2) | (morton_expand_bits(q.y) << 1) | morton_expand_bits(q.z);
+}
+
+void intersect_batch(const Bvh& bvh,
+                     const glm::vec3* origins,
+                     const glm::vec3* directions,
+                     size_t ray_count,
+                     RayHit* hits,
+                     ThreadPool* pool) {
+    auto trace = [&](size_t ray) {
+        RayHit hit = intersect_bvh(bvh, origins[ray], directions[ray]);
+        if (hit.triangle != UINT32_MAX) {
+            hit.triangle = bvh.triangles[hit.triangle].index;
+        }
+        hits[ray] = hit;
+    };
+
+    if (ray_count <= RAY_BATCH_CHUNK_SIZE) {
+        for (size_t i = 0; i < ray_count; i++) {
+            trace(i);
+        }
+        return;
+    }
+
+    // Sort key: direction octant, then origin and direction along Morton
+    // curves, so a chunk holds rays that traverse the same part of the tree.
+    glm::vec3 origin_min(INFINITY);
+    glm::vec3 origin_max(-INFINITY);
+    for (size_t i = 0; i < ray_count; i++) {
+        origin_min = glm::min(origin_min, origins[i]);
+        origin_max = glm::max(origin_max, origins[i]);
+    }
+    glm::vec3 origin_extent = origin_max - origin_min;
+    glm::vec3 origin_scale = glm::vec3(
+        origin_extent.x > 0.0f ? 1.0f / origin_extent.x : 0.0f,
+        origin_extent.y > 0.0f ? 1.0f / origin_extent.y : 0.0f,
+        origin_extent.z > 0.0f ? 1.0f / origin_extent.z : 0.0f);
+
+    std::vector<std::pair<uint64_t, uint32_t>> order(ray_count);
+    for (size_t i = 0; i < ray_count; i++) {
+        const glm::vec3& d = directions[i];
+        uint64_t octant = (d.x < 0.0f ? 4 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 1 : 0);
+        uint64_t origin = morton_code((origins[i] - origin_min) * origin_scale);
+        uint64_t direction = morton_code(glm::normalize(d) * 0.5f + 0.5f);
+        order[i] = {(octant << 60) | (origin << 30) | direction, static_cast<uint32_t>(i)};
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t chunk_count = (ray_count + RAY_BATCH_CHUNK_SIZE - 1) / RAY_BATCH_CHUNK_SIZE;
+    auto trace_chunk = [&](size_t chunk) {
+        size_t end = std::min(ray_count, (chunk + 1) * RAY_BATCH_CHUNK_SIZE);
+        for (size_t i = chunk * RAY_BATCH_CHUNK_SIZE; i < end; i++) {
+            trace(order[i].second);
+        }
+    };
+
+    if (pool) {
+        parallel_for(*pool, chunk_count, trace_chunk);
+    } else {
+        for (size_t c = 0; c < chunk_count; c++) {
+            trace_chunk(c);
+        }
+    }
+}
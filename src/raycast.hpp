@@ -0,0 +1,113 @@
+#pragma once
+
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "thread_pool.hpp"
+
+#include <vector>
+
+static const uint32_t TRIANGLE_BLOCK_SIZE = 8;
+
+// TRIANGLE_BLOCK_SIZE triangles, one per SIMD lane. Padding lanes have zero
+// edges and never hit.
+struct alignas(32) TriangleBlock {
+    float v0[3][TRIANGLE_BLOCK_SIZE];
+    float edge1[3][TRIANGLE_BLOCK_SIZE];
+    float edge2[3][TRIANGLE_BLOCK_SIZE];
+};
+
+struct RayHit {
+    float t; // INFINITY on a miss
+    uint32_t triangle; // UINT32_MAX on a miss
+    float u, v; // barycentrics of the second and third vertices
+};
+
+// Precomputed triangles for brute force queries without gathers.
+struct TriangleSoA {
+    std::vector<TriangleBlock> blocks;
+    size_t triangle_count;
+};
+
+TriangleSoA build_triangle_soa(const glm::vec3* positions,
+                               size_t position_stride,
+                               const uint32_t* indices,
+                               size_t index_count);
+TriangleSoA build_triangle_soa(const Mesh& mesh);
+TriangleSoA build_triangle_soa(const CachedMesh& mesh);
+
+// Nearest hit along the ray with t > 0, brute force over every triangle.
+bool intersect(const Mesh& mesh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out);
+
+// True if any triangle is hit with tmin < t < tmax. Returns on the first hit
+// found instead of searching for the nearest one, for shadow and visibility
+// rays.
+bool occluded(const Mesh& mesh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax);
+
+// Same query over SoA triangles, 8 at a time with AVX, 4 with SSE, or one by
+// one, depending on the CPU.
+bool intersect(const TriangleSoA& triangles,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out = nullptr);
+
+bool occluded(const TriangleSoA& triangles,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax);
+
+// Same query, traversing the BVH. triangle_out receives the index of the hit
+// triangle in the source index buffer.
+bool intersect(const Bvh& bvh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out = nullptr);
+
+bool occluded(const Bvh& bvh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax);
+
+// Same queries on the wide tree, testing the four child boxes of a node at
+// once.
+bool intersect(const Bvh4& bvh,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* triangle_out = nullptr);
+
+bool occluded(const Bvh4& bvh,
+              const glm::vec3& ray_o,
+              const glm::vec3& ray_d,
+              float tmin,
+              float tmax);
+
+// Nearest hit over every instance of the scene. instance_out receives the
+// instance id, triangle_out the triangle in that instance's mesh.
+bool intersect(const SceneBvh& scene,
+               const glm::vec3& ray_o,
+               const glm::vec3& ray_d,
+               float* t_out,
+               uint32_t* instance_out = nullptr,
+               uint32_t* triangle_out = nullptr);
+
+// Traces ray_count rays through the BVH, writing hits[i] for ray i. Rays are
+// sorted by direction octant and origin so that neighbouring rays walk the
+// same nodes, then traced in chunks on the pool if one is given.
+void intersect_batch(const Bvh& bvh,
+                     const glm::vec3* origins,
+                     const glm::vec3* directions,
+                     size_t ray_count,
+                     RayHit* hits,
+                     ThreadPool* pool = nullptr);
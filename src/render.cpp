@@ -1,144 +1,185 @@
 #include "render.hpp"
 
 #include "platform_gpu.hpp"
+#include "quantize.hpp"
 
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <tuple>
-#include <unordered_map>
 
-#include "hash_tuple.hpp"
-
-GPUMesh gpu_mesh_allocate(const GPUContext& gpu, size_t vertex_count, size_t triangle_count) {
+GPUMesh gpu_mesh_allocate(const GPUContext& gpu,
+                          size_t vertex_count,
+                          size_t triangle_count,
+                          VertexFormat vertex_format) {
     GPUMesh mesh;
-    mesh.vertex_buffer = gpu_buffer_allocate<Vertex>(gpu,
-                                                     VERTEX_BUFFER | STORAGE_BUFFER,
-                                                     vertex_count);
-    mesh.color_buffer = gpu_buffer_allocate<glm::vec3>(gpu,
-                                                       VERTEX_BUFFER | STORAGE_BUFFER,
-                                                       vertex_count);
-    mesh.index_buffer = gpu_buffer_allocate<uint32_t>(gpu,
-                                                      INDEX_BUFFER,
-                                                      triangle_count * 3);
+    mesh.vertex_format = vertex_format;
+    mesh.vertex_buffer = {};
+    mesh.color_buffer = {};
+    mesh.compact_vertex_buffer = {};
+    mesh.compact_color_buffer = {};
+    mesh.dequantize = glm::mat4(1.0f);
+
+    if (vertex_format == VERTEX_FORMAT_COMPACT) {
+        mesh.compact_vertex_buffer = gpu_buffer_allocate<CompactVertex>(gpu,
+                                                                        VERTEX_BUFFER | STORAGE_BUFFER,
+                                                                        vertex_count);
+        mesh.compact_color_buffer = gpu_buffer_allocate<uint32_t>(gpu,
+                                                                  VERTEX_BUFFER | STORAGE_BUFFER,
+                                                                  vertex_count);
+    } else {
+        mesh.vertex_buffer = gpu_buffer_allocate<Vertex>(gpu,
+                                                         VERTEX_BUFFER | STORAGE_BUFFER,
+                                                         vertex_count);
+        mesh.color_buffer = gpu_buffer_allocate<glm::vec3>(gpu,
+                                                           VERTEX_BUFFER | STORAGE_BUFFER,
+                                                           vertex_count);
+    }
+
+    mesh.index_type = index_type_for(vertex_count);
+    mesh.index_buffer = {};
+    mesh.index_buffer_16 = {};
+    mesh.index_count = triangle_count * 3;
+    if (mesh.index_type == INDEX_TYPE_UINT16) {
+        mesh.index_buffer_16 = gpu_buffer_allocate<uint16_t>(gpu,
+                                                             INDEX_BUFFER,
+                                                             mesh.index_count);
+    } else {
+        mesh.index_buffer = gpu_buffer_allocate<uint32_t>(gpu,
+                                                          INDEX_BUFFER,
+                                                          mesh.index_count);
+    }
+    mesh.meshlets = GPUMeshlets{};
+    mesh.bounds = glm::vec4(0.0f);
     return mesh;
 }
 
 void gpu_mesh_upload(const GPUContext& gpu, GPUMesh& gpu_mesh, const Mesh& mesh) {
-    Vertex* gpu_vertices = gpu_buffer_map(gpu, gpu_mesh.vertex_buffer);
+    if (gpu_mesh.vertex_format == VERTEX_FORMAT_COMPACT) {
+        VertexQuantization quantization = vertex_quantization(mesh.positions.data(), mesh.positions.size());
+        gpu_mesh.dequantize = vertex_dequantize_matrix(quantization);
 
-    for (uint32_t i = 0; i < mesh.positions.size(); i++) {
-        gpu_vertices[i].position = mesh.positions[i];
-        gpu_vertices[i].uv = mesh.uvs[i];
-        gpu_vertices[i].normal = mesh.normals[i];
-    }
+        std::vector<CompactVertex> vertices(mesh.positions.size());
+        for (uint32_t i = 0; i < mesh.positions.size(); i++) {
+            vertices[i] = compact_vertex(mesh.positions[i], mesh.uvs[i], mesh.normals[i], quantization);
+        }
 
-    gpu_buffer_unmap(gpu, gpu_mesh.vertex_buffer);
-    
-    gpu_buffer_upload(gpu, gpu_mesh.index_buffer, mesh.indices.data(), 0, mesh.indices.size());
-}
+        gpu_buffer_upload(gpu, gpu_mesh.compact_vertex_buffer, vertices.data(), 0, vertices.size());
+    } else {
+        std::vector<Vertex> vertices(mesh.positions.size());
+        for (uint32_t i = 0; i < mesh.positions.size(); i++) {
+            vertices[i].position = mesh.positions[i];
+            vertices[i].uv = mesh.uvs[i];
+            vertices[i].normal = mesh.normals[i];
+        }
 
-Mesh load_obj_mesh(const std::string &filename) {
-    Mesh mesh;
-    
-    using vertex_tuple = std::tuple<uint32_t, uint32_t, uint32_t>;
+        gpu_buffer_upload(gpu, gpu_mesh.vertex_buffer, vertices.data(), 0, vertices.size());
+    }
     
-    std::ifstream file(filename);
-    std::string line;
+    gpu_mesh_upload_indices(gpu, gpu_mesh, mesh.indices.data(), 0, mesh.indices.size());
+    if (!mesh.lod_indices.empty()) {
+        gpu_mesh_upload_indices(gpu, gpu_mesh, mesh.lod_indices.data(), mesh.indices.size(), mesh.lod_indices.size());
+    }
+}
 
-    std::unordered_map<vertex_tuple, uint32_t> vertex_indices;
+void gpu_mesh_upload(const GPUContext& gpu, GPUMesh& gpu_mesh, const CachedMesh& mesh) {
+    // The cache already holds interleaved vertices in both formats, so all
+    // arrays go straight to the GPU.
+    if (gpu_mesh.vertex_format == VERTEX_FORMAT_COMPACT) {
+        gpu_mesh.dequantize = vertex_dequantize_matrix(mesh.quantization);
+        gpu_buffer_upload(gpu, gpu_mesh.compact_vertex_buffer, mesh.compact_vertices, 0, mesh.vertex_count);
+    } else {
+        gpu_buffer_upload(gpu, gpu_mesh.vertex_buffer, mesh.vertices, 0, mesh.vertex_count);
+    }
+    gpu_mesh_upload_indices(gpu, gpu_mesh, mesh.indices, 0, mesh.index_count + mesh.lod_index_count);
+}
 
-    std::vector<glm::vec3> raw_positions;
-    std::vector<glm::vec3> raw_normals;
-    std::vector<glm::vec2> raw_uvs;
-    
-    while (std::getline(file, line)) {
-        if (line.empty() || line[0] == '#') {
-            continue;
-        }
+void gpu_mesh_upload_indices(const GPUContext& gpu,
+                             GPUMesh& gpu_mesh,
+                             const uint32_t* indices,
+                             size_t offset,
+                             size_t count,
+                             GPUUploadTicket* ticket) {
+    if (gpu_mesh.index_type == INDEX_TYPE_UINT32) {
+        gpu_buffer_upload(gpu, gpu_mesh.index_buffer, indices, offset, count, ticket);
+        return;
+    }
 
-        std::istringstream iss(line);
-        std::string head;
-
-        iss >> head;
-
-        if (head == "f") {
-            std::vector<vertex_tuple> face;
-            while (iss) {
-                std::string block;
-                iss >> block;
-                if (block.empty()) {
-                    continue;
-                }
-
-                vertex_tuple vertex(-1, -1, -1);
-                char delim1, delim2;
-
-                std::istringstream block_iss(block);
-                block_iss >> std::get<0>(vertex);
-                block_iss.clear();
-                
-                block_iss >> delim1;
-
-                block_iss >> std::get<1>(vertex);
-                block_iss.clear();
-
-                block_iss >> delim2;
-                
-                block_iss >> std::get<2>(vertex);
-                block_iss.clear();
-
-                if (delim1 != '/' || delim2 != '/') {
-                    throw std::runtime_error("Expected '/' in .obj file");
-                }
-
-                face.push_back(vertex);
-            }
-
-            std::vector<uint32_t> face_indices(face.size());
-            for (uint32_t i = 0; i < face_indices.size(); i++) {
-                if (vertex_indices.find(face[i]) == vertex_indices.end()) {
-                    vertex_indices[face[i]] = mesh.positions.size();
-
-                    mesh.positions.push_back(raw_positions[std::get<0>(face[i]) - 1]);
-                    mesh.uvs.push_back(raw_uvs[std::get<1>(face[i]) - 1]);
-                    mesh.normals.push_back(raw_normals[std::get<2>(face[i]) - 1]);
-                }
-                face_indices[i] = vertex_indices[face[i]];
-            }
-
-            for (uint32_t second = 0; second + 1 < face.size(); second++) {
-                uint32_t third = second + 1;
-                mesh.indices.push_back(face_indices[0]);
-                mesh.indices.push_back(face_indices[second]);
-                mesh.indices.push_back(face_indices[third]);
-            }
-        } else if (head == "v") {
-            glm::vec3 pos;
-            iss >> pos.x >> pos.y >> pos.z;
-            raw_positions.push_back(pos);
-        } else if (head == "vt") {
-            glm::vec2 uv;
-            iss >> uv.x >> uv.y;
-            raw_uvs.push_back(uv);
-        } else if (head == "vn") {
-            glm::vec3 normal;
-            iss >> normal.x >> normal.y >> normal.z;
-            raw_normals.push_back(normal);
-        } else {
-            std::cout << "Unknown .obj file directive '" << head << "'\n";
-        }
+    // Narrowed straight into the staging ring would save this copy, but it
+    // is half the size of the source and stays in cache.
+    std::vector<uint16_t> narrowed(count);
+    for (size_t i = 0; i < count; i++) {
+        narrowed[i] = static_cast<uint16_t>(indices[i]);
     }
+    gpu_buffer_upload(gpu, gpu_mesh.index_buffer_16, narrowed.data(), offset, count, ticket);
+}
 
-    assert(mesh.positions.size() == mesh.uvs.size()
-           && mesh.uvs.size() == mesh.normals.size());
+void gpu_mesh_upload_meshlets(const GPUContext& gpu,
+                              GPUMesh& gpu_mesh,
+                              const CachedMesh& mesh,
+                              GPUUploadTicket* ticket) {
+    if (mesh.meshlet_count == 0) {
+        return;
+    }
 
-    return mesh;
+    GPUMeshlets& meshlets = gpu_mesh.meshlets;
+    meshlets.meshlet_buffer = gpu_buffer_allocate<Meshlet>(gpu, GRAPHICS | COMPUTE | STORAGE_BUFFER, mesh.meshlet_count);
+    meshlets.vertex_buffer = gpu_buffer_allocate<uint32_t>(gpu, GRAPHICS | COMPUTE | STORAGE_BUFFER, mesh.meshlet_vertex_count);
+    meshlets.triangle_buffer = gpu_buffer_allocate<uint32_t>(gpu, GRAPHICS | COMPUTE | STORAGE_BUFFER, mesh.meshlet_triangle_size / 4);
+
+    gpu_buffer_upload(gpu, meshlets.meshlet_buffer, mesh.meshlets, 0, mesh.meshlet_count, ticket);
+    gpu_buffer_upload(gpu, meshlets.vertex_buffer, mesh.meshlet_vertices, 0, mesh.meshlet_vertex_count, ticket);
+    gpu_buffer_upload(gpu, meshlets.triangle_buffer,
+                      reinterpret_cast<const uint32_t*>(mesh.meshlet_triangles),
+                      0, mesh.meshlet_triangle_size / 4,
+                      ticket);
 }
 
 void gpu_mesh_destroy(const GPUContext& ctx, GPUMesh& mesh) {
-    gpu_buffer_free(ctx, mesh.index_buffer);
-    gpu_buffer_free(ctx, mesh.vertex_buffer);
-    gpu_buffer_free(ctx, mesh.color_buffer);
+    if (mesh.index_type == INDEX_TYPE_UINT16) {
+        gpu_buffer_free(ctx, mesh.index_buffer_16);
+    } else {
+        gpu_buffer_free(ctx, mesh.index_buffer);
+    }
+    if (mesh.vertex_format == VERTEX_FORMAT_COMPACT) {
+        gpu_buffer_free(ctx, mesh.compact_vertex_buffer);
+        gpu_buffer_free(ctx, mesh.compact_color_buffer);
+    } else {
+        gpu_buffer_free(ctx, mesh.vertex_buffer);
+        gpu_buffer_free(ctx, mesh.color_buffer);
+    }
+
+    if (mesh.meshlets.meshlet_buffer.count > 0) {
+        gpu_buffer_free(ctx, mesh.meshlets.meshlet_buffer);
+        gpu_buffer_free(ctx, mesh.meshlets.vertex_buffer);
+        gpu_buffer_free(ctx, mesh.meshlets.triangle_buffer);
+    }
 }
 
+uint32_t select_mesh_lod(const GPUMesh& mesh,
+                         const glm::mat4& model_view,
+                         const glm::mat4& proj,
+                         float viewport_height,
+                         float max_pixel_error) {
+    if (mesh.lods.size() <= 1) {
+        return 0;
+    }
+
+    float scale = std::max(glm::length(glm::vec3(model_view[0])),
+                           std::max(glm::length(glm::vec3(model_view[1])),
+                                    glm::length(glm::vec3(model_view[2]))));
+
+    glm::vec4 center = model_view * glm::vec4(glm::vec3(mesh.bounds), 1.0f);
+    float distance = -center.z - mesh.bounds.w * scale;
+    if (distance <= 0.0f) {
+        return 0;
+    }
+
+    // proj[1][1] is the cotangent of half the vertical field of view.
+    float pixels_per_unit = proj[1][1] * .5f * viewport_height / distance;
+
+    uint32_t lod = 0;
+    while (lod + 1 < mesh.lods.size()
+           && mesh.lods[lod + 1].error * scale * pixels_per_unit <= max_pixel_error) {
+        lod++;
+    }
+    return lod;
+}
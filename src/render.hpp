@@ -2,26 +2,56 @@
 
 #include <glm/glm.hpp>
 #include "platform_gpu.hpp"
+#include "mesh.hpp"
+#include "mesh_cache.hpp"
 
-struct Mesh {
-    std::vector<glm::vec3> positions;
-    std::vector<glm::vec2> uvs;
-    std::vector<glm::vec3> normals;
-    
-    std::vector<uint32_t> indices;
+#include <vector>
+
+enum IndexType : uint32_t {
+    INDEX_TYPE_UINT16,
+    INDEX_TYPE_UINT32,
 };
 
-struct Vertex {
-    glm::vec3 position;
-    glm::vec2 uv;
-    glm::vec3 normal;
+// 16-bit indices whenever they can address every vertex.
+static inline IndexType index_type_for(size_t vertex_count) {
+    return vertex_count <= 65536 ? INDEX_TYPE_UINT16 : INDEX_TYPE_UINT32;
+}
+
+// Meshlet arrays of a mesh, see meshlet.hpp. All counts are zero for meshes
+// loaded without MESH_LOAD_MESHLETS.
+struct GPUMeshlets {
+    GPUBuffer<Meshlet> meshlet_buffer;
+    GPUBuffer<uint32_t> vertex_buffer;
+    // Local 8-bit indices, four per word.
+    GPUBuffer<uint32_t> triangle_buffer;
 };
-static_assert(sizeof(Vertex) == sizeof(float) * 8, "Wrong size for Vertex");
 
 struct GPUMesh {
+    VertexFormat vertex_format;
+
+    // Only allocated for VERTEX_FORMAT_FULL
     GPUBuffer<Vertex> vertex_buffer;
-    GPUBuffer<uint32_t> index_buffer;
     GPUBuffer<glm::vec3> color_buffer;
+
+    // Only allocated for VERTEX_FORMAT_COMPACT
+    GPUBuffer<CompactVertex> compact_vertex_buffer;
+    // RGBA8, see compact_color
+    GPUBuffer<uint32_t> compact_color_buffer;
+    // Maps compact positions to object space, identity for full vertices.
+    glm::mat4 dequantize;
+
+    IndexType index_type;
+    // Only the one matching index_type is allocated.
+    GPUBuffer<uint32_t> index_buffer;
+    GPUBuffer<uint16_t> index_buffer_16;
+    size_t index_count;
+
+    GPUMeshlets meshlets;
+
+    // Ranges of index_buffer, empty to always draw all of it.
+    std::vector<MeshLod> lods;
+    // Object-space bounding sphere, center then radius
+    glm::vec4 bounds;
 };
 
 struct GPUModel {
@@ -38,19 +68,49 @@ struct Camera {
     float far;
 };
 
-GPUMesh gpu_mesh_allocate(const GPUContext& gpu, size_t vertex_count, size_t triangle_count);
+GPUMesh gpu_mesh_allocate(const GPUContext& gpu,
+                          size_t vertex_count,
+                          size_t triangle_count,
+                          VertexFormat vertex_format = VERTEX_FORMAT_FULL);
 void gpu_mesh_upload(const GPUContext& gpu, GPUMesh& gpu_mesh, const Mesh& mesh);
+void gpu_mesh_upload(const GPUContext& gpu, GPUMesh& gpu_mesh, const CachedMesh& mesh);
 
-Mesh load_obj_mesh(const std::string& filename);
+// Copies 32-bit indices into the index buffer, narrowing them on the way for
+// 16-bit meshes. ticket makes the upload asynchronous, see gpu_buffer_upload.
+void gpu_mesh_upload_indices(const GPUContext& gpu,
+                             GPUMesh& gpu_mesh,
+                             const uint32_t* indices,
+                             size_t offset,
+                             size_t count,
+                             GPUUploadTicket* ticket = nullptr);
+
+// Allocates and fills the meshlet buffers of gpu_mesh, if the mesh has meshlets.
+void gpu_mesh_upload_meshlets(const GPUContext& gpu,
+                              GPUMesh& gpu_mesh,
+                              const CachedMesh& mesh,
+                              GPUUploadTicket* ticket = nullptr);
 
 void gpu_mesh_destroy(const GPUContext& ctx, GPUMesh& mesh);
 
+// Largest simplification error allowed on screen, in pixels.
+static const float LOD_MAX_PIXEL_ERROR = 1.0f;
+
+// Picks the coarsest level of detail whose error projects to less than
+// max_pixel_error pixels, measured at the point of the bounding sphere closest
+// to the camera.
+uint32_t select_mesh_lod(const GPUMesh& mesh,
+                         const glm::mat4& model_view,
+                         const glm::mat4& proj,
+                         float viewport_height,
+                         float max_pixel_error = LOD_MAX_PIXEL_ERROR);
+
 GraphicsFrame begin_frame(GraphicsContext& ctx);
 void end_frame(const GraphicsContext& ctx,
                GraphicsFrame& frame);
 
 void draw_mesh(const GraphicsFrame& frame,
-               const GPUMesh& mesh);
+               const GPUMesh& mesh,
+               uint32_t lod = 0);
 
 void draw_model(const GraphicsFrame& frame,
                 const glm::mat4& view,
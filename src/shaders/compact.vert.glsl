@@ -0,0 +1,36 @@
+#version 450
+
+struct Matrices {
+    mat4 mvp;
+    mat4 model_view;
+};
+
+layout(push_constant) uniform push_constants {
+    Matrices u_mat;
+};
+
+// Unpacked by the vertex formats, positions are still in [0, 1] and
+// u_mat.mvp maps them back into the mesh bounds.
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec2 uv;
+layout(location = 2) in vec2 normal_oct;
+layout(location = 3) in vec4 color;
+
+layout(location = 0) out vec2 out_uv;
+layout(location = 1) out vec3 out_normal;
+layout(location = 2) out vec3 out_color;
+
+vec3 octahedral_decode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    gl_Position = u_mat.mvp * vec4(position.xyz, 1);
+    out_uv = uv;
+    out_normal = (u_mat.model_view * vec4(octahedral_decode(normal_oct), 0)).xyz;
+    out_color = color.rgb;
+}
@@ -0,0 +1,80 @@
+#version 450
+
+// Bounds of the triangle centroids, which the Morton codes are quantized in.
+// The result is kept as order preserving uints so it can be merged with
+// atomicMin/atomicMax. bounds must be reset to (~0, 0) beforehand.
+
+layout(local_size_x = 256) in;
+
+struct Vertex {
+    vec3 position;
+    float u;
+    float v;
+    float nx;
+    float ny;
+    float nz;
+};
+
+layout(std430, binding = 0) readonly buffer vertex_buffer
+{
+    Vertex vertices[];
+};
+
+layout(std430, binding = 1) readonly buffer index_buffer
+{
+    uint indices[];
+};
+
+layout(std430, binding = 2) readonly buffer parameters
+{
+    uint triangle_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 3) buffer bounds_buffer
+{
+    // min xyz, then max xyz
+    uint bounds[6];
+};
+
+shared vec3 group_min[256];
+shared vec3 group_max[256];
+
+uint float_to_ordered(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    uint tid = gl_LocalInvocationID.x;
+
+    if (i < triangle_count) {
+        vec3 p0 = vertices[indices[3 * i]].position;
+        vec3 p1 = vertices[indices[3 * i + 1]].position;
+        vec3 p2 = vertices[indices[3 * i + 2]].position;
+        vec3 centroid = (min(p0, min(p1, p2)) + max(p0, max(p1, p2))) * 0.5;
+        group_min[tid] = centroid;
+        group_max[tid] = centroid;
+    } else {
+        group_min[tid] = vec3(uintBitsToFloat(0x7f800000u));
+        group_max[tid] = vec3(-uintBitsToFloat(0x7f800000u));
+    }
+    barrier();
+
+    for (uint stride = 128u; stride > 0u; stride /= 2u) {
+        if (tid < stride) {
+            group_min[tid] = min(group_min[tid], group_min[tid + stride]);
+            group_max[tid] = max(group_max[tid], group_max[tid + stride]);
+        }
+        barrier();
+    }
+
+    if (tid == 0) {
+        for (int k = 0; k < 3; k++) {
+            atomicMin(bounds[k], float_to_ordered(group_min[0][k]));
+            atomicMax(bounds[3 + k], float_to_ordered(group_max[0][k]));
+        }
+    }
+}
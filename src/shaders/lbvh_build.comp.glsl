@@ -0,0 +1,107 @@
+#version 450
+
+// Karras' parallel construction of the binary radix tree over the sorted
+// Morton codes, one invocation per inner node. Inner nodes are
+// [0, n - 1), leaves [n - 1, 2n - 1), the root is node 0. Equal codes are
+// told apart by their position.
+
+layout(local_size_x = 256) in;
+
+struct Node {
+    vec3 min;
+    uint left;
+    vec3 max;
+    // ~0 for leaves, whose left is their triangle.
+    uint right;
+};
+
+layout(std430, binding = 0) readonly buffer parameters
+{
+    uint triangle_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 1) readonly buffer key_buffer
+{
+    uint keys[];
+};
+
+layout(std430, binding = 2) writeonly buffer node_buffer
+{
+    Node nodes[];
+};
+
+layout(std430, binding = 3) writeonly buffer parent_buffer
+{
+    uint parents[];
+};
+
+// Visit counters for lbvh_refit.
+layout(std430, binding = 4) writeonly buffer flag_buffer
+{
+    uint flags[];
+};
+
+// Length of the common prefix of the codes at i and j, -1 outside the array.
+int delta(int i, int j) {
+    if (j < 0 || j >= int(triangle_count)) {
+        return -1;
+    }
+    uint a = keys[i];
+    uint b = keys[j];
+    if (a == b) {
+        return 32 + 31 - findMSB(uint(i ^ j));
+    }
+    return 31 - findMSB(a ^ b);
+}
+
+void main() {
+    int i = int(gl_GlobalInvocationID.x);
+    int n = int(triangle_count);
+    if (i >= n - 1) {
+        return;
+    }
+
+    // Direction of the range, then its other end by exponential and binary search.
+    int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+    int delta_min = delta(i, i - d);
+
+    int range_max = 2;
+    while (delta(i, i + range_max * d) > delta_min) {
+        range_max *= 2;
+    }
+
+    int range_length = 0;
+    for (int t = range_max / 2; t >= 1; t /= 2) {
+        if (delta(i, i + (range_length + t) * d) > delta_min) {
+            range_length += t;
+        }
+    }
+    int j = i + range_length * d;
+
+    // Split where the prefix of the whole range ends.
+    int delta_node = delta(i, j);
+    int split = 0;
+    int divisor = 2;
+    while (true) {
+        int t = (range_length + divisor - 1) / divisor;
+        if (delta(i, i + (split + t) * d) > delta_node) {
+            split += t;
+        }
+        if (t <= 1) {
+            break;
+        }
+        divisor *= 2;
+    }
+    int gamma = i + split * d + min(d, 0);
+
+    uint left = min(i, j) == gamma ? uint(n - 1 + gamma) : uint(gamma);
+    uint right = max(i, j) == gamma + 1 ? uint(n - 1 + gamma + 1) : uint(gamma + 1);
+
+    nodes[i].left = left;
+    nodes[i].right = right;
+    parents[left] = uint(i);
+    parents[right] = uint(i);
+    flags[i] = 0u;
+}
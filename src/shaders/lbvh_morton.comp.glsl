@@ -0,0 +1,84 @@
+#version 450
+
+// 30-bit Morton code of every triangle centroid, paired with the triangle
+// index for sorting.
+
+layout(local_size_x = 256) in;
+
+struct Vertex {
+    vec3 position;
+    float u;
+    float v;
+    float nx;
+    float ny;
+    float nz;
+};
+
+layout(std430, binding = 0) readonly buffer vertex_buffer
+{
+    Vertex vertices[];
+};
+
+layout(std430, binding = 1) readonly buffer index_buffer
+{
+    uint indices[];
+};
+
+layout(std430, binding = 2) readonly buffer parameters
+{
+    uint triangle_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 3) readonly buffer bounds_buffer
+{
+    uint bounds[6];
+};
+
+layout(std430, binding = 4) writeonly buffer key_buffer
+{
+    uint keys[];
+};
+
+layout(std430, binding = 5) writeonly buffer value_buffer
+{
+    uint values[];
+};
+
+float ordered_to_float(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7fffffffu : ~u);
+}
+
+// Spreads the low 10 bits of x to every third bit.
+uint expand_bits(uint x) {
+    x &= 0x3ffu;
+    x = (x | (x << 16)) & 0x030000ffu;
+    x = (x | (x << 8)) & 0x0300f00fu;
+    x = (x | (x << 4)) & 0x030c30c3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= triangle_count) {
+        return;
+    }
+
+    vec3 scene_min = vec3(ordered_to_float(bounds[0]), ordered_to_float(bounds[1]), ordered_to_float(bounds[2]));
+    vec3 scene_max = vec3(ordered_to_float(bounds[3]), ordered_to_float(bounds[4]), ordered_to_float(bounds[5]));
+    vec3 extent = scene_max - scene_min;
+    vec3 scale = vec3(extent.x > 0.0 ? 1.0 / extent.x : 0.0,
+                      extent.y > 0.0 ? 1.0 / extent.y : 0.0,
+                      extent.z > 0.0 ? 1.0 / extent.z : 0.0);
+
+    vec3 p0 = vertices[indices[3 * i]].position;
+    vec3 p1 = vertices[indices[3 * i + 1]].position;
+    vec3 p2 = vertices[indices[3 * i + 2]].position;
+    vec3 centroid = (min(p0, min(p1, p2)) + max(p0, max(p1, p2))) * 0.5;
+
+    uvec3 q = uvec3(clamp((centroid - scene_min) * scale * 1024.0, vec3(0.0), vec3(1023.0)));
+    keys[i] = (expand_bits(q.x) << 2) | (expand_bits(q.y) << 1) | expand_bits(q.z);
+    values[i] = i;
+}
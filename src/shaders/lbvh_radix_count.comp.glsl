@@ -0,0 +1,45 @@
+#version 450
+
+// First step of one 8-bit radix sort pass : per block histogram of the digit
+// at shift. Blocks hold 1024 keys. The histograms are stored digit major,
+// so an exclusive scan over the whole buffer gives every block its output
+// offset for every digit.
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer parameters
+{
+    uint key_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 1) readonly buffer key_buffer
+{
+    uint keys[];
+};
+
+layout(std430, binding = 2) writeonly buffer histogram_buffer
+{
+    uint histograms[];
+};
+
+shared uint histogram[256];
+
+void main() {
+    uint tid = gl_LocalInvocationID.x;
+    uint block = gl_WorkGroupID.x;
+
+    histogram[tid] = 0u;
+    barrier();
+
+    for (uint k = 0u; k < 4u; k++) {
+        uint i = block * 1024 + k * 256 + tid;
+        if (i < key_count) {
+            atomicAdd(histogram[(keys[i] >> shift) & 0xffu], 1u);
+        }
+    }
+    barrier();
+
+    histograms[tid * block_count + block] = histogram[tid];
+}
@@ -0,0 +1,53 @@
+#version 450
+
+// Exclusive scan of the radix histograms, in place, with a single workgroup.
+// Each invocation scans one contiguous segment.
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer parameters
+{
+    uint key_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 1) buffer histogram_buffer
+{
+    uint histograms[];
+};
+
+shared uint segment_offsets[256];
+
+void main() {
+    uint tid = gl_LocalInvocationID.x;
+
+    uint total = 256 * block_count;
+    uint segment = (total + 255) / 256;
+    uint begin = min(tid * segment, total);
+    uint end = min(begin + segment, total);
+
+    uint sum = 0u;
+    for (uint i = begin; i < end; i++) {
+        sum += histograms[i];
+    }
+    segment_offsets[tid] = sum;
+    barrier();
+
+    if (tid == 0) {
+        uint running = 0u;
+        for (uint s = 0u; s < 256u; s++) {
+            uint count = segment_offsets[s];
+            segment_offsets[s] = running;
+            running += count;
+        }
+    }
+    barrier();
+
+    uint running = segment_offsets[tid];
+    for (uint i = begin; i < end; i++) {
+        uint count = histograms[i];
+        histograms[i] = running;
+        running += count;
+    }
+}
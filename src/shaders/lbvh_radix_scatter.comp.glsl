@@ -0,0 +1,78 @@
+#version 450
+
+// Last step of a radix sort pass : stable scatter of each block to the
+// offsets from the scanned histograms. The block is walked 256 keys at a
+// time, ranking every key among the earlier keys with the same digit.
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer parameters
+{
+    uint key_count;
+    uint shift;
+    uint block_count;
+};
+
+layout(std430, binding = 1) readonly buffer key_in_buffer
+{
+    uint keys_in[];
+};
+
+layout(std430, binding = 2) readonly buffer value_in_buffer
+{
+    uint values_in[];
+};
+
+layout(std430, binding = 3) writeonly buffer key_out_buffer
+{
+    uint keys_out[];
+};
+
+layout(std430, binding = 4) writeonly buffer value_out_buffer
+{
+    uint values_out[];
+};
+
+layout(std430, binding = 5) readonly buffer histogram_buffer
+{
+    uint histograms[];
+};
+
+shared uint offsets[256];
+// 256 marks invocations past the end of the keys.
+shared uint digits[256];
+
+void main() {
+    uint tid = gl_LocalInvocationID.x;
+    uint block = gl_WorkGroupID.x;
+
+    offsets[tid] = histograms[tid * block_count + block];
+    barrier();
+
+    for (uint k = 0u; k < 4u; k++) {
+        uint i = block * 1024 + k * 256 + tid;
+        uint key = i < key_count ? keys_in[i] : 0u;
+        uint digit = i < key_count ? (key >> shift) & 0xffu : 256u;
+        digits[tid] = digit;
+        barrier();
+
+        if (digit < 256u) {
+            uint rank = 0u;
+            for (uint j = 0u; j < tid; j++) {
+                rank += digits[j] == digit ? 1u : 0u;
+            }
+            uint destination = offsets[digit] + rank;
+            keys_out[destination] = key;
+            values_out[destination] = values_in[i];
+        }
+        barrier();
+
+        // Here tid stands for a digit.
+        uint count = 0u;
+        for (uint j = 0u; j < 256u; j++) {
+            count += digits[j] == tid ? 1u : 0u;
+        }
+        offsets[tid] += count;
+        barrier();
+    }
+}
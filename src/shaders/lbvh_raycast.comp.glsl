@@ -0,0 +1,139 @@
+#version 450
+
+// Nearest hit of every ray against the LBVH, same conventions as the CPU
+// intersect() : t > 0, Moller-Trumbore barycentrics.
+
+layout(local_size_x = 64) in;
+
+struct Vertex {
+    vec3 position;
+    float u;
+    float v;
+    float nx;
+    float ny;
+    float nz;
+};
+
+struct Node {
+    vec3 min;
+    uint left;
+    vec3 max;
+    uint right;
+};
+
+struct Ray {
+    vec4 origin;
+    // w is the maximum distance
+    vec4 direction;
+};
+
+struct Hit {
+    float t;
+    uint triangle;
+    float u;
+    float v;
+};
+
+layout(std430, binding = 0) readonly buffer vertex_buffer
+{
+    Vertex vertices[];
+};
+
+layout(std430, binding = 1) readonly buffer index_buffer
+{
+    uint indices[];
+};
+
+layout(std430, binding = 2) readonly buffer node_buffer
+{
+    Node nodes[];
+};
+
+layout(std430, binding = 3) readonly buffer parameters
+{
+    uint ray_count;
+};
+
+layout(std430, binding = 4) readonly buffer ray_buffer
+{
+    Ray rays[];
+};
+
+layout(std430, binding = 5) writeonly buffer hit_buffer
+{
+    Hit hits[];
+};
+
+// Every level extends the common (code, index) prefix, which is at most 62
+// bits long, so the tree is never deeper than this.
+const uint STACK_SIZE = 64u;
+
+bool hit_box(uint node, vec3 origin, vec3 inv_direction, float tmax) {
+    vec3 t0 = (nodes[node].min - origin) * inv_direction;
+    vec3 t1 = (nodes[node].max - origin) * inv_direction;
+    vec3 near = min(t0, t1);
+    vec3 far = max(t0, t1);
+    float enter = max(max(near.x, near.y), max(near.z, 0.0));
+    float exit = min(min(far.x, far.y), min(far.z, tmax));
+    return enter <= exit;
+}
+
+void main() {
+    uint r = gl_GlobalInvocationID.x;
+    if (r >= ray_count) {
+        return;
+    }
+
+    vec3 origin = rays[r].origin.xyz;
+    vec3 direction = rays[r].direction.xyz;
+    vec3 inv_direction = 1.0 / direction;
+
+    Hit hit = Hit(rays[r].direction.w, ~0u, 0.0, 0.0);
+
+    uint stack[STACK_SIZE];
+    uint stack_size = 0u;
+    stack[stack_size++] = 0u;
+
+    while (stack_size > 0u) {
+        uint node = stack[--stack_size];
+        if (!hit_box(node, origin, inv_direction, hit.t)) {
+            continue;
+        }
+
+        if (nodes[node].right == ~0u) {
+            uint triangle = nodes[node].left;
+            vec3 v0 = vertices[indices[3 * triangle]].position;
+            vec3 edge1 = vertices[indices[3 * triangle + 1]].position - v0;
+            vec3 edge2 = vertices[indices[3 * triangle + 2]].position - v0;
+
+            vec3 h = cross(direction, edge2);
+            float a = dot(edge1, h);
+            if (a == 0.0) {
+                continue;
+            }
+            float f = 1.0 / a;
+            vec3 s = origin - v0;
+            float u = f * dot(s, h);
+            if (u < 0.0 || u > 1.0) {
+                continue;
+            }
+            vec3 q = cross(s, edge1);
+            float v = f * dot(direction, q);
+            if (v < 0.0 || u + v > 1.0) {
+                continue;
+            }
+            float t = f * dot(edge2, q);
+            if (t > 0.0 && t < hit.t) {
+                hit = Hit(t, triangle, u, v);
+            }
+        } else {
+            stack[stack_size++] = nodes[node].right;
+            stack[stack_size++] = nodes[node].left;
+        }
+    }
+
+    if (hit.triangle == ~0u) {
+        hit.t = uintBitsToFloat(0x7f800000u);
+    }
+    hits[r] = hit;
+}
@@ -0,0 +1,96 @@
+#version 450
+
+// Node bounds, bottom-up. Every leaf walks towards the root, and at each
+// inner node the first of the two children to arrive stops, so the second
+// one sees both children finished.
+
+layout(local_size_x = 256) in;
+
+struct Vertex {
+    vec3 position;
+    float u;
+    float v;
+    float nx;
+    float ny;
+    float nz;
+};
+
+struct Node {
+    vec3 min;
+    uint left;
+    vec3 max;
+    uint right;
+};
+
+layout(std430, binding = 0) readonly buffer vertex_buffer
+{
+    Vertex vertices[];
+};
+
+layout(std430, binding = 1) readonly buffer index_buffer
+{
+    uint indices[];
+};
+
+layout(std430, binding = 2) readonly buffer parameters
+{
+    uint triangle_count;
+    uint shift;
+    uint block_count;
+};
+
+// Triangle indices in Morton order.
+layout(std430, binding = 3) readonly buffer value_buffer
+{
+    uint values[];
+};
+
+layout(std430, binding = 4) coherent buffer node_buffer
+{
+    Node nodes[];
+};
+
+layout(std430, binding = 5) readonly buffer parent_buffer
+{
+    uint parents[];
+};
+
+layout(std430, binding = 6) coherent buffer flag_buffer
+{
+    uint flags[];
+};
+
+void main() {
+    uint k = gl_GlobalInvocationID.x;
+    if (k >= triangle_count) {
+        return;
+    }
+
+    uint node = triangle_count - 1 + k;
+    uint triangle = values[k];
+
+    vec3 p0 = vertices[indices[3 * triangle]].position;
+    vec3 p1 = vertices[indices[3 * triangle + 1]].position;
+    vec3 p2 = vertices[indices[3 * triangle + 2]].position;
+    nodes[node].min = min(p0, min(p1, p2));
+    nodes[node].max = max(p0, max(p1, p2));
+    nodes[node].left = triangle;
+    nodes[node].right = ~0u;
+    memoryBarrierBuffer();
+
+    while (node != 0u) {
+        uint parent = parents[node];
+        if (atomicAdd(flags[parent], 1u) == 0u) {
+            return;
+        }
+        memoryBarrierBuffer();
+
+        uint left = nodes[parent].left;
+        uint right = nodes[parent].right;
+        nodes[parent].min = min(nodes[left].min, nodes[right].min);
+        nodes[parent].max = max(nodes[left].max, nodes[right].max);
+        memoryBarrierBuffer();
+
+        node = parent;
+    }
+}
@@ -34,6 +34,10 @@ void main() {
     float amp = .05f;
     
     uint i = gl_GlobalInvocationID.x;
+    if (i >= vertices_out.length()) {
+        return;
+    }
+
     vertices_out[i] = vertices_in[i];
     
     vertices_out[i].position.x += amp * sin(vertices_in[i].position.z * k - w * t);
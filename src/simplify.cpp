@@ -0,0 +1,336 @@
+#include "simplify.hpp"
+
+#include "flat_hash_map.hpp"
+#include "hash.hpp"
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Symmetric 4x4 matrix summing squared distances to planes, upper triangle
+// stored row by row.
+struct Quadric {
+    double m[10];
+    double weight;
+};
+
+static void quadric_add_plane(Quadric& q, const glm::dvec3& n, double d, double weight) {
+    q.m[0] += weight * n.x * n.x;
+    q.m[1] += weight * n.x * n.y;
+    q.m[2] += weight * n.x * n.z;
+    q.m[3] += weight * n.x * d;
+    q.m[4] += weight * n.y * n.y;
+    q.m[5] += weight * n.y * n.z;
+    q.m[6] += weight * n.y * d;
+    q.m[7] += weight * n.z * n.z;
+    q.m[8] += weight * n.z * d;
+    q.m[9] += weight * d * d;
+    q.weight += weight;
+}
+
+static void quadric_add(Quadric& q, const Quadric& other) {
+    for (int i = 0; i < 10; i++) {
+        q.m[i] += other.m[i];
+    }
+    q.weight += other.weight;
+}
+
+// Mean squared distance from p to the planes of a + b.
+static double quadric_error(const Quadric& a, const Quadric& b, const glm::vec3& p) {
+    double m[10];
+    for (int i = 0; i < 10; i++) {
+        m[i] = a.m[i] + b.m[i];
+    }
+    double weight = a.weight + b.weight;
+
+    double x = p.x, y = p.y, z = p.z;
+    double r = m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+        + m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+        + m[7] * z * z + 2.0 * m[8] * z
+        + m[9];
+
+    return weight > 0.0 ? std::fabs(r) / weight : 0.0;
+}
+
+struct EdgeKey {
+    uint32_t a;
+    uint32_t b;
+};
+
+static inline bool operator==(const EdgeKey& a, const EdgeKey& b) {
+    return a.a == b.a && a.b == b.b;
+}
+
+static inline uint64_t hash_key(const EdgeKey& key) {
+    return hash_u32x3(key.a, key.b, 0);
+}
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double error;
+};
+
+// Returns true if moving `from` onto `to` turns a triangle of `from` over.
+static bool collapse_flips(const std::vector<glm::vec3>& positions,
+                           const std::vector<uint32_t>& indices,
+                           const std::vector<uint32_t>& remap,
+                           const uint32_t* triangles,
+                           size_t triangle_count,
+                           uint32_t from,
+                           uint32_t to) {
+    for (size_t i = 0; i < triangle_count; i++) {
+        uint32_t corners[3];
+        for (int k = 0; k < 3; k++) {
+            corners[k] = remap[indices[triangles[i] * 3 + k]];
+        }
+
+        // Triangles on the collapsed edge disappear.
+        if (corners[0] == to || corners[1] == to || corners[2] == to) {
+            continue;
+        }
+        if (corners[0] != from && corners[1] != from && corners[2] != from) {
+            continue;
+        }
+
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = positions[corners[k]];
+            q[k] = corners[k] == from ? positions[to] : p[k];
+        }
+
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+
+        if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<uint32_t> simplify_indices(const std::vector<glm::vec3>& positions,
+                                       const uint32_t* indices,
+                                       size_t index_count,
+                                       size_t target_index_count,
+                                       float* error_out) {
+    size_t vertex_count = positions.size();
+
+    std::vector<uint32_t> result;
+    result.reserve(index_count);
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a != b && b != c && c != a) {
+            result.push_back(a);
+            result.push_back(b);
+            result.push_back(c);
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertex_count, Quadric{});
+    for (size_t i = 0; i < result.size(); i += 3) {
+        glm::dvec3 p0 = positions[result[i]];
+        glm::dvec3 p1 = positions[result[i + 1]];
+        glm::dvec3 p2 = positions[result[i + 2]];
+
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        double area = glm::length(n);
+        if (area == 0.0) {
+            continue;
+        }
+        n /= area;
+
+        for (int k = 0; k < 3; k++) {
+            quadric_add_plane(quadrics[result[i + k]], n, -glm::dot(n, p0), area);
+        }
+    }
+
+    // Edges with a single triangle are mesh borders or attribute seams, moving
+    // their vertices would open holes.
+    std::vector<bool> locked(vertex_count, false);
+    {
+        FlatHashMap<EdgeKey> edges;
+        flat_hash_map_reserve(edges, result.size());
+        std::vector<uint32_t> edge_triangle_counts;
+        std::vector<EdgeKey> edge_keys;
+
+        for (size_t i = 0; i < result.size(); i++) {
+            uint32_t a = result[i];
+            uint32_t b = result[i % 3 == 2 ? i - 2 : i + 1];
+            EdgeKey key = {std::min(a, b), std::max(a, b)};
+
+            uint32_t edge = flat_hash_map_insert(edges, key, edge_keys.size());
+            if (edge == edge_keys.size()) {
+                edge_keys.push_back(key);
+                edge_triangle_counts.push_back(0);
+            }
+            edge_triangle_counts[edge]++;
+        }
+
+        for (size_t e = 0; e < edge_keys.size(); e++) {
+            if (edge_triangle_counts[e] == 1) {
+                locked[edge_keys[e].a] = true;
+                locked[edge_keys[e].b] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> remap(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++) {
+        remap[v] = v;
+    }
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> best(vertex_count);
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched(vertex_count);
+
+    double max_error = 0.0;
+
+    while (result.size() > target_index_count) {
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for (uint32_t index : result) {
+            adjacency_offsets[index + 1]++;
+        }
+        for (size_t v = 0; v < vertex_count; v++) {
+            adjacency_offsets[v + 1] += adjacency_offsets[v];
+        }
+        adjacency.resize(result.size());
+        {
+            std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++) {
+                adjacency[fill[result[i]]++] = i / 3;
+            }
+        }
+
+        // Cheapest collapse of every vertex, along one of its edges.
+        for (uint32_t index : result) {
+            best[index] = {index, index, INFINITY};
+        }
+        for (size_t i = 0; i < result.size(); i++) {
+            uint32_t a = result[i];
+            uint32_t b = result[i % 3 == 2 ? i - 2 : i + 1];
+            uint32_t ends[2][2] = {{a, b}, {b, a}};
+
+            for (const auto& end : ends) {
+                uint32_t from = end[0], to = end[1];
+                if (locked[from]) {
+                    continue;
+                }
+
+                double error = quadric_error(quadrics[from], quadrics[to], positions[to]);
+                if (error < best[from].error) {
+                    best[from] = {from, to, error};
+                }
+            }
+        }
+
+        collapses.clear();
+        for (uint32_t index : result) {
+            if (best[index].to != index) {
+                collapses.push_back(best[index]);
+                // Only push each vertex once, it appears at every corner.
+                best[index].to = index;
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+            return a.error < b.error;
+        });
+
+        // Collapses in one pass must not share vertices, so that the ones
+        // taken later still see valid triangles around them.
+        std::fill(touched.begin(), touched.end(), false);
+
+        size_t triangles_to_remove = (result.size() - target_index_count) / 3;
+        size_t triangles_removed = 0;
+        size_t collapse_count = 0;
+
+        for (const Collapse& collapse : collapses) {
+            if (triangles_removed >= triangles_to_remove) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+
+            const uint32_t* triangles = &adjacency[adjacency_offsets[collapse.from]];
+            size_t triangle_count = adjacency_offsets[collapse.from + 1] - adjacency_offsets[collapse.from];
+            if (collapse_flips(positions, result, remap, triangles, triangle_count, collapse.from, collapse.to)) {
+                continue;
+            }
+
+            for (size_t i = 0; i < triangle_count; i++) {
+                const uint32_t* corners = &result[triangles[i] * 3];
+                triangles_removed += corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to;
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadric_add(quadrics[collapse.to], quadrics[collapse.from]);
+            touched[collapse.from] = true;
+            touched[collapse.to] = true;
+
+            max_error = std::max(max_error, collapse.error);
+            collapse_count++;
+        }
+
+        if (collapse_count == 0) {
+            break;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (a != b && b != c && c != a) {
+                result[kept++] = a;
+                result[kept++] = b;
+                result[kept++] = c;
+            }
+        }
+        result.resize(kept);
+    }
+
+    if (error_out) {
+        *error_out = static_cast<float>(std::sqrt(max_error));
+    }
+
+    return result;
+}
+
+void build_mesh_lods(Mesh& mesh, uint32_t max_lod_count, size_t min_triangle_count) {
+    mesh.lods.clear();
+    mesh.lod_indices.clear();
+    mesh.lods.push_back({0, static_cast<uint32_t>(mesh.indices.size()), 0.0f});
+
+    std::vector<uint32_t> current = mesh.indices;
+    float error = 0.0f;
+
+    while (mesh.lods.size() < max_lod_count && current.size() / 3 > min_triangle_count) {
+        float lod_error;
+        std::vector<uint32_t> next = simplify_indices(mesh.positions,
+                                                      current.data(),
+                                                      current.size(),
+                                                      current.size() / 6 * 3,
+                                                      &lod_error);
+
+        // Everything left is locked or would flip.
+        if (next.size() > current.size() * 3 / 4) {
+            break;
+        }
+
+        optimize_vertex_cache(next, mesh.positions.size());
+
+        // Each level is simplified from the previous one, so errors add up.
+        error += lod_error;
+
+        MeshLod lod;
+        lod.index_offset = mesh.indices.size() + mesh.lod_indices.size();
+        lod.index_count = next.size();
+        lod.error = error;
+        mesh.lods.push_back(lod);
+
+        mesh.lod_indices.insert(mesh.lod_indices.end(), next.begin(), next.end());
+        current.swap(next);
+    }
+}
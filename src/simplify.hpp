@@ -0,0 +1,19 @@
+#pragma once
+
+#include "mesh.hpp"
+
+// Collapses edges in order of quadric error (Garland and Heckbert,
+// "Surface Simplification Using Quadric Error Metrics") until at most
+// target_index_count indices are left, or nothing can be collapsed. Vertices
+// only ever collapse onto other vertices, so the result indexes the same
+// vertex buffer. Vertices on open edges, which includes UV and normal seams,
+// never move. error_out receives the largest collapse error, as a distance.
+std::vector<uint32_t> simplify_indices(const std::vector<glm::vec3>& positions,
+                                       const uint32_t* indices,
+                                       size_t index_count,
+                                       size_t target_index_count,
+                                       float* error_out = nullptr);
+
+// Fills mesh.lods and mesh.lod_indices with a chain of simplified index
+// buffers, each about half the size of the previous one.
+void build_mesh_lods(Mesh& mesh, uint32_t max_lod_count = 8, size_t min_triangle_count = 256);
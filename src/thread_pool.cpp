@@ -0,0 +1,180 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+// Set on worker threads, so submissions from tasks go to the worker's own queue.
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local uint32_t current_worker = 0;
+
+static uint32_t own_queue(const ThreadPool& pool) {
+    return current_pool == &pool ? current_worker : pool.queues.size() - 1;
+}
+
+static bool pop_task(ThreadPool& pool, ThreadPoolTask& task) {
+    uint32_t queue_count = pool.queues.size();
+    uint32_t own = own_queue(pool);
+
+    {
+        ThreadPoolQueue& queue = *pool.queues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            pool.queued--;
+            return true;
+        }
+    }
+
+    for (uint32_t i = 1; i < queue_count; i++) {
+        ThreadPoolQueue& queue = *pool.queues[(own + i) % queue_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            pool.queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void run_task(ThreadPool& pool, ThreadPoolTask& task) {
+    std::exception_ptr error;
+    try {
+        task.run();
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    if (error) {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        std::exception_ptr& slot = task.group ? task.group->error : pool.error;
+        if (!slot) {
+            slot = error;
+        }
+    }
+
+    if (task.group) {
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+    }
+    if (pool.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.work_done.notify_all();
+    }
+}
+
+static void worker_loop(ThreadPool& pool, uint32_t index) {
+    current_pool = &pool;
+    current_worker = index;
+
+    while (true) {
+        ThreadPoolTask task;
+        if (pop_task(pool, task)) {
+            run_task(pool, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.work_available.wait(lock, [&pool]() { return pool.stopping || pool.queued > 0; });
+        if (pool.stopping && pool.queued == 0) {
+            return;
+        }
+    }
+}
+
+void thread_pool_init(ThreadPool& pool, uint32_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    pool.queued = 0;
+    pool.pending = 0;
+    pool.stopping = false;
+    pool.error = nullptr;
+
+    pool.queues.clear();
+    for (uint32_t i = 0; i < thread_count + 1; i++) {
+        pool.queues.emplace_back(new ThreadPoolQueue());
+    }
+
+    pool.workers.reserve(thread_count);
+    for (uint32_t i = 0; i < thread_count; i++) {
+        pool.workers.emplace_back(worker_loop, std::ref(pool), i);
+    }
+}
+
+void thread_pool_finalize(ThreadPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.work_available.notify_all();
+
+    for (std::thread& worker : pool.workers) {
+        worker.join();
+    }
+    pool.workers.clear();
+    pool.queues.clear();
+}
+
+uint32_t thread_pool_size(const ThreadPool& pool) {
+    return pool.workers.size();
+}
+
+static void push_task(ThreadPool& pool, ThreadPoolTask task) {
+    if (task.group) {
+        task.group->pending++;
+    }
+    pool.pending++;
+
+    {
+        ThreadPoolQueue& queue = *pool.queues[own_queue(pool)];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        pool.queued++;
+    }
+
+    // Taking the lock orders the push before a sleeping worker's next check.
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+    }
+    pool.work_available.notify_one();
+}
+
+void thread_pool_submit(ThreadPool& pool, std::function<void()> task) {
+    push_task(pool, {std::move(task), nullptr});
+}
+
+void thread_pool_submit(ThreadPool& pool, TaskGroup& group, std::function<void()> task) {
+    push_task(pool, {std::move(task), &group});
+}
+
+void thread_pool_wait(ThreadPool& pool) {
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.work_done.wait(lock, [&pool]() { return pool.pending == 0; });
+
+    if (pool.error) {
+        std::exception_ptr error = pool.error;
+        pool.error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void thread_pool_wait(ThreadPool& pool, TaskGroup& group) {
+    while (group.pending.load(std::memory_order_acquire) > 0) {
+        ThreadPoolTask task;
+        if (pop_task(pool, task)) {
+            run_task(pool, task);
+        } else {
+            // The remaining tasks of the group are running on other threads.
+            std::this_thread::yield();
+        }
+    }
+
+    if (group.error) {
+        std::exception_ptr error = group.error;
+        group.error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
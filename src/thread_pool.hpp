@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks whose completion can be awaited separately from the rest of the pool.
+struct TaskGroup {
+    std::atomic<size_t> pending{0};
+    // First exception thrown by a task of the group, rethrown by thread_pool_wait.
+    std::exception_ptr error;
+};
+
+struct ThreadPoolTask {
+    std::function<void()> run;
+    TaskGroup* group;
+};
+
+struct ThreadPoolQueue {
+    std::mutex mutex;
+    std::deque<ThreadPoolTask> tasks;
+};
+
+// Work stealing pool. Each worker pushes and pops the back of its own queue,
+// and steals from the front of the others when it runs dry. Tasks submitted
+// from outside the pool go to one extra shared queue.
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    // workers.size() + 1 queues, the last one being the shared one.
+    std::vector<std::unique_ptr<ThreadPoolQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+
+    // Tasks sitting in a queue, and tasks not finished yet.
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+    bool stopping;
+
+    // First exception thrown by a task outside any group, rethrown by thread_pool_wait.
+    std::exception_ptr error;
+};
+
+// A thread_count of 0 uses one worker per hardware thread.
+void thread_pool_init(ThreadPool& pool, uint32_t thread_count = 0);
+void thread_pool_finalize(ThreadPool& pool);
+
+uint32_t thread_pool_size(const ThreadPool& pool);
+
+void thread_pool_submit(ThreadPool& pool, std::function<void()> task);
+void thread_pool_submit(ThreadPool& pool, TaskGroup& group, std::function<void()> task);
+
+// Blocks until every submitted task has run. Must not be called from a task.
+void thread_pool_wait(ThreadPool& pool);
+
+// Runs queued tasks until every task of the group has run. Can be called
+// from a task, so tasks may fork and join subtasks.
+void thread_pool_wait(ThreadPool& pool, TaskGroup& group);
+
+// Runs f(i) for i in [0, count) on the pool and waits for completion.
+template<typename F>
+void parallel_for(ThreadPool& pool, size_t count, F f) {
+    TaskGroup group;
+    for (size_t i = 0; i < count; i++) {
+        thread_pool_submit(pool, group, [&f, i]() { f(i); });
+    }
+    thread_pool_wait(pool, group);
+}
@@ -0,0 +1,288 @@
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static uint32_t buddy_order(VkDeviceSize size) {
+    uint32_t order = 0;
+    while ((GPU_MEMORY_MIN_ALLOCATION << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+static void free_list_insert(GPUMemoryBlock& block, uint32_t order, VkDeviceSize offset) {
+    block.free_lists[order].insert(offset);
+    block.free_orders |= 1u << order;
+}
+
+static void free_list_erase(GPUMemoryBlock& block, uint32_t order, std::set<VkDeviceSize>::iterator it) {
+    block.free_lists[order].erase(it);
+    if (block.free_lists[order].empty()) {
+        block.free_orders &= ~(1u << order);
+    }
+}
+
+// Takes the lowest free buddy of the smallest order that fits, splitting it
+// down to order. Returns false if the block has nothing big enough.
+static bool buddy_allocate(GPUMemoryBlock& block, uint32_t order, VkDeviceSize* offset_out) {
+    uint32_t available = block.free_orders >> order;
+    if (available == 0) {
+        return false;
+    }
+    uint32_t found = order + __builtin_ctz(available);
+
+    VkDeviceSize offset = *block.free_lists[found].begin();
+    free_list_erase(block, found, block.free_lists[found].begin());
+
+    while (found > order) {
+        found--;
+        free_list_insert(block, found, offset + (GPU_MEMORY_MIN_ALLOCATION << found));
+    }
+
+    *offset_out = offset;
+    return true;
+}
+
+static void buddy_free(GPUMemoryBlock& block, uint32_t order, VkDeviceSize offset) {
+    while (order + 1 < block.free_lists.size()) {
+        VkDeviceSize buddy = offset ^ (GPU_MEMORY_MIN_ALLOCATION << order);
+        auto it = block.free_lists[order].find(buddy);
+        if (it == block.free_lists[order].end()) {
+            break;
+        }
+        free_list_erase(block, order, it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    free_list_insert(block, order, offset);
+}
+
+// Frees [offset, end) as the largest aligned buddies that tile it.
+static void buddy_free_range(GPUMemoryBlock& block, VkDeviceSize offset, VkDeviceSize end) {
+    uint32_t top_order = block.free_lists.size() - 1;
+    while (offset < end) {
+        uint32_t order = 0;
+        while (order < top_order) {
+            VkDeviceSize next_size = GPU_MEMORY_MIN_ALLOCATION << (order + 1);
+            if (offset % next_size != 0 || offset + next_size > end) {
+                break;
+            }
+            order++;
+        }
+        buddy_free(block, order, offset);
+        offset += GPU_MEMORY_MIN_ALLOCATION << order;
+    }
+}
+
+static VkDeviceSize round_to_min_allocation(VkDeviceSize size) {
+    return (size + GPU_MEMORY_MIN_ALLOCATION - 1) / GPU_MEMORY_MIN_ALLOCATION * GPU_MEMORY_MIN_ALLOCATION;
+}
+
+static GPUMemoryBlock* allocate_block(GPUAllocator& allocator,
+                                      uint32_t memory_type,
+                                      VkDeviceSize size,
+                                      bool linear,
+                                      bool dedicated) {
+    VkMemoryAllocateInfo memory_ai{};
+    memory_ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_ai.allocationSize = size;
+    memory_ai.memoryTypeIndex = memory_type;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(allocator.device, &memory_ai, nullptr, &memory) != VK_SUCCESS) {
+        return nullptr;
+    }
+
+    allocator.blocks.emplace_back(new GPUMemoryBlock());
+    GPUMemoryBlock* block = allocator.blocks.back().get();
+    block->memory = memory;
+    block->size = size;
+    block->memory_type = memory_type;
+    block->properties = allocator.memory_properties.memoryTypes[memory_type].propertyFlags;
+    block->linear = linear;
+    block->dedicated = dedicated;
+    block->free_orders = 0;
+    block->used = 0;
+    block->mapped = nullptr;
+    if (block->properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void* mapped;
+        if (vkMapMemory(allocator.device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+            throw std::runtime_error("Could not map device memory.");
+        }
+        block->mapped = static_cast<char*>(mapped);
+    }
+
+    if (!dedicated) {
+        uint32_t top_order = buddy_order(size);
+        block->free_lists.resize(top_order + 1);
+        free_list_insert(*block, top_order, 0);
+    }
+
+    return block;
+}
+
+static void release_block(GPUAllocator& allocator, GPUMemoryBlock* block) {
+    vkFreeMemory(allocator.device, block->memory, nullptr);
+
+    for (size_t i = 0; i < allocator.blocks.size(); i++) {
+        if (allocator.blocks[i].get() == block) {
+            allocator.blocks[i] = std::move(allocator.blocks.back());
+            allocator.blocks.pop_back();
+            break;
+        }
+    }
+}
+
+void gpu_allocator_init(VkDevice device, VkPhysicalDevice physical_device, GPUAllocator& allocator) {
+    allocator.device = device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator.memory_properties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    allocator.non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+}
+
+void gpu_allocator_finalize(GPUAllocator& allocator) {
+    for (std::unique_ptr<GPUMemoryBlock>& block : allocator.blocks) {
+        vkFreeMemory(allocator.device, block->memory, nullptr);
+    }
+    allocator.blocks.clear();
+}
+
+// Sub-allocates from the blocks of one memory type, adding a block if they
+// are all full. Returns false if the heap has no room for another block.
+static bool allocate_from_type(GPUAllocator& allocator,
+                               uint32_t memory_type,
+                               const VkMemoryRequirements& requirements,
+                               bool linear,
+                               GPUAllocation& allocation) {
+    allocation.size = requirements.size;
+
+    // Buddies are aligned to their own size, which covers the alignment as
+    // long as they are at least that big.
+    VkDeviceSize buddy_size = std::max(requirements.size, requirements.alignment);
+    if (buddy_size > GPU_MEMORY_BLOCK_SIZE) {
+        allocation.block = allocate_block(allocator, memory_type, requirements.size, linear, true);
+        if (!allocation.block) {
+            return false;
+        }
+        allocation.offset = 0;
+        allocation.block->used = requirements.size;
+        return true;
+    }
+
+    uint32_t order = buddy_order(buddy_size);
+    allocation.block = nullptr;
+    for (std::unique_ptr<GPUMemoryBlock>& block : allocator.blocks) {
+        if (block->dedicated || block->memory_type != memory_type || block->linear != linear) {
+            continue;
+        }
+        if (buddy_allocate(*block, order, &allocation.offset)) {
+            allocation.block = block.get();
+            break;
+        }
+    }
+    if (!allocation.block) {
+        allocation.block = allocate_block(allocator, memory_type, GPU_MEMORY_BLOCK_SIZE, linear, false);
+        if (!allocation.block) {
+            return false;
+        }
+        buddy_allocate(*allocation.block, order, &allocation.offset);
+    }
+
+    VkDeviceSize used_end = allocation.offset + round_to_min_allocation(requirements.size);
+    buddy_free_range(*allocation.block, used_end, allocation.offset + (GPU_MEMORY_MIN_ALLOCATION << order));
+    allocation.block->used += round_to_min_allocation(requirements.size);
+
+    return true;
+}
+
+GPUAllocation gpu_memory_allocate(GPUAllocator& allocator,
+                                  const VkMemoryRequirements& requirements,
+                                  VkMemoryPropertyFlags required,
+                                  VkMemoryPropertyFlags preferred,
+                                  bool linear) {
+    std::lock_guard<std::mutex> lock(allocator.mutex);
+
+    // Types with the preferred properties first, then the others.
+    GPUAllocation allocation;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < allocator.memory_properties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags properties = allocator.memory_properties.memoryTypes[i].propertyFlags;
+            bool has_preferred = (properties & preferred) == preferred;
+            if (!(requirements.memoryTypeBits & (1u << i))
+                || (properties & required) != required
+                || has_preferred != (pass == 0)) {
+                continue;
+            }
+            if (allocate_from_type(allocator, i, requirements, linear, allocation)) {
+                return allocation;
+            }
+        }
+    }
+
+    throw std::runtime_error("Could not allocate device memory.");
+}
+
+void gpu_memory_free(GPUAllocator& allocator, GPUAllocation& allocation) {
+    std::lock_guard<std::mutex> lock(allocator.mutex);
+
+    GPUMemoryBlock* block = allocation.block;
+    if (block->dedicated) {
+        release_block(allocator, block);
+    } else {
+        VkDeviceSize used_size = round_to_min_allocation(allocation.size);
+        buddy_free_range(*block, allocation.offset, allocation.offset + used_size);
+        block->used -= used_size;
+    }
+
+    allocation.block = nullptr;
+}
+
+char* gpu_memory_mapped(const GPUAllocation& allocation) {
+    char* mapped = allocation.block->mapped;
+    return mapped ? mapped + allocation.offset : nullptr;
+}
+
+// The range widened to whole atoms, as non coherent memory requires. It may
+// spill into neighbouring allocations, which is harmless.
+static VkMappedMemoryRange atom_range(const GPUAllocator& allocator,
+                                      const GPUAllocation& allocation,
+                                      VkDeviceSize offset,
+                                      VkDeviceSize size) {
+    VkDeviceSize atom = allocator.non_coherent_atom_size;
+    VkDeviceSize begin = (allocation.offset + offset) / atom * atom;
+    VkDeviceSize end = (allocation.offset + offset + size + atom - 1) / atom * atom;
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.block->memory;
+    range.offset = begin;
+    range.size = end < allocation.block->size ? end - begin : VK_WHOLE_SIZE;
+    return range;
+}
+
+void gpu_memory_flush(const GPUAllocator& allocator,
+                      const GPUAllocation& allocation,
+                      VkDeviceSize offset,
+                      VkDeviceSize size) {
+    if (size == 0 || (allocation.block->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        return;
+    }
+
+    VkMappedMemoryRange range = atom_range(allocator, allocation, offset, size);
+    vkFlushMappedMemoryRanges(allocator.device, 1, &range);
+}
+
+void gpu_memory_invalidate(const GPUAllocator& allocator,
+                           const GPUAllocation& allocation,
+                           VkDeviceSize offset,
+                           VkDeviceSize size) {
+    if (size == 0 || (allocation.block->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        return;
+    }
+
+    VkMappedMemoryRange range = atom_range(allocator, allocation, offset, size);
+    vkInvalidateMappedMemoryRanges(allocator.device, 1, &range);
+}
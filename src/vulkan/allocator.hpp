@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// Device memory is allocated in blocks of this size and handed out with a
+// buddy scheme, in multiples of GPU_MEMORY_MIN_ALLOCATION. Anything bigger
+// than a block gets a dedicated allocation.
+static const VkDeviceSize GPU_MEMORY_BLOCK_SIZE = VkDeviceSize(64) << 20;
+static const VkDeviceSize GPU_MEMORY_MIN_ALLOCATION = 256;
+
+struct GPUMemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    VkMemoryPropertyFlags properties;
+    // Buffers and optimal tiling images never share a block, so
+    // bufferImageGranularity never applies between neighbours.
+    bool linear;
+    bool dedicated;
+
+    // free_lists[order] holds the offsets of the free buddies of size
+    // GPU_MEMORY_MIN_ALLOCATION << order, and bit order of free_orders is set
+    // when it is not empty. Empty for dedicated blocks.
+    std::vector<std::set<VkDeviceSize>> free_lists;
+    uint32_t free_orders;
+    VkDeviceSize used;
+
+    // Host visible blocks are mapped whole for as long as they exist,
+    // nullptr for the others.
+    char* mapped;
+};
+
+// The buddy an allocation is carved from is aligned to its own size. The
+// part past size, rounded up to GPU_MEMORY_MIN_ALLOCATION, is given back
+// right away as smaller buddies, so rounding wastes at most
+// GPU_MEMORY_MIN_ALLOCATION per allocation.
+struct GPUAllocation {
+    GPUMemoryBlock* block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+struct GPUAllocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize non_coherent_atom_size;
+
+    // Empty blocks are kept for reuse until gpu_allocator_finalize, dedicated
+    // ones are released with their allocation.
+    std::vector<std::unique_ptr<GPUMemoryBlock>> blocks;
+    std::mutex mutex;
+};
+
+void gpu_allocator_init(VkDevice device, VkPhysicalDevice physical_device, GPUAllocator& allocator);
+void gpu_allocator_finalize(GPUAllocator& allocator);
+
+// Allocates from a memory type allowed by requirements and having at least
+// the required properties. Types that also have the preferred ones are
+// tried first, and are skipped if their heap is full. linear is true for
+// buffers and linear images, false for optimal tiling images.
+GPUAllocation gpu_memory_allocate(GPUAllocator& allocator,
+                                  const VkMemoryRequirements& requirements,
+                                  VkMemoryPropertyFlags required,
+                                  VkMemoryPropertyFlags preferred,
+                                  bool linear);
+void gpu_memory_free(GPUAllocator& allocator, GPUAllocation& allocation);
+
+// Host pointer to the start of the allocation, nullptr if it is not host
+// visible.
+char* gpu_memory_mapped(const GPUAllocation& allocation);
+
+// Make host writes to size bytes at offset in the allocation visible to the
+// device, and device writes visible to the host. They do nothing on
+// coherent memory.
+void gpu_memory_flush(const GPUAllocator& allocator,
+                      const GPUAllocation& allocation,
+                      VkDeviceSize offset,
+                      VkDeviceSize size);
+void gpu_memory_invalidate(const GPUAllocator& allocator,
+                           const GPUAllocation& allocation,
+                           VkDeviceSize offset,
+                           VkDeviceSize size);
@@ -15,3 +15,96 @@ void compute_init(const VulkanContext* vk, VulkanComputeContext& ctx) {
 void compute_finalize(const VulkanComputeContext& ctx) {
     vkDestroyCommandPool(ctx.vk->device, ctx.command_pool, nullptr);
 }
+
+void compute_batch_begin(const VulkanComputeContext& ctx, VulkanComputeBatch& batch) {
+    VkCommandBufferAllocateInfo command_buffer_ai{};
+    command_buffer_ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_ai.commandPool = ctx.command_pool;
+    command_buffer_ai.commandBufferCount = 1;
+    command_buffer_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    if (vkAllocateCommandBuffers(ctx.vk->device, &command_buffer_ai, &batch.command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Could not allocate compute command buffer.");
+    }
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    
+    vkBeginCommandBuffer(batch.command_buffer, &begin_info);
+
+    batch.dispatch_count = 0;
+    batch.descriptor_sets.clear();
+}
+
+void compute_batch_barrier(VulkanComputeBatch& batch) {
+    if (batch.dispatch_count == 0) {
+        return;
+    }
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(batch.command_buffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+}
+
+void compute_batch_submit(const VulkanComputeContext& ctx, VulkanComputeBatch& batch) {
+    // Results are read through persistently mapped pointers once the fence
+    // is signaled.
+    VkMemoryBarrier host_barrier{};
+    host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(batch.command_buffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1, &host_barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    vkEndCommandBuffer(batch.command_buffer);
+
+    // Uploads are submitted to the graphics queue, a separate compute queue
+    // has to wait for them.
+    staging_flush(*ctx.vk, *ctx.vk->transfer);
+    staging_flush(*ctx.vk, *ctx.vk->staging, ctx.vk->compute_queue_idx != ctx.vk->graphics_queue_idx);
+
+    std::vector<VkSemaphore> wait_semaphores;
+    staging_collect_waits(*ctx.vk, *ctx.vk->transfer, STAGING_CONSUMER_COMPUTE, wait_semaphores);
+    std::vector<VkPipelineStageFlags> wait_stage_masks(wait_semaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+    VkQueue queue;
+    vkGetDeviceQueue(ctx.vk->device, ctx.vk->compute_queue_idx, 0, &queue);
+
+    VkFence submit_done;
+    VkFenceCreateInfo submit_done_ci{};
+    submit_done_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    vkCreateFence(ctx.vk->device, &submit_done_ci, nullptr, &submit_done);
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    submit_info.waitSemaphoreCount = wait_semaphores.size();
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stage_masks.data();
+    
+    vkQueueSubmit(queue, 1, &submit_info, submit_done);
+
+    vkWaitForFences(ctx.vk->device, 1, &submit_done, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(ctx.vk->device, submit_done, nullptr);
+
+    for (const std::pair<VkDescriptorPool, VkDescriptorSet>& set : batch.descriptor_sets) {
+        vkFreeDescriptorSets(ctx.vk->device, set.first, 1, &set.second);
+    }
+    batch.descriptor_sets.clear();
+    vkFreeCommandBuffers(ctx.vk->device, ctx.command_pool, 1, &batch.command_buffer);
+}
@@ -1,9 +1,13 @@
 #pragma once
 
 // #include "../render.hpp"
+#include "frame_ring.hpp"
 #include "gpu.hpp"
+#include "staging.hpp"
 
 #include <iostream>
+#include <utility>
+#include <vector>
 
 struct VulkanComputeContext {
     const VulkanContext* vk;
@@ -11,6 +15,20 @@ struct VulkanComputeContext {
     VkCommandPool command_pool;
 };
 
+// Descriptor sets a kernel can have in flight, that is how many times it can
+// be dispatched within one VulkanComputeBatch.
+static const uint32_t COMPUTE_KERNEL_MAX_SETS = 8;
+
+// Dispatches recorded into a single command buffer and submitted at once.
+// Each dispatch waits for the writes of the ones before it.
+struct VulkanComputeBatch {
+    VkCommandBuffer command_buffer;
+    uint32_t dispatch_count;
+
+    // Freed once the submission is done.
+    std::vector<std::pair<VkDescriptorPool, VkDescriptorSet>> descriptor_sets;
+};
+
 template<typename... Args>
 struct VulkanComputeKernel {
     VkPipelineLayout pipeline_layout;
@@ -34,6 +52,11 @@ struct DescriptorType<VulkanBuffer<T>> {
     static const VkDescriptorType value = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 };
 
+template<typename T>
+struct DescriptorType<VulkanBufferSlice<T>> {
+    static const VkDescriptorType value = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+};
+
 
 template<typename Arg0>
 void setup_bindings_base(VkDescriptorSetLayoutBinding* bindings, uint32_t idx) {
@@ -129,10 +152,13 @@ VulkanComputeKernel<Args...> compute_kernel_create(const VulkanComputeContext& c
 
     std::vector<VkDescriptorPoolSize> sizes;
     setup_sizes<Args...>(sizes);
+    for (VkDescriptorPoolSize& size : sizes) {
+        size.descriptorCount *= COMPUTE_KERNEL_MAX_SETS;
+    }
         
     VkDescriptorPoolCreateInfo descriptor_pool_ci{};
     descriptor_pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptor_pool_ci.maxSets = 1;
+    descriptor_pool_ci.maxSets = COMPUTE_KERNEL_MAX_SETS;
     descriptor_pool_ci.poolSizeCount = sizes.size();
     descriptor_pool_ci.pPoolSizes = sizes.data();
     descriptor_pool_ci.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
@@ -189,6 +215,30 @@ struct UpdateDescriptorSet<VulkanBuffer<T>> {
     }
 };
 
+template<typename T>
+struct UpdateDescriptorSet<VulkanBufferSlice<T>> {
+    static void f(const VulkanComputeContext& ctx,
+                  VkDescriptorSet set,
+                  uint32_t binding,
+                  VulkanBufferSlice<T> slice) {
+        
+        VkDescriptorBufferInfo buffer_info{};
+        buffer_info.buffer = slice.handle;
+        buffer_info.offset = slice.offset;
+        buffer_info.range = sizeof(T) * slice.count;
+    
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.pBufferInfo = &buffer_info;
+        write.dstSet = set;
+        write.dstBinding = binding;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        
+        vkUpdateDescriptorSets(ctx.vk->device, 1, &write, 0, nullptr);
+    }
+};
+
 template<typename... Args>
 void update_descriptor_set(const VulkanComputeContext& ctx,
                            VkDescriptorSet set,
@@ -199,25 +249,23 @@ void update_descriptor_set(const VulkanComputeContext& ctx,
     dummy{ (UpdateDescriptorSet<Args>::f(ctx, set, binding++, args), 0)... };
 }
 
-template<typename... Args>
-void compute_kernel_invoke(const VulkanComputeContext& ctx,
-                           const VulkanComputeKernel<Args...>& kernel,
-                           uint32_t group_count_x,
-                           uint32_t group_count_y,
-                           uint32_t group_count_z,
-                           Args... args) {
-    VkCommandBufferAllocateInfo command_buffer_ai{};
-    command_buffer_ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    command_buffer_ai.commandPool = ctx.command_pool;
-    command_buffer_ai.commandBufferCount = 1;
-    command_buffer_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+void compute_batch_begin(const VulkanComputeContext& ctx, VulkanComputeBatch& batch);
 
-    VkCommandBuffer command_buffer;
+// Makes the next dispatch of batch wait for the previous ones.
+void compute_batch_barrier(VulkanComputeBatch& batch);
 
-    if (vkAllocateCommandBuffers(ctx.vk->device, &command_buffer_ai, &command_buffer) != VK_SUCCESS) {
-        throw std::runtime_error("Could not allocate compute command buffer.");
-    }
+// Submits batch after the pending uploads and waits for it, its results can
+// be read from the host afterwards.
+void compute_batch_submit(const VulkanComputeContext& ctx, VulkanComputeBatch& batch);
 
+template<typename... Args>
+void compute_batch_dispatch(const VulkanComputeContext& ctx,
+                            VulkanComputeBatch& batch,
+                            const VulkanComputeKernel<Args...>& kernel,
+                            uint32_t group_count_x,
+                            uint32_t group_count_y,
+                            uint32_t group_count_z,
+                            Args... args) {
     VkDescriptorSet descriptor_set;
     VkDescriptorSetAllocateInfo descriptor_set_ai{};
     descriptor_set_ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -228,18 +276,15 @@ void compute_kernel_invoke(const VulkanComputeContext& ctx,
     if (vkAllocateDescriptorSets(ctx.vk->device, &descriptor_set_ai, &descriptor_set) != VK_SUCCESS) {
         throw std::runtime_error("Could not allocate compute descriptor set.");
     }
+    batch.descriptor_sets.push_back({kernel.descriptor_pool, descriptor_set});
 
     update_descriptor_set(ctx, descriptor_set, args...);
 
-    
-    VkCommandBufferBeginInfo begin_info{};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    
-    vkBeginCommandBuffer(command_buffer, &begin_info);
+    compute_batch_barrier(batch);
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+    vkCmdBindPipeline(batch.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
 
-    vkCmdBindDescriptorSets(command_buffer,
+    vkCmdBindDescriptorSets(batch.command_buffer,
                             VK_PIPELINE_BIND_POINT_COMPUTE,
                             kernel.pipeline_layout,
                             0,
@@ -248,30 +293,21 @@ void compute_kernel_invoke(const VulkanComputeContext& ctx,
                             0,
                             nullptr);
     
-    vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
-
-    vkEndCommandBuffer(command_buffer);
-
-    VkQueue queue;
-    vkGetDeviceQueue(ctx.vk->device, ctx.vk->compute_queue_idx, 0, &queue);
-
-    VkFence submit_done;
-    VkFenceCreateInfo submit_done_ci{};
-    submit_done_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    vkCreateFence(ctx.vk->device, &submit_done_ci, nullptr, &submit_done);
-
-    VkSubmitInfo submit_info{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-    
-    vkQueueSubmit(queue, 1, &submit_info, submit_done);
-
-    vkWaitForFences(ctx.vk->device, 1, &submit_done, VK_TRUE, UINT64_MAX);
-    vkDestroyFence(ctx.vk->device, submit_done, nullptr);
+    vkCmdDispatch(batch.command_buffer, group_count_x, group_count_y, group_count_z);
+    batch.dispatch_count++;
+}
 
-    vkFreeDescriptorSets(ctx.vk->device, kernel.descriptor_pool, 1, &descriptor_set);
-    vkFreeCommandBuffers(ctx.vk->device, ctx.command_pool, 1, &command_buffer);
+template<typename... Args>
+void compute_kernel_invoke(const VulkanComputeContext& ctx,
+                           const VulkanComputeKernel<Args...>& kernel,
+                           uint32_t group_count_x,
+                           uint32_t group_count_y,
+                           uint32_t group_count_z,
+                           Args... args) {
+    VulkanComputeBatch batch;
+    compute_batch_begin(ctx, batch);
+    compute_batch_dispatch(ctx, batch, kernel, group_count_x, group_count_y, group_count_z, args...);
+    compute_batch_submit(ctx, batch);
 }
 
 void compute_init(const VulkanContext* vk, VulkanComputeContext &ctx);
@@ -0,0 +1,40 @@
+#include "frame_ring.hpp"
+
+#include <algorithm>
+
+void frame_ring_init(const VulkanContext& vk, uint32_t slice_count, FrameRing& ring) {
+    ring.buffer = gpu_buffer_allocate<char>(vk,
+                                            GRAPHICS | COMPUTE | STORAGE_BUFFER | UNIFORM_BUFFER | HOST_ACCESS,
+                                            slice_count * FRAME_RING_SLICE_SIZE);
+    ring.slice_count = slice_count;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk.physical_device, &properties);
+    ring.alignment = std::max({properties.limits.minStorageBufferOffsetAlignment,
+                               properties.limits.minUniformBufferOffsetAlignment,
+                               properties.limits.nonCoherentAtomSize,
+                               VkDeviceSize(16)});
+
+    ring.current = 0;
+    ring.head = 0;
+}
+
+void frame_ring_finalize(const VulkanContext& vk, FrameRing& ring) {
+    gpu_buffer_free(vk, ring.buffer);
+}
+
+void frame_ring_begin(FrameRing& ring, uint32_t slice) {
+    ring.current = slice;
+    ring.head = 0;
+}
+
+VkDeviceSize frame_ring_reserve(FrameRing& ring, VkDeviceSize size) {
+    VkDeviceSize aligned_size = (size + ring.alignment - 1) / ring.alignment * ring.alignment;
+    if (ring.head + aligned_size > FRAME_RING_SLICE_SIZE) {
+        throw std::runtime_error("Frame ring slice is full.");
+    }
+
+    VkDeviceSize offset = ring.current * FRAME_RING_SLICE_SIZE + ring.head;
+    ring.head += aligned_size;
+    return offset;
+}
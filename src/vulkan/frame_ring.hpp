@@ -0,0 +1,60 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <cstring>
+
+// Host visible buffer split in one slice per frame in flight, handing out
+// ranges for small data rewritten every frame. begin_frame empties the
+// slice of the frame it begins once the frame_finished fence of that slot
+// has signaled, so ranges must be consumed by the frame's own submission or
+// by work waited on before the next frame begins, like
+// compute_kernel_invoke.
+static const VkDeviceSize FRAME_RING_SLICE_SIZE = VkDeviceSize(1) << 20;
+
+// count elements of buffer, starting offset bytes in.
+template<typename T>
+struct VulkanBufferSlice {
+    VkBuffer handle;
+    VkDeviceSize offset;
+    size_t count;
+    T* mapped;
+};
+
+// Used only from the thread driving the frame loop.
+struct FrameRing {
+    VulkanBuffer<char> buffer;
+    uint32_t slice_count;
+    // Ranges start at multiples of this, which suits storage and uniform
+    // buffer offsets and non coherent flushes.
+    VkDeviceSize alignment;
+
+    uint32_t current;
+    VkDeviceSize head;
+};
+
+void frame_ring_init(const VulkanContext& vk, uint32_t slice_count, FrameRing& ring);
+void frame_ring_finalize(const VulkanContext& vk, FrameRing& ring);
+
+// Empties slice and allocates from it from now on. The work that used it
+// must be done.
+void frame_ring_begin(FrameRing& ring, uint32_t slice);
+
+// Offset of size free bytes in the buffer, throws when the slice is full.
+VkDeviceSize frame_ring_reserve(FrameRing& ring, VkDeviceSize size);
+
+template<typename T>
+VulkanBufferSlice<T> frame_ring_upload(const VulkanContext& vk, FrameRing& ring, const T* data, size_t count) {
+    VkDeviceSize offset = frame_ring_reserve(ring, count * sizeof(T));
+
+    VulkanBufferSlice<T> slice;
+    slice.handle = ring.buffer.handle;
+    slice.offset = offset;
+    slice.count = count;
+    slice.mapped = reinterpret_cast<T*>(ring.buffer.mapped + offset);
+
+    memcpy(slice.mapped, data, count * sizeof(T));
+    gpu_buffer_flush(vk, ring.buffer, offset, count * sizeof(T));
+
+    return slice;
+}
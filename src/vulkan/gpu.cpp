@@ -1,10 +1,28 @@
 #include "gpu.hpp"
+#include "staging.hpp"
 
 #include <cstring>
+#include <iostream>
 
-#include "../memory_util.hpp"
+// Headless contexts take the best device available, down to software ones.
+static int device_type_rank(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        return 4;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        return 3;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void gpu_init(VulkanContext& ctx, uint32_t flags) {
+    bool headless = flags & GPU_INIT_HEADLESS;
 
-void gpu_init(VulkanContext& ctx) {
     uint32_t layer_count;
     vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
 
@@ -15,6 +33,9 @@ void gpu_init(VulkanContext& ctx) {
         "VK_LAYER_KHRONOS_validation"
     };
 
+    // Headless runs go on machines without the SDK, validation is only
+    // enabled there if it is installed.
+    std::vector<const char*> enabled_layers;
     for (const char* name : required_layers) {
         bool found = false;
         for (const auto& prop : layer_properties) {
@@ -23,7 +44,11 @@ void gpu_init(VulkanContext& ctx) {
                 break;
             }
         }
-        if (!found) {
+        if (found) {
+            enabled_layers.push_back(name);
+        } else if (headless) {
+            std::cerr << "Warning : layer " << name << " not found, running without it.\n";
+        } else {
             throw std::runtime_error("Could not find required layer " + std::string(name) + ".");
         }
     }
@@ -34,10 +59,11 @@ void gpu_init(VulkanContext& ctx) {
     std::vector<VkExtensionProperties> extension_properties(extension_count);
     vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extension_properties.data());
 
-    std::vector<const char*> required_extensions = {
-        "VK_KHR_surface",
-        "VK_KHR_xlib_surface",
-    };
+    std::vector<const char*> required_extensions;
+    if (!headless) {
+        required_extensions.push_back("VK_KHR_surface");
+        required_extensions.push_back("VK_KHR_xlib_surface");
+    }
 
     for (const char* name : required_extensions) {
         bool found = false;
@@ -58,8 +84,8 @@ void gpu_init(VulkanContext& ctx) {
 
     VkInstanceCreateInfo instance_ci{};
     instance_ci.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instance_ci.enabledLayerCount = required_layers.size();
-    instance_ci.ppEnabledLayerNames = required_layers.data();
+    instance_ci.enabledLayerCount = enabled_layers.size();
+    instance_ci.ppEnabledLayerNames = enabled_layers.data();
     instance_ci.enabledExtensionCount = required_extensions.size();
     instance_ci.ppEnabledExtensionNames = required_extensions.data();
     instance_ci.pApplicationInfo = &app_info;
@@ -75,12 +101,15 @@ void gpu_init(VulkanContext& ctx) {
     vkEnumeratePhysicalDevices(ctx.instance, &physical_device_count, physical_devices.data());
 
     std::vector<const char*> required_device_extensions = {
-        "VK_KHR_swapchain",
         "VK_KHR_maintenance1",
         "VK_KHR_shader_non_semantic_info",
     };
+    if (!headless) {
+        required_device_extensions.push_back("VK_KHR_swapchain");
+    }
     
     ctx.physical_device = VK_NULL_HANDLE;
+    int best_rank = 0;
     for (const auto& candidate : physical_devices) {
         uint32_t device_extension_count;
         vkEnumerateDeviceExtensionProperties(candidate, nullptr, &device_extension_count, nullptr);
@@ -109,7 +138,13 @@ void gpu_init(VulkanContext& ctx) {
         VkPhysicalDeviceProperties properties;
         vkGetPhysicalDeviceProperties(candidate, &properties);
 
-        if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+        if (headless) {
+            int rank = device_type_rank(properties.deviceType);
+            if (ctx.physical_device == VK_NULL_HANDLE || rank > best_rank) {
+                ctx.physical_device = candidate;
+                best_rank = rank;
+            }
+        } else if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
             ctx.physical_device = candidate;
             break;
         }
@@ -126,6 +161,7 @@ void gpu_init(VulkanContext& ctx) {
 
     int graphics_idx = -1;
     int compute_idx = -1;
+    int transfer_idx = -1;
     for (int i = 0; i < families.size(); i++) {
         if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             graphics_idx = i;
@@ -133,6 +169,12 @@ void gpu_init(VulkanContext& ctx) {
         if (families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
             compute_idx = i;
         }
+        // Copy engines run next to rendering, their families have neither
+        // graphics nor compute.
+        if ((families[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
+            && !(families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transfer_idx = i;
+        }
     }
 
     if (graphics_idx < 0) {
@@ -143,6 +185,7 @@ void gpu_init(VulkanContext& ctx) {
     }
     ctx.graphics_queue_idx = graphics_idx;
     ctx.compute_queue_idx = compute_idx;
+    ctx.transfer_queue_idx = transfer_idx < 0 ? graphics_idx : transfer_idx;
 
     float priority = 1.0f;
     VkDeviceQueueCreateInfo graphics_queue_ci{};
@@ -157,11 +200,27 @@ void gpu_init(VulkanContext& ctx) {
     compute_queue_ci.queueCount = 1;
     compute_queue_ci.pQueuePriorities = &priority;
 
-    VkDeviceQueueCreateInfo queue_cis[] = {graphics_queue_ci, compute_queue_ci};
+    VkDeviceQueueCreateInfo transfer_queue_ci{};
+    transfer_queue_ci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    transfer_queue_ci.queueFamilyIndex = ctx.transfer_queue_idx;
+    transfer_queue_ci.queueCount = 1;
+    transfer_queue_ci.pQueuePriorities = &priority;
+
+    // Software devices usually expose a single family for everything, which
+    // may only be requested once.
+    VkDeviceQueueCreateInfo queue_cis[3];
+    uint32_t queue_ci_count = 0;
+    queue_cis[queue_ci_count++] = graphics_queue_ci;
+    if (compute_idx != graphics_idx) {
+        queue_cis[queue_ci_count++] = compute_queue_ci;
+    }
+    if (transfer_idx >= 0) {
+        queue_cis[queue_ci_count++] = transfer_queue_ci;
+    }
 
     VkDeviceCreateInfo device_ci{};
     device_ci.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_ci.queueCreateInfoCount = ARRAY_SIZE(queue_cis);
+    device_ci.queueCreateInfoCount = queue_ci_count;
     device_ci.pQueueCreateInfos = queue_cis;
     device_ci.ppEnabledExtensionNames = required_device_extensions.data();
     device_ci.enabledExtensionCount = required_device_extensions.size();
@@ -169,9 +228,36 @@ void gpu_init(VulkanContext& ctx) {
     if (vkCreateDevice(ctx.physical_device, &device_ci, nullptr, &ctx.device) != VK_SUCCESS) {
         throw std::runtime_error("Could not create Vulkan device.");
     }
+
+    ctx.allocator = new GPUAllocator();
+    gpu_allocator_init(ctx.device, ctx.physical_device, *ctx.allocator);
+
+    ctx.staging = new StagingRing();
+    staging_init(ctx, ctx.graphics_queue_idx, *ctx.staging);
+
+    if (ctx.transfer_queue_idx != ctx.graphics_queue_idx) {
+        ctx.transfer = new StagingRing();
+        staging_init(ctx, ctx.transfer_queue_idx, *ctx.transfer);
+    } else {
+        ctx.transfer = ctx.staging;
+    }
 }
 
 void gpu_finalize(VulkanContext& ctx) {
+    if (ctx.transfer != ctx.staging) {
+        staging_finalize(ctx, *ctx.transfer);
+        delete ctx.transfer;
+    }
+    ctx.transfer = nullptr;
+
+    staging_finalize(ctx, *ctx.staging);
+    delete ctx.staging;
+    ctx.staging = nullptr;
+
+    gpu_allocator_finalize(*ctx.allocator);
+    delete ctx.allocator;
+    ctx.allocator = nullptr;
+
     vkDestroyDevice(ctx.device, nullptr);
     vkDestroyInstance(ctx.instance, nullptr);
 }
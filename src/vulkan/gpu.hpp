@@ -1,24 +1,33 @@
 #pragma once
 
 #include "../common/platform.hpp"
+#include "allocator.hpp"
 #include "internal.hpp"
 
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
 #include <vector>
 #include <stdexcept>
 
+struct StagingRing;
+
 template<typename T>
 struct VulkanBuffer {
     size_t count;
     VkBuffer handle;
-    VkDeviceMemory memory;
+    GPUAllocation allocation;
+    // HOST_ACCESS buffers stay mapped for their whole life, nullptr for the
+    // others, even when their device local memory happens to be host visible
+    // as on UMA or ReBAR devices. Those still go through staging, which keeps
+    // uploads ordered against the device.
+    T* mapped;
 };
 
 struct VulkanImage {
     VkImage handle;
     VkImageView view;
-    VkDeviceMemory memory;
+    GPUAllocation allocation;
 };
 
 struct VulkanContext {
@@ -28,6 +37,16 @@ struct VulkanContext {
 
     uint32_t graphics_queue_idx;
     uint32_t compute_queue_idx;
+    // A transfer only family if the device has one, the graphics family
+    // otherwise.
+    uint32_t transfer_queue_idx;
+
+    // Owned by the context, every buffer and image memory comes from it.
+    GPUAllocator* allocator;
+    // Owned by the context, see staging.hpp. transfer is the same ring as
+    // staging without a dedicated transfer family.
+    StagingRing* staging;
+    StagingRing* transfer;
 };
 
 template<typename T>
@@ -37,6 +56,8 @@ VulkanBuffer<T> gpu_buffer_allocate(const VulkanContext& vk,
     VulkanBuffer<T> buf;
     buf.count = count;
 
+    // Staged copies may come from the transfer family. Sharing the buffer
+    // between the families it is used on saves ownership transfers.
     std::vector<uint32_t> family_indices;
     if (usage & GRAPHICS) {
         family_indices.push_back(vk.graphics_queue_idx);
@@ -44,14 +65,27 @@ VulkanBuffer<T> gpu_buffer_allocate(const VulkanContext& vk,
     if (usage & COMPUTE) {
         family_indices.push_back(vk.compute_queue_idx);
     }
+    if (!(usage & HOST_ACCESS)) {
+        family_indices.push_back(vk.graphics_queue_idx);
+        family_indices.push_back(vk.transfer_queue_idx);
+    }
+    std::sort(family_indices.begin(), family_indices.end());
+    family_indices.erase(std::unique(family_indices.begin(), family_indices.end()), family_indices.end());
 
     VkBufferCreateInfo buffer_ci{};
     buffer_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_ci.size = count * sizeof(T);
     buffer_ci.usage = to_vulkan_flags(usage);
-    buffer_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    buffer_ci.queueFamilyIndexCount = family_indices.size();
-    buffer_ci.pQueueFamilyIndices = family_indices.data();
+    if (!(usage & HOST_ACCESS)) {
+        buffer_ci.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    }
+    if (family_indices.size() > 1) {
+        buffer_ci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_ci.queueFamilyIndexCount = family_indices.size();
+        buffer_ci.pQueueFamilyIndices = family_indices.data();
+    } else {
+        buffer_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
 
     if (vkCreateBuffer(vk.device, &buffer_ci, nullptr, &buf.handle) != VK_SUCCESS) {
         throw std::runtime_error("Could not create buffer.");
@@ -60,51 +94,48 @@ VulkanBuffer<T> gpu_buffer_allocate(const VulkanContext& vk,
     VkMemoryRequirements buffer_memory_requirements;
     vkGetBufferMemoryRequirements(vk.device, buf.handle, &buffer_memory_requirements);
 
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(vk.physical_device, &memory_properties);
-
-    VkMemoryAllocateInfo buffer_memory_ai{};
-    buffer_memory_ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    buffer_memory_ai.allocationSize = buffer_memory_requirements.size;
-    buffer_memory_ai.memoryTypeIndex =
-        find_memory_type(&memory_properties,
-                         buffer_memory_requirements.memoryTypeBits,
-                         (VkMemoryPropertyFlagBits) (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-                                                     | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT));
-    
-    if (vkAllocateMemory(vk.device, &buffer_memory_ai, nullptr, &buf.memory) != VK_SUCCESS) {
-        throw std::runtime_error("Could not allocate buffer memory.");
+    // Host access prefers the device local window when there is one, and
+    // falls back to system memory once it is full.
+    if (usage & HOST_ACCESS) {
+        buf.allocation = gpu_memory_allocate(*vk.allocator,
+                                             buffer_memory_requirements,
+                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                             true);
+    } else {
+        buf.allocation = gpu_memory_allocate(*vk.allocator,
+                                             buffer_memory_requirements,
+                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                             0,
+                                             true);
     }
 
-    vkBindBufferMemory(vk.device, buf.handle, buf.memory, 0);
+    vkBindBufferMemory(vk.device, buf.handle, buf.allocation.block->memory, buf.allocation.offset);
+    buf.mapped = usage & HOST_ACCESS ? reinterpret_cast<T*>(gpu_memory_mapped(buf.allocation)) : nullptr;
 
     return buf;
 }
 
 template <typename T>
-T* gpu_buffer_map(const VulkanContext &ctx, VulkanBuffer<T>& buf, size_t offset, size_t count) {
-    T* ptr;
-
-    if (vkMapMemory(ctx.device, buf.memory, offset * sizeof(T), count * sizeof(T), 0,
-                    reinterpret_cast<void **>(&ptr)) != VK_SUCCESS) {
-        throw std::runtime_error("Could not bind buffer");
-    }
-
-    return ptr;
+bool gpu_buffer_host_visible(const VulkanBuffer<T>& buf) {
+    return buf.mapped != nullptr;
 }
 
+// Host writes through buf.mapped reach the device after a flush, and device
+// writes are only seen by the host after an invalidate. Both do nothing on
+// coherent memory.
 template <typename T>
-T* gpu_buffer_map(const VulkanContext &ctx, VulkanBuffer<T>& buf) {
-    return gpu_buffer_map(ctx, buf, 0, buf.count);
+void gpu_buffer_flush(const VulkanContext& ctx, const VulkanBuffer<T>& buf, size_t offset, size_t count) {
+    gpu_memory_flush(*ctx.allocator, buf.allocation, offset * sizeof(T), count * sizeof(T));
 }
 
 template <typename T>
-void gpu_buffer_unmap(const VulkanContext& ctx, VulkanBuffer<T>& buf) {
-    vkUnmapMemory(ctx.device, buf.memory);
+void gpu_buffer_invalidate(const VulkanContext& ctx, const VulkanBuffer<T>& buf, size_t offset, size_t count) {
+    gpu_memory_invalidate(*ctx.allocator, buf.allocation, offset * sizeof(T), count * sizeof(T));
 }
 
 template <typename T>
 static void gpu_buffer_free(const VulkanContext& ctx, VulkanBuffer<T>& buf) {
-    vkFreeMemory(ctx.device, buf.memory, nullptr);
     vkDestroyBuffer(ctx.device, buf.handle, nullptr);
+    gpu_memory_free(*ctx.allocator, buf.allocation);
 }
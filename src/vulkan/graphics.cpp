@@ -1,8 +1,16 @@
 #include "graphics.hpp"
 
 #include "../platform_wm.hpp"
+#include "../mesh.hpp"
 
-static VulkanImage allocate_image(VkDevice device, VkPhysicalDevice physical_device, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height) {
+#include <cstddef>
+
+static VulkanImage allocate_image(const VulkanContext& vk,
+                                  VkFormat format,
+                                  VkImageUsageFlags usage,
+                                  VkImageAspectFlags aspect,
+                                  uint32_t width,
+                                  uint32_t height) {
     VulkanImage image;
 
     VkImageCreateInfo image_ci{};
@@ -18,28 +26,16 @@ static VulkanImage allocate_image(VkDevice device, VkPhysicalDevice physical_dev
     image_ci.mipLevels = 1;
     image_ci.arrayLayers = 1;
 
-    if (vkCreateImage(device, &image_ci, nullptr, &image.handle) != VK_SUCCESS) {
+    if (vkCreateImage(vk.device, &image_ci, nullptr, &image.handle) != VK_SUCCESS) {
         throw std::runtime_error("Could not create image.");
     }
 
     VkMemoryRequirements image_req;
-    vkGetImageMemoryRequirements(device, image.handle, &image_req);
-
-    VkPhysicalDeviceMemoryProperties props;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &props);
-
-    int32_t image_mem_type = find_memory_type(&props, image_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkGetImageMemoryRequirements(vk.device, image.handle, &image_req);
 
-    VkMemoryAllocateInfo image_memory_ai{};
-    image_memory_ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    image_memory_ai.allocationSize = image_req.size;
-    image_memory_ai.memoryTypeIndex = image_mem_type;
+    image.allocation = gpu_memory_allocate(*vk.allocator, image_req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false);
     
-    if (vkAllocateMemory(device, &image_memory_ai, nullptr, &image.memory) != VK_SUCCESS) {
-        throw std::runtime_error("Could not allocate image memory.");
-    }
-    
-    vkBindImageMemory(device, image.handle, image.memory, 0);
+    vkBindImageMemory(vk.device, image.handle, image.allocation.block->memory, image.allocation.offset);
 
     VkImageViewCreateInfo view_ci{};
     view_ci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -48,57 +44,27 @@ static VulkanImage allocate_image(VkDevice device, VkPhysicalDevice physical_dev
     view_ci.subresourceRange.layerCount = 1;
     view_ci.subresourceRange.baseMipLevel = 0;
     view_ci.subresourceRange.levelCount = 1;
-    view_ci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    view_ci.subresourceRange.aspectMask = aspect;
     view_ci.format = format;
     view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
 
-    if (vkCreateImageView(device, &view_ci, nullptr, &image.view) != VK_SUCCESS) {
+    if (vkCreateImageView(vk.device, &view_ci, nullptr, &image.view) != VK_SUCCESS) {
         throw std::runtime_error("Could not create image view.");
     }
 
     return image;
 }
 
-static void destroy_image(VkDevice device, VulkanImage& image) {
-    vkDestroyImageView(device, image.view, nullptr);
-    vkFreeMemory(device, image.memory, nullptr);
-    vkDestroyImage(device, image.handle, nullptr);
+static void destroy_image(const VulkanContext& vk, VulkanImage& image) {
+    vkDestroyImageView(vk.device, image.view, nullptr);
+    vkDestroyImage(vk.device, image.handle, nullptr);
+    gpu_memory_free(*vk.allocator, image.allocation);
 }
 
-static Swapchain create_swapchain(VkDevice device,
-                                  VkPhysicalDevice physical_device,
-                                  VkSurfaceKHR surface,
-                                  VkSwapchainKHR old_swapchain_handle = VK_NULL_HANDLE) {
-    Swapchain swapchain;
-    
-    // Pick a format
-    uint32_t format_count;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, nullptr);
-
-    std::vector<VkSurfaceFormatKHR> formats(format_count);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, formats.data());
-
-    size_t format_index = 0;
-    for (size_t i = 0; i < formats.size(); i++) {
-        if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            format_index = i;
-        }
-    }
-    swapchain.format = formats[format_index];
-
-    // Find out extent
-    VkSurfaceCapabilitiesKHR surface_capabilities;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
-    swapchain.extent = surface_capabilities.currentExtent;
-    
-    const VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
-    swapchain.depth_image = allocate_image(device,
-                                           physical_device,
-                                           depth_format,
-                                           VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                                           swapchain.extent.width,
-                                           swapchain.extent.height);
-    
+static VkRenderPass create_render_pass(VkDevice device,
+                                       VkFormat color_format,
+                                       VkFormat depth_format,
+                                       VkImageLayout color_final_layout) {
     VkAttachmentReference color_attachment_ref{};
     color_attachment_ref.attachment = 0;
     color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -121,14 +87,14 @@ static Swapchain create_swapchain(VkDevice device,
     
     std::vector<VkAttachmentDescription> attachments;
     VkAttachmentDescription color_attachment{};
-    color_attachment.format = swapchain.format.format;
+    color_attachment.format = color_format;
     color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
     color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.finalLayout = color_final_layout;
 
     attachments.push_back(color_attachment);
 
@@ -151,10 +117,97 @@ static Swapchain create_swapchain(VkDevice device,
     render_pass_ci.subpassCount = subpasses.size();
     render_pass_ci.pSubpasses = subpasses.data();
 
-    if (vkCreateRenderPass(device, &render_pass_ci, nullptr, &swapchain.render_pass) != VK_SUCCESS) {
+    // Every frame in flight shares the depth image, its clear must wait for
+    // the depth tests of the frame submitted before.
+    std::vector<VkSubpassDependency> dependencies;
+    VkSubpassDependency depth_dependency{};
+    depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    depth_dependency.dstSubpass = 0;
+    depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depth_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies.push_back(depth_dependency);
+
+    // Offscreen color images are copied out once the pass is done.
+    if (color_final_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+        VkSubpassDependency transfer_dependency{};
+        transfer_dependency.srcSubpass = 0;
+        transfer_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+        transfer_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        transfer_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        transfer_dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        transfer_dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        dependencies.push_back(transfer_dependency);
+    }
+    render_pass_ci.dependencyCount = dependencies.size();
+    render_pass_ci.pDependencies = dependencies.data();
+
+    VkRenderPass render_pass;
+    if (vkCreateRenderPass(device, &render_pass_ci, nullptr, &render_pass) != VK_SUCCESS) {
         throw std::runtime_error("Could not create render pass");
     }
 
+    return render_pass;
+}
+
+static void create_framebuffers(VkDevice device, Swapchain& swapchain) {
+    swapchain.framebuffers.resize(swapchain.images.size());
+    for (size_t i = 0; i < swapchain.images.size(); i++) {
+        std::vector<VkImageView> fb_attachments = {swapchain.image_views[i], swapchain.depth_image.view};
+        VkFramebufferCreateInfo framebuffer_ci{};
+        framebuffer_ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_ci.width = swapchain.extent.width;
+        framebuffer_ci.height = swapchain.extent.height;
+        framebuffer_ci.attachmentCount = fb_attachments.size();
+        framebuffer_ci.pAttachments = fb_attachments.data();
+        framebuffer_ci.renderPass = swapchain.render_pass;
+        framebuffer_ci.layers = 1;
+    
+        if (vkCreateFramebuffer(device, &framebuffer_ci, nullptr, &swapchain.framebuffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Could not create framebuffer.");
+        }
+    }
+}
+
+static Swapchain create_swapchain(const VulkanContext& vk,
+                                  VkSurfaceKHR surface,
+                                  VkSwapchainKHR old_swapchain_handle = VK_NULL_HANDLE) {
+    VkDevice device = vk.device;
+    VkPhysicalDevice physical_device = vk.physical_device;
+    Swapchain swapchain;
+    
+    // Pick a format
+    uint32_t format_count;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, nullptr);
+
+    std::vector<VkSurfaceFormatKHR> formats(format_count);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, formats.data());
+
+    size_t format_index = 0;
+    for (size_t i = 0; i < formats.size(); i++) {
+        if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            format_index = i;
+        }
+    }
+    swapchain.format = formats[format_index];
+
+    // Find out extent
+    VkSurfaceCapabilitiesKHR surface_capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
+    swapchain.extent = surface_capabilities.currentExtent;
+    
+    const VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
+    swapchain.depth_image = allocate_image(vk,
+                                           depth_format,
+                                           VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                           VK_IMAGE_ASPECT_DEPTH_BIT,
+                                           swapchain.extent.width,
+                                           swapchain.extent.height);
+    
+    swapchain.render_pass = create_render_pass(device, swapchain.format.format, depth_format, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
     uint32_t present_mode_count;
     vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, nullptr);
     std::vector<VkPresentModeKHR> present_modes(present_mode_count);
@@ -235,43 +288,77 @@ static Swapchain create_swapchain(VkDevice device,
 
     swapchain.frames.resize(swapchain_image_count, -1);
 
-    swapchain.framebuffers.resize(swapchain.images.size());
-    for (size_t i = 0; i < swapchain.images.size(); i++) {
-        std::vector<VkImageView> fb_attachments = {swapchain.image_views[i], swapchain.depth_image.view};
-        VkFramebufferCreateInfo framebuffer_ci{};
-        framebuffer_ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebuffer_ci.width = swapchain.extent.width;
-        framebuffer_ci.height = swapchain.extent.height;
-        framebuffer_ci.attachmentCount = fb_attachments.size();
-        framebuffer_ci.pAttachments = fb_attachments.data();
-        framebuffer_ci.renderPass = swapchain.render_pass;
-        framebuffer_ci.layers = 1;
-    
-        if (vkCreateFramebuffer(device, &framebuffer_ci, nullptr, &swapchain.framebuffers[i]) != VK_SUCCESS) {
-            throw std::runtime_error("Could not create framebuffer.");
-        }
-    }
+    create_framebuffers(device, swapchain);
 
     return swapchain;
 }
 
 
-static void destroy_swapchain(VkDevice device, Swapchain& swapchain) {
-    vkDestroyRenderPass(device, swapchain.render_pass, nullptr);
-    
+// Stands in for the swapchain when there is no surface. The images are left
+// in TRANSFER_SRC_OPTIMAL for readback.
+static Swapchain create_offscreen_targets(const VulkanContext& vk,
+                                          uint32_t width,
+                                          uint32_t height) {
+    VkDevice device = vk.device;
+    Swapchain swapchain;
+    swapchain.handle = VK_NULL_HANDLE;
+    swapchain.format = {VK_FORMAT_R8G8B8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    swapchain.extent = {width, height};
+
+    const VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
+    swapchain.depth_image = allocate_image(vk,
+                                           depth_format,
+                                           VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                           VK_IMAGE_ASPECT_DEPTH_BIT,
+                                           width,
+                                           height);
+
+    swapchain.render_pass = create_render_pass(device, swapchain.format.format, depth_format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VulkanImage image = allocate_image(vk,
+                                           swapchain.format.format,
+                                           VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                           VK_IMAGE_ASPECT_COLOR_BIT,
+                                           width,
+                                           height);
+        swapchain.offscreen_images.push_back(image);
+        swapchain.images.push_back(image.handle);
+        swapchain.image_views.push_back(image.view);
+    }
+
+    swapchain.frames.resize(MAX_FRAMES_IN_FLIGHT, -1);
+
+    create_framebuffers(device, swapchain);
+
+    return swapchain;
+}
+
+static void destroy_swapchain(const VulkanContext& vk, Swapchain& swapchain) {
+    VkDevice device = vk.device;
     for (size_t i = 0; i < swapchain.images.size(); i++) {
         vkDestroyFramebuffer(device, swapchain.framebuffers[i], nullptr);
-        vkDestroyImageView(device, swapchain.image_views[i], nullptr);
     }
-    destroy_image(device, swapchain.depth_image);
 
-    vkDestroySwapchainKHR(device, swapchain.handle, nullptr);
+    if (swapchain.handle == VK_NULL_HANDLE) {
+        for (VulkanImage& image : swapchain.offscreen_images) {
+            destroy_image(vk, image);
+        }
+    } else {
+        for (size_t i = 0; i < swapchain.images.size(); i++) {
+            vkDestroyImageView(device, swapchain.image_views[i], nullptr);
+        }
+        vkDestroySwapchainKHR(device, swapchain.handle, nullptr);
+    }
+    destroy_image(vk, swapchain.depth_image);
+
+    vkDestroyRenderPass(device, swapchain.render_pass, nullptr);
 }
 
 void recreate_swapchain(VulkanGraphicsContext& ctx) {
     vkWaitForFences(ctx.vk->device, MAX_FRAMES_IN_FLIGHT, ctx.frame_finished, VK_TRUE, UINT64_MAX);
-    Swapchain new_swapchain = create_swapchain(ctx.vk->device, ctx.vk->physical_device, ctx.surface, ctx.swapchain.handle);
-    destroy_swapchain(ctx.vk->device, ctx.swapchain);
+    Swapchain new_swapchain = create_swapchain(*ctx.vk, ctx.surface, ctx.swapchain.handle);
+    destroy_swapchain(*ctx.vk, ctx.swapchain);
     ctx.swapchain = new_swapchain;
 }
 
@@ -308,6 +395,10 @@ static void window_init(VulkanGraphicsContext& ctx, const WMContext* wm) {
         throw std::runtime_error("Surface does not support presentation.");
     }
 
+    ctx.swapchain = create_swapchain(*ctx.vk, ctx.surface);
+}
+
+static void frame_resources_init(VulkanGraphicsContext& ctx) {
     VkCommandPoolCreateInfo command_pool_ci{};
     command_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     command_pool_ci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -317,8 +408,6 @@ static void window_init(VulkanGraphicsContext& ctx, const WMContext* wm) {
         throw std::runtime_error("Could not create command pool.");
     }
 
-    ctx.swapchain = create_swapchain(ctx.vk->device, ctx.vk->physical_device, ctx.surface);
-
     ctx.command_buffers.resize(ctx.swapchain.images.size());
     
     VkCommandBufferAllocateInfo command_buffer_ai{};
@@ -341,6 +430,8 @@ static void window_init(VulkanGraphicsContext& ctx, const WMContext* wm) {
             throw std::runtime_error("Could not create sync objects for frame.");
         }
     }
+
+    frame_ring_init(*ctx.vk, MAX_FRAMES_IN_FLIGHT, ctx.frame_ring);
 }
 
 static void pipeline_init(VulkanGraphicsContext& ctx) {
@@ -510,12 +601,103 @@ static void pipeline_init(VulkanGraphicsContext& ctx) {
     if (vkCreateGraphicsPipelines(ctx.vk->device, VK_NULL_HANDLE, 1, &pipeline_ci, nullptr, &ctx.pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Could not create graphics pipeline.");
     }
+
+    // The compact pipeline only differs in vertex input, the formats do the
+    // unpacking and compact.vert decodes normals.
+    VkPipelineShaderStageCreateInfo compact_vertex_shader_stage = vertex_shader_stage;
+    compact_vertex_shader_stage.module = create_shader_module(ctx.vk->device, "shaders/compact.vert.spv");
+    ctx.shaders.push_back(compact_vertex_shader_stage.module);
+    shader_stages[0] = compact_vertex_shader_stage;
+
+    std::vector<VkVertexInputAttributeDescription> compact_vertex_attributes = {
+        {
+            // position :
+            0,                                       // location
+            0,                                       // binding
+            VK_FORMAT_R16G16B16A16_UNORM,            // format
+            offsetof(CompactVertex, position),       // offset
+        },
+        {
+            // UV :
+            1,                                       // location
+            0,                                       // binding
+            VK_FORMAT_R16G16_SFLOAT,                 // format
+            offsetof(CompactVertex, uv),             // offset
+        },
+        {
+            // Normal :
+            2,                                       // location
+            0,                                       // binding
+            VK_FORMAT_R16G16_SNORM,                  // format
+            offsetof(CompactVertex, normal),         // offset
+        },
+        {
+            // Color :
+            3,                                       // location
+            1,                                       // binding
+            VK_FORMAT_R8G8B8A8_UNORM,                // format
+            0,                                       // offset
+        },
+    };
+
+    std::vector<VkVertexInputBindingDescription> compact_vertex_bindings = {
+        {
+            // pos/uv/normal :
+            0,                           // binding
+            sizeof(CompactVertex),       // stride
+            VK_VERTEX_INPUT_RATE_VERTEX, // input rate
+        },
+        {
+            // Color :
+            1,                           // binding
+            sizeof(uint32_t),            // stride
+            VK_VERTEX_INPUT_RATE_VERTEX, // input rate
+        },
+    };
+
+    VkPipelineVertexInputStateCreateInfo compact_vertex_input = vertex_input;
+    compact_vertex_input.vertexBindingDescriptionCount = compact_vertex_bindings.size();
+    compact_vertex_input.pVertexBindingDescriptions = compact_vertex_bindings.data();
+    compact_vertex_input.vertexAttributeDescriptionCount = compact_vertex_attributes.size();
+    compact_vertex_input.pVertexAttributeDescriptions = compact_vertex_attributes.data();
+
+    pipeline_ci.pStages = shader_stages.data();
+    pipeline_ci.pVertexInputState = &compact_vertex_input;
+
+    if (vkCreateGraphicsPipelines(ctx.vk->device, VK_NULL_HANDLE, 1, &pipeline_ci, nullptr, &ctx.compact_pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Could not create compact graphics pipeline.");
+    }
 }
 
 void graphics_init(const VulkanContext* ctx, const WMContext* wm, VulkanGraphicsContext& graphics) {
     graphics.vk = ctx;
+    graphics.headless = false;
     
     window_init(graphics, wm);
+    frame_resources_init(graphics);
+    pipeline_init(graphics);
+    graphics.next_frame = 0;
+}
+
+void graphics_init_headless(const VulkanContext* ctx,
+                            uint32_t width,
+                            uint32_t height,
+                            bool readback,
+                            VulkanGraphicsContext& graphics) {
+    graphics.vk = ctx;
+    graphics.wm = nullptr;
+    graphics.surface = VK_NULL_HANDLE;
+    graphics.headless = true;
+
+    graphics.swapchain = create_offscreen_targets(*ctx, width, height);
+    frame_resources_init(graphics);
+
+    if (readback) {
+        for (size_t i = 0; i < graphics.swapchain.images.size(); i++) {
+            graphics.readback_buffers.push_back(gpu_buffer_allocate<uint32_t>(*ctx, TRANSFER_DST | HOST_ACCESS, width * height));
+        }
+    }
+
     pipeline_init(graphics);
     graphics.next_frame = 0;
 }
@@ -532,19 +714,28 @@ void graphics_finalize(VulkanGraphicsContext& ctx) {
         vkDestroyShaderModule(ctx.vk->device, shader, nullptr);
     }
     vkDestroyPipeline(ctx.vk->device, ctx.pipeline, nullptr);
+    vkDestroyPipeline(ctx.vk->device, ctx.compact_pipeline, nullptr);
     vkDestroyPipelineLayout(ctx.vk->device, ctx.pipeline_layout, nullptr);
 
     // Window :
-    destroy_swapchain(ctx.vk->device, ctx.swapchain);
+    destroy_swapchain(*ctx.vk, ctx.swapchain);
     
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroyFence(ctx.vk->device, ctx.frame_finished[i], nullptr);
         vkDestroySemaphore(ctx.vk->device, ctx.swapchain_image_ready[i], nullptr);
         vkDestroySemaphore(ctx.vk->device, ctx.swapchain_submit_done[i], nullptr);
     }
+    frame_ring_finalize(*ctx.vk, ctx.frame_ring);
     
     vkDestroyCommandPool(ctx.vk->device, ctx.command_pool, nullptr);
-    vkDestroySurfaceKHR(ctx.vk->instance, ctx.surface, nullptr);
+    if (!ctx.headless) {
+        vkDestroySurfaceKHR(ctx.vk->instance, ctx.surface, nullptr);
+    }
+
+    for (VulkanBuffer<uint32_t>& buffer : ctx.readback_buffers) {
+        gpu_buffer_free(*ctx.vk, buffer);
+    }
+    ctx.readback_buffers.clear();
 
 }
 
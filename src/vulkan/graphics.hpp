@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
 
+#include "frame_ring.hpp"
 #include "gpu.hpp"
 
 #include "../platform_wm.hpp"
@@ -12,6 +13,7 @@
 #define MAX_FRAMES_IN_FLIGHT 3
 
 struct Swapchain {
+    // VK_NULL_HANDLE for headless contexts.
     VkSwapchainKHR handle;
     
     VkExtent2D extent;
@@ -24,11 +26,16 @@ struct Swapchain {
     std::vector<VkImageView> image_views;
     std::vector<int64_t> frames;
     std::vector<VkFramebuffer> framebuffers;
+
+    // Headless only, the images behind images and image_views.
+    std::vector<VulkanImage> offscreen_images;
 };
 
 struct VulkanGraphicsContext {
     const VulkanContext* vk;
+    // nullptr for headless contexts.
     const WMContext* wm;
+    bool headless;
     
     VkCommandPool command_pool;
     std::vector<VkCommandBuffer> command_buffers;
@@ -36,6 +43,8 @@ struct VulkanGraphicsContext {
     VkPipelineLayout pipeline_layout;
     std::vector<VkShaderModule> shaders;
     VkPipeline pipeline;
+    // Same as pipeline, for VERTEX_FORMAT_COMPACT meshes.
+    VkPipeline compact_pipeline;
 
     Swapchain swapchain;
     uint32_t next_frame;
@@ -43,15 +52,23 @@ struct VulkanGraphicsContext {
     VkSemaphore swapchain_image_ready[MAX_FRAMES_IN_FLIGHT];
     VkSemaphore swapchain_submit_done[MAX_FRAMES_IN_FLIGHT];
     VkFence frame_finished[MAX_FRAMES_IN_FLIGHT];
+    // One slice per frame in flight.
+    FrameRing frame_ring;
 
     VkSurfaceKHR surface;
+
+    // Headless only, one per offscreen image, empty without readback.
+    std::vector<VulkanBuffer<uint32_t>> readback_buffers;
 };
 
 struct VulkanFrame {
     VkCommandBuffer command_buffer;
     VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+    VkPipeline compact_pipeline;
     uint32_t frame_index;
     uint32_t image_index;
+    VkExtent2D extent;
 };
 
 struct PushMatrices {
@@ -19,6 +19,12 @@ VkBufferUsageFlags to_vulkan_flags(uint32_t usage) {
     if (usage & STORAGE_BUFFER) {
         rval |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
     }
+    if (usage & TRANSFER_DST) {
+        rval |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    }
+    if (usage & TRANSFER_SRC) {
+        rval |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    }
 
     return rval;
 }
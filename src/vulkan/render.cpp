@@ -5,20 +5,8 @@
 
 #include <iostream>
 
-VulkanFrame begin_frame(VulkanGraphicsContext& ctx) {
-    VulkanFrame frame;
-    frame.frame_index = ctx.next_frame;
-    frame.command_buffer = ctx.command_buffers[frame.frame_index % ctx.swapchain.images.size()];
-    frame.pipeline_layout = ctx.pipeline_layout;
-    
-    ctx.next_frame++;
-    
-    uint32_t current_frame_in_flight = frame.frame_index % MAX_FRAMES_IN_FLIGHT;
-        
-    // Wait until the current frame is done rendering.
-    vkWaitForFences(ctx.vk->device, 1, &ctx.frame_finished[current_frame_in_flight], VK_TRUE, UINT64_MAX);
-
-    VkResult acquire_result; 
+static void acquire_image(VulkanGraphicsContext& ctx, uint32_t current_frame_in_flight, VulkanFrame& frame) {
+    VkResult acquire_result;
     do {
         acquire_result = vkAcquireNextImageKHR(ctx.vk->device,
                                                ctx.swapchain.handle,
@@ -44,6 +32,30 @@ VulkanFrame begin_frame(VulkanGraphicsContext& ctx) {
             break;
         }
     } while (acquire_result != VK_SUCCESS);
+}
+
+VulkanFrame begin_frame(VulkanGraphicsContext& ctx) {
+    VulkanFrame frame;
+    frame.frame_index = ctx.next_frame;
+    frame.command_buffer = ctx.command_buffers[frame.frame_index % ctx.swapchain.images.size()];
+    frame.pipeline_layout = ctx.pipeline_layout;
+    frame.pipeline = ctx.pipeline;
+    frame.compact_pipeline = ctx.compact_pipeline;
+    frame.extent = ctx.swapchain.extent;
+    
+    ctx.next_frame++;
+    
+    uint32_t current_frame_in_flight = frame.frame_index % MAX_FRAMES_IN_FLIGHT;
+        
+    // Wait until the current frame is done rendering.
+    vkWaitForFences(ctx.vk->device, 1, &ctx.frame_finished[current_frame_in_flight], VK_TRUE, UINT64_MAX);
+    frame_ring_begin(ctx.frame_ring, current_frame_in_flight);
+
+    if (ctx.headless) {
+        frame.image_index = frame.frame_index % ctx.swapchain.images.size();
+    } else {
+        acquire_image(ctx, current_frame_in_flight, frame);
+    }
 
     // Make sure we're not rendering to an image that is being used by another in-flight frame
     if (ctx.swapchain.frames[frame.image_index] >= 0) {
@@ -110,31 +122,79 @@ VulkanFrame begin_frame(VulkanGraphicsContext& ctx) {
 void end_frame(const VulkanGraphicsContext &ctx, GraphicsFrame &frame) {
     // Finish recording command buffer
     vkCmdEndRenderPass(frame.command_buffer);
+
+    if (ctx.headless && !ctx.readback_buffers.empty()) {
+        // The render pass leaves the image in TRANSFER_SRC_OPTIMAL and waits
+        // for the color writes before transfers.
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {ctx.swapchain.extent.width, ctx.swapchain.extent.height, 1};
+
+        vkCmdCopyImageToBuffer(frame.command_buffer,
+                               ctx.swapchain.images[frame.image_index],
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               ctx.readback_buffers[frame.image_index].handle,
+                               1,
+                               &region);
+
+        VkMemoryBarrier host_barrier{};
+        host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(frame.command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1, &host_barrier,
+                             0, nullptr,
+                             0, nullptr);
+    }
+    
     vkEndCommandBuffer(frame.command_buffer);
 
+    // Uploads recorded since the last frame go first on the same queue.
+    // Asynchronous ones are submitted on their own, the frame only waits on
+    // those already finished.
+    staging_flush(*ctx.vk, *ctx.vk->transfer);
+    staging_flush(*ctx.vk, *ctx.vk->staging);
+
+    std::vector<VkSemaphore> wait_semaphores;
+    staging_collect_waits(*ctx.vk, *ctx.vk->transfer, STAGING_CONSUMER_GRAPHICS, wait_semaphores);
+
     // Submit command buffer
     VkQueue queue;
     vkGetDeviceQueue(ctx.vk->device, ctx.vk->graphics_queue_idx, 0, &queue);
 
     uint32_t current_frame_in_flight = frame.frame_index % MAX_FRAMES_IN_FLIGHT;    
     
-    VkPipelineStageFlags submit_wait_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    std::vector<VkPipelineStageFlags> wait_stage_masks(wait_semaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    if (!ctx.headless) {
+        wait_semaphores.push_back(ctx.swapchain_image_ready[current_frame_in_flight]);
+        wait_stage_masks.push_back(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    }
 
     VkSubmitInfo submit_info{};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &frame.command_buffer;
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = &ctx.swapchain_image_ready[current_frame_in_flight];
-    submit_info.pWaitDstStageMask = &submit_wait_stage_mask;
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = &ctx.swapchain_submit_done[current_frame_in_flight];
+    submit_info.waitSemaphoreCount = wait_semaphores.size();
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stage_masks.data();
+    if (!ctx.headless) {
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &ctx.swapchain_submit_done[current_frame_in_flight];
+    }
 
     vkResetFences(ctx.vk->device, 1, &ctx.frame_finished[current_frame_in_flight]);
     if (vkQueueSubmit(queue, 1, &submit_info, ctx.frame_finished[current_frame_in_flight]) != VK_SUCCESS) {
         throw std::runtime_error("Could not submit commands.");
     }
 
+    if (ctx.headless) {
+        return;
+    }
+
     VkPresentInfoKHR present_info{};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.swapchainCount = 1;
@@ -159,10 +219,16 @@ void end_frame(const VulkanGraphicsContext &ctx, GraphicsFrame &frame) {
 }
 
 void draw_mesh(const GraphicsFrame& frame,
-               const GPUMesh& mesh) {
+               const GPUMesh& mesh,
+               uint32_t lod) {
+    bool compact = mesh.vertex_format == VERTEX_FORMAT_COMPACT;
+    vkCmdBindPipeline(frame.command_buffer,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      compact ? frame.compact_pipeline : frame.pipeline);
+
     VkBuffer bind_buffers[] = {
-        mesh.vertex_buffer.handle,
-        mesh.color_buffer.handle,
+        compact ? mesh.compact_vertex_buffer.handle : mesh.vertex_buffer.handle,
+        compact ? mesh.compact_color_buffer.handle : mesh.color_buffer.handle,
     };
     VkDeviceSize bind_offsets[] = {
         0,
@@ -174,9 +240,17 @@ void draw_mesh(const GraphicsFrame& frame,
                            ARRAY_SIZE(bind_buffers),
                            bind_buffers,
                            bind_offsets);
-    vkCmdBindIndexBuffer(frame.command_buffer, mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+    if (mesh.index_type == INDEX_TYPE_UINT16) {
+        vkCmdBindIndexBuffer(frame.command_buffer, mesh.index_buffer_16.handle, 0, VK_INDEX_TYPE_UINT16);
+    } else {
+        vkCmdBindIndexBuffer(frame.command_buffer, mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+    }
 	
-    vkCmdDrawIndexed(frame.command_buffer, mesh.index_buffer.count, 1, 0, 0, 0);
+    if (mesh.lods.empty()) {
+        vkCmdDrawIndexed(frame.command_buffer, mesh.index_count, 1, 0, 0, 0);
+    } else {
+        vkCmdDrawIndexed(frame.command_buffer, mesh.lods[lod].index_count, 1, mesh.lods[lod].index_offset, 0, 0);
+    }
 }
 
 void draw_model(const GraphicsFrame& frame,
@@ -185,7 +259,8 @@ void draw_model(const GraphicsFrame& frame,
                 const GPUModel& model) {
     PushMatrices push;
     push.model_view = view * model.transform;
-    push.mvp = proj * push.model_view;
+    // Normals do not go through the dequantization scale.
+    push.mvp = proj * push.model_view * model.mesh->dequantize;
 
     vkCmdPushConstants(frame.command_buffer,
                        frame.pipeline_layout,
@@ -194,5 +269,18 @@ void draw_model(const GraphicsFrame& frame,
                        sizeof(PushMatrices),
                        &push);
     
-    draw_mesh(frame, *model.mesh);
+    uint32_t lod = select_mesh_lod(*model.mesh, push.model_view, proj, frame.extent.height);
+    draw_mesh(frame, *model.mesh, lod);
+}
+
+void graphics_read_frame(const VulkanGraphicsContext& ctx, const VulkanFrame& frame, uint32_t* pixels) {
+    if (ctx.readback_buffers.empty()) {
+        throw std::runtime_error("Frames can only be read back from headless contexts with readback.");
+    }
+
+    vkWaitForFences(ctx.vk->device, 1, &ctx.frame_finished[frame.frame_index % MAX_FRAMES_IN_FLIGHT], VK_TRUE, UINT64_MAX);
+
+    const VulkanBuffer<uint32_t>& buffer = ctx.readback_buffers[frame.image_index];
+    gpu_buffer_invalidate(*ctx.vk, buffer, 0, buffer.count);
+    memcpy(pixels, buffer.mapped, buffer.count * sizeof(uint32_t));
 }
@@ -0,0 +1,333 @@
+#include "staging.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Uploads are split in copies of at most this size, so that a copy never
+// needs the whole ring to itself.
+static const VkDeviceSize STAGING_MAX_COPY_SIZE = STAGING_RING_SIZE / 2;
+static const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void staging_init(const VulkanContext& vk, uint32_t queue_family, StagingRing& ring) {
+    ring.buffer = gpu_buffer_allocate<char>(vk, TRANSFER_SRC | HOST_ACCESS, STAGING_RING_SIZE);
+    ring.mapped = ring.buffer.mapped;
+    ring.head = 0;
+    ring.used = 0;
+
+    ring.queue_family = queue_family;
+    vkGetDeviceQueue(vk.device, queue_family, 0, &ring.queue);
+
+    VkCommandPoolCreateInfo command_pool_ci{};
+    command_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_ci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    command_pool_ci.queueFamilyIndex = queue_family;
+
+    if (vkCreateCommandPool(vk.device, &command_pool_ci, nullptr, &ring.command_pool) != VK_SUCCESS) {
+        throw std::runtime_error("Could not create staging command pool.");
+    }
+
+    VkCommandBuffer command_buffers[STAGING_BATCH_COUNT];
+    VkCommandBufferAllocateInfo command_buffer_ai{};
+    command_buffer_ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_ai.commandPool = ring.command_pool;
+    command_buffer_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_ai.commandBufferCount = STAGING_BATCH_COUNT;
+
+    if (vkAllocateCommandBuffers(vk.device, &command_buffer_ai, command_buffers) != VK_SUCCESS) {
+        throw std::runtime_error("Could not allocate staging command buffers.");
+    }
+
+    VkFenceCreateInfo fence_ci{};
+    fence_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkSemaphoreCreateInfo semaphore_ci{};
+    semaphore_ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (uint32_t i = 0; i < STAGING_BATCH_COUNT; i++) {
+        StagingBatch& batch = ring.batches[i];
+        batch.command_buffer = command_buffers[i];
+        if (vkCreateFence(vk.device, &fence_ci, nullptr, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("Could not create staging fence.");
+        }
+        for (uint32_t consumer = 0; consumer < STAGING_CONSUMER_COUNT; consumer++) {
+            if (vkCreateSemaphore(vk.device, &semaphore_ci, nullptr, &batch.semaphores[consumer]) != VK_SUCCESS) {
+                throw std::runtime_error("Could not create staging semaphore.");
+            }
+            batch.semaphores_pending[consumer] = false;
+        }
+        batch.ticket = 0;
+        batch.size = 0;
+        batch.copy_count = 0;
+        batch.submitted = false;
+    }
+    ring.current = 0;
+    ring.next_ticket = 1;
+    ring.finished_ticket = 0;
+}
+
+void staging_finalize(const VulkanContext& vk, StagingRing& ring) {
+    // Copies never submitted are dropped, their destinations may be gone.
+    StagingBatch& current = ring.batches[ring.current];
+    if (current.copy_count > 0) {
+        vkEndCommandBuffer(current.command_buffer);
+    }
+
+    for (StagingBatch& batch : ring.batches) {
+        if (batch.submitted) {
+            vkWaitForFences(vk.device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        }
+        vkDestroyFence(vk.device, batch.fence, nullptr);
+        for (VkSemaphore semaphore : batch.semaphores) {
+            vkDestroySemaphore(vk.device, semaphore, nullptr);
+        }
+    }
+    vkDestroyCommandPool(vk.device, ring.command_pool, nullptr);
+
+    gpu_buffer_free(vk, ring.buffer);
+}
+
+static void retire_batch(const VulkanContext& vk, StagingRing& ring, StagingBatch& batch) {
+    if (!batch.submitted) {
+        return;
+    }
+
+    vkWaitForFences(vk.device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    ring.used -= batch.size;
+    ring.finished_ticket = std::max(ring.finished_ticket, batch.ticket);
+    batch.size = 0;
+    batch.submitted = false;
+}
+
+// Retires the finished batches, oldest first, without blocking. The
+// current batch is the oldest when it is still in flight.
+static void poll_batches(const VulkanContext& vk, StagingRing& ring) {
+    for (uint32_t i = 0; i < STAGING_BATCH_COUNT; i++) {
+        StagingBatch& batch = ring.batches[(ring.current + i) % STAGING_BATCH_COUNT];
+        if (!batch.submitted) {
+            continue;
+        }
+        if (vkGetFenceStatus(vk.device, batch.fence) != VK_SUCCESS) {
+            break;
+        }
+        retire_batch(vk, ring, batch);
+    }
+}
+
+static bool signals_semaphores(const VulkanContext& vk, const StagingRing& ring) {
+    return ring.queue_family != vk.graphics_queue_idx;
+}
+
+static VkQueue consumer_queue(const VulkanContext& vk, StagingConsumer consumer) {
+    uint32_t family = consumer == STAGING_CONSUMER_GRAPHICS ? vk.graphics_queue_idx : vk.compute_queue_idx;
+    VkQueue queue;
+    vkGetDeviceQueue(vk.device, family, 0, &queue);
+    return queue;
+}
+
+static void begin_batch(StagingRing& ring, StagingBatch& batch) {
+    batch.ticket = ring.next_ticket;
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch.command_buffer, &begin_info);
+
+    // Earlier frames may still read or write the buffers being overwritten.
+    // This only covers work on the ring's own queue, asynchronous uploads
+    // never target buffers in use.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(batch.command_buffer,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+}
+
+void staging_flush(const VulkanContext& vk, StagingRing& ring, bool wait) {
+    StagingBatch& batch = ring.batches[ring.current];
+    if (batch.copy_count > 0) {
+        // Makes the copies visible to everything submitted after them.
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(batch.command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0,
+                             1, &barrier,
+                             0, nullptr,
+                             0, nullptr);
+        vkEndCommandBuffer(batch.command_buffer);
+
+        // A binary semaphore is waited on before being signaled again. When a
+        // consumer did not submit anything since this batch last finished, an
+        // empty submission takes its place.
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        for (uint32_t consumer = 0; consumer < STAGING_CONSUMER_COUNT; consumer++) {
+            if (!batch.semaphores_pending[consumer]) {
+                continue;
+            }
+
+            VkSubmitInfo wait_info{};
+            wait_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            wait_info.waitSemaphoreCount = 1;
+            wait_info.pWaitSemaphores = &batch.semaphores[consumer];
+            wait_info.pWaitDstStageMask = &wait_stage;
+            VkQueue queue = consumer_queue(vk, static_cast<StagingConsumer>(consumer));
+            if (vkQueueSubmit(queue, 1, &wait_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("Could not submit staging semaphore wait.");
+            }
+            batch.semaphores_pending[consumer] = false;
+        }
+
+        VkSubmitInfo submit_info{};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &batch.command_buffer;
+        if (signals_semaphores(vk, ring)) {
+            submit_info.signalSemaphoreCount = STAGING_CONSUMER_COUNT;
+            submit_info.pSignalSemaphores = batch.semaphores;
+            for (bool& pending : batch.semaphores_pending) {
+                pending = true;
+            }
+        }
+
+        vkResetFences(vk.device, 1, &batch.fence);
+        if (vkQueueSubmit(ring.queue, 1, &submit_info, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("Could not submit staging copies.");
+        }
+        batch.submitted = true;
+        batch.copy_count = 0;
+        ring.next_ticket++;
+
+        // The next batch is the oldest one. It may still be in flight, the
+        // next upload waits for it rather than the frame submitting this.
+        ring.current = (ring.current + 1) % STAGING_BATCH_COUNT;
+    }
+
+    if (wait) {
+        for (StagingBatch& submitted : ring.batches) {
+            retire_batch(vk, ring, submitted);
+        }
+    }
+}
+
+// Returns the ring offset of size free bytes. Space is released in
+// submission order, so the bytes in use always follow each other.
+static VkDeviceSize reserve(const VulkanContext& vk, StagingRing& ring, VkDeviceSize size) {
+    size = (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+    while (true) {
+        // The batch the copy goes to has to be done with its last submission.
+        retire_batch(vk, ring, ring.batches[ring.current]);
+        if (ring.used == 0) {
+            ring.head = 0;
+        }
+
+        // A copy never straddles the end of the ring, the rest of it is skipped.
+        VkDeviceSize padding = ring.head + size > STAGING_RING_SIZE ? STAGING_RING_SIZE - ring.head : 0;
+        if (ring.used + padding + size <= STAGING_RING_SIZE) {
+            VkDeviceSize offset = padding > 0 ? 0 : ring.head;
+            ring.head = offset + size;
+            ring.used += padding + size;
+            ring.batches[ring.current].size += padding + size;
+            return offset;
+        }
+
+        // Submit what is recorded, the oldest batch becomes the current one
+        // and is waited on above. With nothing recorded, wait for the oldest
+        // batch in flight.
+        if (ring.batches[ring.current].copy_count > 0) {
+            staging_flush(vk, ring);
+            continue;
+        }
+        for (uint32_t i = 1; i < STAGING_BATCH_COUNT; i++) {
+            StagingBatch& oldest = ring.batches[(ring.current + i) % STAGING_BATCH_COUNT];
+            if (oldest.submitted) {
+                retire_batch(vk, ring, oldest);
+                break;
+            }
+        }
+    }
+}
+
+StagingTicket staging_upload(const VulkanContext& vk,
+                             StagingRing& ring,
+                             VkBuffer dst,
+                             VkDeviceSize dst_offset,
+                             const void* data,
+                             VkDeviceSize size) {
+    const char* bytes = static_cast<const char*>(data);
+    StagingTicket ticket = 0;
+
+    while (size > 0) {
+        VkDeviceSize copy_size = std::min(size, STAGING_MAX_COPY_SIZE);
+        VkDeviceSize offset = reserve(vk, ring, copy_size);
+        memcpy(ring.mapped + offset, bytes, copy_size);
+        gpu_buffer_flush(vk, ring.buffer, offset, copy_size);
+
+        StagingBatch& batch = ring.batches[ring.current];
+        if (batch.copy_count == 0) {
+            begin_batch(ring, batch);
+        }
+        ticket = batch.ticket;
+
+        VkBufferCopy region{};
+        region.srcOffset = offset;
+        region.dstOffset = dst_offset;
+        region.size = copy_size;
+        vkCmdCopyBuffer(batch.command_buffer, ring.buffer.handle, dst, 1, &region);
+        batch.copy_count++;
+
+        bytes += copy_size;
+        dst_offset += copy_size;
+        size -= copy_size;
+    }
+
+    return ticket;
+}
+
+bool staging_ticket_done(const VulkanContext& vk, StagingRing& ring, StagingTicket ticket) {
+    if (ticket <= ring.finished_ticket) {
+        return true;
+    }
+    if (ticket >= ring.next_ticket) {
+        // Still recording.
+        return false;
+    }
+
+    poll_batches(vk, ring);
+    return ticket <= ring.finished_ticket;
+}
+
+void staging_collect_waits(const VulkanContext& vk,
+                           StagingRing& ring,
+                           StagingConsumer consumer,
+                           std::vector<VkSemaphore>& semaphores) {
+    if (!signals_semaphores(vk, ring)) {
+        return;
+    }
+
+    poll_batches(vk, ring);
+    for (StagingBatch& batch : ring.batches) {
+        if (batch.semaphores_pending[consumer] && !batch.submitted) {
+            semaphores.push_back(batch.semaphores[consumer]);
+            batch.semaphores_pending[consumer] = false;
+        }
+    }
+}
+
+bool staging_has_room(const VulkanContext& vk, StagingRing& ring, VkDeviceSize size) {
+    poll_batches(vk, ring);
+
+    // Padding at the end of the ring is less than one copy, and each copy
+    // is rounded up to STAGING_ALIGNMENT.
+    // More than the ring only fits in an empty one, and still blocks while
+    // it is split.
+    VkDeviceSize worst_case = std::min(2 * size + 64 * STAGING_ALIGNMENT, STAGING_RING_SIZE);
+    return !ring.batches[ring.current].submitted && ring.used + worst_case <= STAGING_RING_SIZE;
+}
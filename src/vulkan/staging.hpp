@@ -0,0 +1,100 @@
+#pragma once
+
+#include "gpu.hpp"
+
+// Host visible ring that gpu_buffer_upload writes into, recording copies to
+// device local buffers. Copies accumulate in one command buffer until
+// staging_flush submits them, which end_frame and compute_kernel_invoke do
+// before their own submissions.
+//
+// The context has one ring on the graphics queue, whose copies are ordered
+// before everything submitted after them, and one for asynchronous uploads
+// on the transfer queue, the same ring when there is no dedicated transfer
+// family. Asynchronous copies signal one semaphore per consuming queue, that
+// the first submission to it after they are seen finished waits on, so they
+// never hold back a frame. staging_flush never blocks either, only uploads
+// wait when the ring is full or STAGING_BATCH_COUNT batches are in flight,
+// which callers streaming data avoid with staging_has_room.
+static const VkDeviceSize STAGING_RING_SIZE = VkDeviceSize(32) << 20;
+// Submitted batches the ring can wait on before reusing their space.
+static const uint32_t STAGING_BATCH_COUNT = 4;
+
+// Queues that use the buffers written by asynchronous copies.
+enum StagingConsumer : uint32_t {
+    STAGING_CONSUMER_GRAPHICS,
+    STAGING_CONSUMER_COMPUTE,
+    STAGING_CONSUMER_COUNT,
+};
+
+// Identifies the batch an upload was recorded in. Batches finish in order,
+// 0 is always finished.
+using StagingTicket = uint64_t;
+
+struct StagingBatch {
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    // Signaled with fence by rings on another family than the graphics one,
+    // pending until a submission to their consumer waits on them.
+    VkSemaphore semaphores[STAGING_CONSUMER_COUNT];
+    bool semaphores_pending[STAGING_CONSUMER_COUNT];
+    StagingTicket ticket;
+    // Ring bytes the batch holds, padding at the end of the ring included.
+    VkDeviceSize size;
+    uint32_t copy_count;
+    bool submitted;
+};
+
+// Used only from the thread driving the frame loop.
+struct StagingRing {
+    VulkanBuffer<char> buffer;
+    char* mapped;
+
+    // Next byte to write, and bytes in use before it, wrapping around.
+    VkDeviceSize head;
+    VkDeviceSize used;
+
+    uint32_t queue_family;
+    VkQueue queue;
+    VkCommandPool command_pool;
+    StagingBatch batches[STAGING_BATCH_COUNT];
+    // The batch being recorded, the others are submitted or idle.
+    uint32_t current;
+
+    // Ticket of the batch being recorded, and last one known finished.
+    StagingTicket next_ticket;
+    StagingTicket finished_ticket;
+};
+
+void staging_init(const VulkanContext& vk, uint32_t queue_family, StagingRing& ring);
+void staging_finalize(const VulkanContext& vk, StagingRing& ring);
+
+// Copies size bytes to the ring and records their copy to dst. Larger
+// uploads are split, submitting and waiting on earlier batches when the
+// ring is full. Returns the ticket of the last batch used.
+StagingTicket staging_upload(const VulkanContext& vk,
+                             StagingRing& ring,
+                             VkBuffer dst,
+                             VkDeviceSize dst_offset,
+                             const void* data,
+                             VkDeviceSize size);
+
+// Submits the recorded copies, if any, without waiting on earlier batches.
+// For the graphics ring, later submissions to the graphics queue see them.
+// With wait, also blocks until they are done, for work on other queues.
+void staging_flush(const VulkanContext& vk, StagingRing& ring, bool wait = false);
+
+// Whether uploads of up to size bytes in total, in a few calls, can be
+// recorded without blocking.
+bool staging_has_room(const VulkanContext& vk, StagingRing& ring, VkDeviceSize size);
+
+// Whether the copies of ticket are done, without blocking. Their buffers
+// can be used by the submissions after the next staging_collect_waits.
+bool staging_ticket_done(const VulkanContext& vk, StagingRing& ring, StagingTicket ticket);
+
+// Appends the semaphores of consumer for the batches seen finished and not
+// waited on yet, for its next submission to wait on. They are already
+// signaled, waiting on them costs nothing.
+void staging_collect_waits(const VulkanContext& vk,
+                           StagingRing& ring,
+                           StagingConsumer consumer,
+                           std::vector<VkSemaphore>& semaphores);